@@ -0,0 +1,2190 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <queue>
+#include <random>
+#include <set>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "dungeon/bestFirst.hpp"
+#include "dungeon/contractionHierarchy.hpp"
+#include "dungeon/cooperativePlanner.hpp"
+#include "dungeon/deltaStepping.hpp"
+#include "dungeon/dstarLite.hpp"
+#include "dungeon/dungeonGenerator.hpp"
+#include "dungeon/dungeonUtils.hpp"
+#include "dungeon/firstMoves.hpp"
+#include "dungeon/grid.hpp"
+#include "dungeon/mapStore.hpp"
+#include "dungeon/pathsearch.hpp"
+#include "dungeon/queryTrace.hpp"
+#include "dungeon/searchScheduler.hpp"
+#include "dungeon/searchStats.hpp"
+#include "dungeon/serialization.hpp"
+#include "dungeon/sparseMap.hpp"
+#include "dungeon/walkableIndex.hpp"
+#include "dungeon/worldStreamer.hpp"
+#include "tileCache.hpp"
+
+
+namespace
+{
+
+// --key value pairs, everything after the mode name
+class Args
+{
+ public:
+  Args(int argc, char** argv, int first)
+  {
+    for (int i = first; i + 1 < argc; i += 2)
+    {
+      std::string key = argv[i];
+      if (key.starts_with("--"))
+        values_[key.substr(2)] = argv[i + 1];
+    }
+  }
+
+  int getInt(const std::string& key, int def) const
+  {
+    auto it = values_.find(key);
+    return it == values_.end() ? def : std::stoi(it->second);
+  }
+
+  std::string get(const std::string& key, std::string def) const
+  {
+    auto it = values_.find(key);
+    return it == values_.end() ? def : it->second;
+  }
+
+ private:
+  std::map<std::string, std::string> values_;
+};
+
+struct Measurement
+{
+  std::string name;
+  std::size_t queries{0};
+  std::size_t found{0};
+  double seconds{0};
+  dungeon::SearchStats stats;
+};
+
+using Clock = std::chrono::steady_clock;
+
+template<class F>
+double timed(F&& f)
+{
+  auto start = Clock::now();
+  f();
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// f's result, with the time it took added to seconds
+template<class F>
+auto timedInto(double& seconds, F&& f)
+{
+  auto start = Clock::now();
+  auto result = f();
+  seconds += std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+void report(const Args& args, const std::vector<Measurement>& measurements)
+{
+  const auto format = args.get("format", "json");
+  std::string out;
+
+  if (format == "csv")
+  {
+    out += fmt::format("name,queries,found,seconds,{}\n", dungeon::csvHeader());
+    for (const auto& m : measurements)
+      out += fmt::format("{},{},{},{},{}\n", m.name, m.queries, m.found, m.seconds, dungeon::toCsvRow(m.stats));
+  }
+  else
+  {
+    out += "[\n";
+    for (std::size_t i = 0; i < measurements.size(); ++i)
+    {
+      const auto& m = measurements[i];
+      out += fmt::format("  {{\"name\": \"{}\", \"queries\": {}, \"found\": {}, \"seconds\": {}, \"stats\": {}}}{}\n",
+        m.name, m.queries, m.found, m.seconds, dungeon::toJson(m.stats), i + 1 < measurements.size() ? "," : "");
+    }
+    out += "]\n";
+  }
+
+  const auto path = args.get("out", "");
+  if (path.empty())
+  {
+    std::fputs(out.c_str(), stdout);
+  }
+  else
+  {
+    std::ofstream file(path);
+    file << out;
+  }
+}
+
+// hierarchicalSearch only supports portal tiles as endpoints, query q goes between two of them.
+// There has to be at least one portal.
+std::pair<glm::ivec2, glm::ivec2> portalEndpoints(const dungeon::HierarchicalSearchData& hierarchy, std::size_t q)
+{
+  const auto& portals = hierarchy.portals;
+  return {portals[q * 7919 % portals.size()].topLeft, portals[q * 104729 % portals.size()].topLeft};
+}
+
+// Random queries against every search on freshly generated maps
+int benchQueries(const Args& args)
+{
+  const int size = args.getInt("size", 200);
+  const int maps = args.getInt("maps", 5);
+  const int queries = args.getInt("queries", 100);
+  const int cellSize = args.getInt("cell", 10);
+  const auto seed = static_cast<unsigned>(args.getInt("seed", 1));
+
+  Measurement build{.name = "buildHierarchy"};
+  Measurement aStar{.name = "aStar"};
+  Measurement weightedAStar{.name = "aStar_eps2"};
+  Measurement araStar{.name = "araStar"};
+  Measurement hierarchical{.name = "hierarchicalSearch"};
+
+  for (int map = 0; map < maps; ++map)
+  {
+    auto dungeon = dungeon::make_dungeon(size, size);
+    dungeon::gen_drunk_dungeon(dungeon.view, seed + static_cast<unsigned>(map));
+
+    dungeon::HierarchicalSearchData hierarchy;
+    build.seconds += timed([&]() { hierarchy = dungeon::buildHierarchy(dungeon.view, cellSize, &build.stats); });
+    ++build.queries;
+
+    const dungeon::WalkableIndex walkable{dungeon.view};
+    std::mt19937 engine{static_cast<unsigned>(map)};
+    std::vector<glm::ivec2> endpoints(2 * std::size_t(queries));
+    walkable.sample(std::span{endpoints}, engine);
+
+    for (int q = 0; q < queries; ++q)
+    {
+      const auto start = endpoints[2 * q];
+      const auto finish = endpoints[2 * q + 1];
+
+      auto run = [&](Measurement& m, auto&& search)
+        {
+          bool found = false;
+          m.seconds += timed([&]() { found = search(); });
+          ++m.queries;
+          m.found += found ? 1 : 0;
+        };
+
+      run(aStar, [&]()
+        { return !dungeon::aStar(dungeon.view, start, finish, 1.f, {.stats = &aStar.stats}).path.empty(); });
+      run(weightedAStar, [&]()
+        { return !dungeon::aStar(dungeon.view, start, finish, 2.f, {.stats = &weightedAStar.stats}).path.empty(); });
+      run(araStar, [&]()
+        {
+          bool found = false;
+          for (const auto& result : dungeon::araStar(dungeon.view, start, finish, 3.f, {.stats = &araStar.stats}))
+            found = !result.path.empty();
+          return found;
+        });
+
+      if (!hierarchy.portals.empty())
+      {
+        const auto portals = portalEndpoints(hierarchy, std::size_t(q));
+        run(hierarchical, [&]()
+          {
+            return !dungeon::hierarchicalSearch(dungeon.view, hierarchy, portals.first, portals.second,
+              {.stats = &hierarchical.stats}).path.empty();
+          });
+      }
+    }
+  }
+
+  report(args, {build, aStar, weightedAStar, araStar, hierarchical});
+  return 0;
+}
+
+// Preprocessing versus loading it back, then checks that the loaded hierarchy answers the same
+int benchSerialize(const Args& args)
+{
+  const int size = args.getInt("size", 200);
+  const int cellSize = args.getInt("cell", 10);
+  const int queries = args.getInt("queries", 100);
+  const auto path = args.get("file", "hierarchy.bin");
+  const auto seed = static_cast<unsigned>(args.getInt("seed", 1));
+
+  auto dungeon = dungeon::make_dungeon(size, size);
+  dungeon::gen_drunk_dungeon(dungeon.view, seed);
+
+  Measurement build{.name = "buildHierarchy", .queries = 1};
+  Measurement save{.name = "saveHierarchy", .queries = 1};
+  Measurement load{.name = "loadHierarchy", .queries = 1};
+
+  dungeon::HierarchicalSearchData built;
+  build.seconds = timed([&]() { built = dungeon::buildHierarchy(dungeon.view, cellSize, &build.stats); });
+
+  bool saved = false;
+  save.seconds = timed([&]() { saved = dungeon::saveHierarchy(path, dungeon.view, built); });
+  save.found = saved ? 1 : 0;
+
+  std::optional<dungeon::LoadedHierarchy> loaded;
+  load.seconds = timed([&]() { loaded = dungeon::loadHierarchy(path); });
+  load.found = loaded ? 1 : 0;
+
+  if (!loaded)
+  {
+    spdlog::error("Could not load {} back", path);
+    return 1;
+  }
+
+  for (int q = 0; q < queries && !built.portals.empty(); ++q)
+  {
+    const auto[from, to] = portalEndpoints(built, std::size_t(q));
+
+    const auto expected = dungeon::hierarchicalSearch(dungeon.view, built, from, to);
+    const auto actual = dungeon::hierarchicalSearch(loaded->dungeon, loaded->hierarchy, from, to);
+    if (!std::equal(expected.path.begin(), expected.path.end(), actual.path.begin(), actual.path.end()))
+    {
+      spdlog::error("Loaded hierarchy disagrees on ({}, {}) -> ({}, {})", from.x, from.y, to.x, to.y);
+      return 1;
+    }
+  }
+
+  report(args, {build, save, load});
+  return 0;
+}
+
+// Open maps with scattered walls, the drunk generator leaves huge maps almost solid
+dungeon::Dungeon randomMap(int size, int wallPercent, unsigned seed)
+{
+  auto result = dungeon::make_dungeon(size, size);
+  std::mt19937 engine{seed};
+  std::uniform_int_distribution<int> percent{0, 99};
+  for (int y = 0; y < size; ++y)
+    for (int x = 0; x < size; ++x)
+      result.view(y, x) = percent(engine) < wallPercent ? dungeon::Tile::Wall : dungeon::Tile::Floor;
+  return result;
+}
+
+using Query = std::pair<glm::ivec2, glm::ivec2>;
+
+// Breadth-first flood from the center touching every reachable tile, isolates the memory access pattern
+template<class Layout>
+std::size_t flood(dungeon::BasicDungeonView<Layout> view)
+{
+  dungeon::BasicDists<Layout> visited(view.extents(), 0.f);
+  std::queue<glm::ivec2> open;
+  const glm::ivec2 center{view.extent(1) / 2, view.extent(0) / 2};
+  open.push(center);
+  visited(center.y, center.x) = 1.f;
+
+  std::size_t reached = 0;
+  while (!open.empty())
+  {
+    const auto current = open.front();
+    open.pop();
+    ++reached;
+    for (auto successor : dungeon::successorsFor(current, view))
+    {
+      if (visited(successor.y, successor.x) != 0.f)
+        continue;
+      visited(successor.y, successor.x) = 1.f;
+      open.push(successor);
+    }
+  }
+  return reached;
+}
+
+template<class Layout>
+void benchLayout(std::string_view layoutName, dungeon::DungeonView map, const std::vector<Query>& queries,
+  std::vector<Measurement>& measurements)
+{
+  auto tiles = dungeon::relayout<Layout>(map);
+  const dungeon::BasicDungeonView<Layout> view = tiles.to_mdspan();
+  const auto suffix = fmt::format("{}/{}", layoutName, map.extent(0));
+
+  Measurement sparse{.name = fmt::format("aStar/{}", suffix)};
+  Measurement dense{.name = fmt::format("aStar_full/{}", suffix)};
+  Measurement bfs{.name = fmt::format("flood/{}", suffix), .queries = 1};
+
+  for (const auto&[start, finish] : queries)
+  {
+    bool found = false;
+    sparse.seconds += timed([&]() { found = !dungeon::aStar(view, start, finish, 1.f, {.stats = &sparse.stats}).path.empty(); });
+    ++sparse.queries;
+    sparse.found += found ? 1 : 0;
+
+    dense.seconds += timed([&]()
+      {
+        found = !dungeon::aStar(view, start, finish, 1.f, {.output = dungeon::SearchOutput::Full, .stats = &dense.stats}).path.empty();
+      });
+    ++dense.queries;
+    dense.found += found ? 1 : 0;
+  }
+
+  bfs.seconds = timed([&]() { bfs.found = flood(view); });
+
+  measurements.insert(measurements.end(), {sparse, dense, bfs});
+}
+
+// Row-major against tiled map and distance storage on big open maps
+int benchLayouts(const Args& args)
+{
+  const auto sizes = args.get("sizes", "1024,2048,4096,8192");
+  const int queries = args.getInt("queries", 20);
+  const int radius = args.getInt("radius", 256);
+  const int walls = args.getInt("walls", 30);
+
+  std::vector<Measurement> measurements;
+
+  for (std::size_t begin = 0; begin < sizes.size();)
+  {
+    const auto end = std::min(sizes.find(',', begin), sizes.size());
+    const int size = std::stoi(sizes.substr(begin, end - begin));
+    begin = end + 1;
+
+    auto map = randomMap(size, walls, static_cast<unsigned>(size));
+
+    // Same endpoints for every layout, close enough that the map-sized buffers do not drown the search
+    std::mt19937 engine{static_cast<unsigned>(size)};
+    std::uniform_int_distribution<int> coord{0, size - 1};
+    std::uniform_int_distribution<int> offset{-radius, radius};
+    auto randomFloor = [&](auto&& sample)
+      {
+        for (;;)
+        {
+          const auto v = sample();
+          if (dungeon::isPassable(map.view, v))
+            return v;
+        }
+      };
+
+    // Unreachable pairs would flood the whole map and swamp everything else
+    const auto components = dungeon::buildComponents(map.view);
+
+    std::vector<Query> endpoints;
+    while (endpoints.size() < std::size_t(queries))
+    {
+      const auto start = randomFloor([&]() { return glm::ivec2{coord(engine), coord(engine)}; });
+      const auto finish = randomFloor([&]() { return start + glm::ivec2{offset(engine), offset(engine)}; });
+      if (dungeon::connected(components, start, finish))
+        endpoints.emplace_back(start, finish);
+    }
+
+    benchLayout<std::experimental::layout_right>("row_major", map.view, endpoints, measurements);
+    benchLayout<dungeon::layout_blocked<3>>("blocked8", map.view, endpoints, measurements);
+    benchLayout<dungeon::layout_morton>("morton", map.view, endpoints, measurements);
+  }
+
+  report(args, measurements);
+  return 0;
+}
+
+// An agent walking to its goal while walls keep appearing just ahead of it:
+// incremental repair against searching from scratch at every step
+int benchReplan(const Args& args)
+{
+  const int size = args.getInt("size", 256);
+  const int walls = args.getInt("walls", 25);
+  const int lookahead = args.getInt("lookahead", 10);
+  const int maxSteps = args.getInt("steps", 1000);
+
+  auto map = randomMap(size, walls, static_cast<unsigned>(size));
+  const glm::ivec2 start{0, 0};
+  const glm::ivec2 goal{size - 1, size - 1};
+  map.view(start.y, start.x) = dungeon::Tile::Floor;
+  map.view(goal.y, goal.x) = dungeon::Tile::Floor;
+
+  Measurement initial{.name = "dstarLite_initial", .queries = 1};
+  Measurement incremental{.name = "dstarLite_replan"};
+  Measurement scratch{.name = "aStar_scratch"};
+
+  dungeon::DStarLite planner{map.view, start, goal};
+  initial.seconds = timed([&]() { planner.replan(&initial.stats); });
+  initial.found = planner.dist() < dungeon::INF ? 1 : 0;
+
+  for (int step = 0; step < maxSteps && planner.start() != goal; ++step)
+  {
+    auto path = planner.path();
+    if (path.size() < 2)
+      break;
+
+    // Wall off a tile a bit ahead, taken back if that cut the agent off
+    auto ahead = path.begin();
+    std::advance(ahead, std::min<std::size_t>(lookahead, path.size() - 2));
+    const auto blocked = *ahead;
+    map.view(blocked.y, blocked.x) = dungeon::Tile::Wall;
+    planner.tileChanged(blocked);
+    planner.moveStart(*std::next(path.begin()));
+
+    incremental.seconds += timed([&]()
+      {
+        planner.replan(&incremental.stats);
+        if (planner.dist() >= dungeon::INF)
+        {
+          map.view(blocked.y, blocked.x) = dungeon::Tile::Floor;
+          planner.tileChanged(blocked);
+          planner.replan(&incremental.stats);
+        }
+      });
+    ++incremental.queries;
+    incremental.found += planner.dist() < dungeon::INF ? 1 : 0;
+
+    bool found = false;
+    scratch.seconds += timed([&]()
+      { found = !dungeon::aStar(map.view, planner.start(), goal, 1.f, {.stats = &scratch.stats}).path.empty(); });
+    ++scratch.queries;
+    scratch.found += found ? 1 : 0;
+  }
+
+  report(args, {initial, incremental, scratch});
+  return 0;
+}
+
+// Readers searching pinned snapshots while a writer keeps publishing edits,
+// against the same queries on the plain row-major map with nobody writing
+int benchSnapshots(const Args& args)
+{
+  const int size = args.getInt("size", 512);
+  const int walls = args.getInt("walls", 25);
+  const int readers = args.getInt("readers", 4);
+  const int queries = args.getInt("queries", 100);
+  const int radius = args.getInt("radius", 64);
+  const int batch = args.getInt("batch", 16);
+  const int interval = args.getInt("interval", 1);
+
+  auto map = randomMap(size, walls, static_cast<unsigned>(size));
+  const auto components = dungeon::buildComponents(map.view);
+
+  std::mt19937 engine{static_cast<unsigned>(size)};
+  std::uniform_int_distribution<int> coord{0, size - 1};
+  std::uniform_int_distribution<int> offset{-radius, radius};
+  std::vector<Query> endpoints;
+  while (endpoints.size() < std::size_t(queries))
+  {
+    const glm::ivec2 start{coord(engine), coord(engine)};
+    const auto finish = start + glm::ivec2{offset(engine), offset(engine)};
+    if (dungeon::isPassable(map.view, start) && dungeon::isPassable(map.view, finish)
+      && dungeon::connected(components, start, finish))
+      endpoints.emplace_back(start, finish);
+  }
+
+  Measurement rowMajor{.name = "row_major_single"};
+  rowMajor.seconds = timed([&]()
+    {
+      for (const auto&[start, finish] : endpoints)
+      {
+        ++rowMajor.queries;
+        rowMajor.found += dungeon::aStar(map.view, start, finish, 1.f, {.stats = &rowMajor.stats}).path.empty() ? 0 : 1;
+      }
+    });
+
+  dungeon::MapStore store{map.view};
+
+  Measurement chunked{.name = "snapshot_single"};
+  chunked.seconds = timed([&]()
+    {
+      const auto snapshot = store.snapshot();
+      for (const auto&[start, finish] : endpoints)
+      {
+        ++chunked.queries;
+        chunked.found += dungeon::aStar(snapshot->view(), start, finish, 1.f, {.stats = &chunked.stats}).path.empty() ? 0 : 1;
+      }
+    });
+
+  // Every reader runs all queries, pinning the latest snapshot for each one
+  std::vector<Measurement> perReader(readers);
+  std::atomic<int> running{readers};
+  Measurement writer{.name = "writer_publish"};
+  std::size_t maxPinned = 0;
+
+  Measurement concurrent{.name = "snapshot_readers"};
+  concurrent.seconds = timed([&]()
+    {
+      std::vector<std::jthread> threads;
+      for (int r = 0; r < readers; ++r)
+        threads.emplace_back([&, r]()
+          {
+            auto& m = perReader[r];
+            for (const auto&[start, finish] : endpoints)
+            {
+              const auto snapshot = store.snapshot();
+              ++m.queries;
+              m.found += dungeon::aStar(snapshot->view(), start, finish, 1.f, {.stats = &m.stats}).path.empty() ? 0 : 1;
+            }
+            --running;
+          });
+
+      std::mt19937 edits{1};
+      while (running > 0)
+      {
+        writer.seconds += timed([&]()
+          {
+            for (int i = 0; i < batch; ++i)
+            {
+              const glm::ivec2 v{coord(edits), coord(edits)};
+              store.set(v, store.get(v) == dungeon::Tile::Wall ? dungeon::Tile::Floor : dungeon::Tile::Wall);
+            }
+            store.publish();
+          });
+        ++writer.queries;
+        maxPinned = std::max(maxPinned, store.pinnedEpochs());
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+      }
+    });
+
+  for (const auto& m : perReader)
+  {
+    concurrent.queries += m.queries;
+    concurrent.found += m.found;
+    concurrent.stats += m.stats;
+  }
+
+  spdlog::info("{} epochs published, at most {} pinned at once, {} pinned at the end",
+    writer.queries, maxPinned, store.pinnedEpochs());
+  report(args, {rowMajor, chunked, concurrent, writer});
+  return 0;
+}
+
+// A burst of queries served by the scheduler one tick at a time, against running each
+// to completion. The interesting numbers are the longest tick and the longest single query.
+int benchSliced(const Args& args)
+{
+  const int size = args.getInt("size", 512);
+  const int walls = args.getInt("walls", 25);
+  const int queries = args.getInt("queries", 100);
+  const int budget = args.getInt("budget", 20000);
+  const int quantum = args.getInt("quantum", 256);
+
+  auto map = randomMap(size, walls, static_cast<unsigned>(size));
+  const auto components = dungeon::buildComponents(map.view);
+
+  std::mt19937 engine{static_cast<unsigned>(size)};
+  std::uniform_int_distribution<int> coord{0, size - 1};
+  std::vector<Query> endpoints;
+  while (endpoints.size() < std::size_t(queries))
+  {
+    const glm::ivec2 start{coord(engine), coord(engine)};
+    const glm::ivec2 finish{coord(engine), coord(engine)};
+    if (dungeon::isPassable(map.view, start) && dungeon::isPassable(map.view, finish)
+      && dungeon::connected(components, start, finish))
+      endpoints.emplace_back(start, finish);
+  }
+
+  Measurement blocking{.name = "aStar_blocking"};
+  std::vector<float> expected;
+  double longestQuery = 0;
+  for (const auto&[start, finish] : endpoints)
+  {
+    float dist = 0;
+    const double seconds = timed([&]() { dist = dungeon::aStar(map.view, start, finish, 1.f, {.stats = &blocking.stats}).dist; });
+    expected.push_back(dist);
+    longestQuery = std::max(longestQuery, seconds);
+    blocking.seconds += seconds;
+    ++blocking.queries;
+    blocking.found += dist < dungeon::INF ? 1 : 0;
+  }
+
+  Measurement sliced{.name = "aStar_sliced"};
+  dungeon::SearchScheduler scheduler{std::size_t(budget), std::size_t(quantum)};
+  std::size_t mismatches = 0;
+  for (std::size_t q = 0; q < endpoints.size(); ++q)
+  {
+    const auto[start, finish] = endpoints[q];
+    scheduler.submit(
+      [&, start, finish](dungeon::ExpansionBudget& b)
+        { return dungeon::aStarSliced(map.view, start, finish, 1.f, b, {.stats = &sliced.stats}); },
+      [&, q](dungeon::SearchResult result, bool last)
+        {
+          if (!last)
+            return;
+          ++sliced.queries;
+          sliced.found += result.path.empty() ? 0 : 1;
+          mismatches += result.dist == expected[q] ? 0 : 1;
+        });
+  }
+
+  std::size_t ticks = 0;
+  double longestTick = 0;
+  while (scheduler.pending() > 0)
+  {
+    const double seconds = timed([&]() { scheduler.tick(); });
+    longestTick = std::max(longestTick, seconds);
+    sliced.seconds += seconds;
+    ++ticks;
+  }
+
+  if (mismatches > 0)
+    spdlog::error("{} sliced results differ from the blocking ones", mismatches);
+  spdlog::info("Longest query {:.2f} ms, {} ticks of {} expansions, longest tick {:.2f} ms",
+    longestQuery * 1e3, ticks, budget, longestTick * 1e3);
+  report(args, {blocking, sliced});
+  return mismatches == 0 ? 0 : 1;
+}
+
+// Rooms joined by corridors on a map whose flat index does not fit 32 bits,
+// only the chunks the rooms and corridors touch get allocated
+int benchSparse(const Args& args)
+{
+  const int size = args.getInt("size", 65536);
+  const int rooms = args.getInt("rooms", 64);
+  const int roomSize = args.getInt("room", 48);
+
+  Measurement build{.name = "sparse_build", .queries = 1};
+  Measurement search{.name = "aStar_sparse"};
+
+  dungeon::SparseDungeon map{size, size};
+  std::mt19937 engine{static_cast<unsigned>(size)};
+  std::uniform_int_distribution<int> coord{1, size - roomSize - 1};
+  std::vector<glm::ivec2> centers;
+
+  build.seconds = timed([&]()
+    {
+      for (int r = 0; r < rooms; ++r)
+      {
+        const glm::ivec2 corner{coord(engine), coord(engine)};
+        for (int y = corner.y; y < corner.y + roomSize; ++y)
+          for (int x = corner.x; x < corner.x + roomSize; ++x)
+            map.set({x, y}, dungeon::Tile::Floor);
+        centers.push_back(corner + roomSize / 2);
+      }
+
+      // L-shaped corridor to the previous room, so consecutive rooms are always connected
+      for (std::size_t r = 1; r < centers.size(); ++r)
+      {
+        const auto from = centers[r - 1];
+        const auto to = centers[r];
+        for (int x = std::min(from.x, to.x); x <= std::max(from.x, to.x); ++x)
+          map.set({x, from.y}, dungeon::Tile::Floor);
+        for (int y = std::min(from.y, to.y); y <= std::max(from.y, to.y); ++y)
+          map.set({to.x, y}, dungeon::Tile::Floor);
+      }
+    });
+  build.found = map.allocatedChunks();
+
+  const auto view = map.view();
+  for (std::size_t r = 1; r < centers.size(); ++r)
+  {
+    bool found = false;
+    search.seconds += timed([&]()
+      { found = !dungeon::aStar(view, centers[r - 1], centers[r], 1.f, {.stats = &search.stats}).path.empty(); });
+    ++search.queries;
+    search.found += found ? 1 : 0;
+  }
+
+  const auto chunks = view.mapping().required_span_size() >> (2 * dungeon::CHUNK_BITS);
+  spdlog::info("{}x{} map, {} of {} chunks allocated", size, size, map.allocatedChunks(), chunks);
+  report(args, {build, search});
+  return search.found == search.queries ? 0 : 1;
+}
+
+// The chunked generator on a big map, checked for determinism across thread counts and for
+// being one connected region. The serial drunk generator runs on a small map for scale.
+int benchGenerate(const Args& args)
+{
+  const int size = args.getInt("size", 4096);
+  const int drunkSize = args.getInt("drunk_size", 256);
+  const auto seed = static_cast<std::uint64_t>(args.getInt("seed", 1));
+
+  Measurement drunk{.name = fmt::format("gen_drunk_dungeon/{}", drunkSize), .queries = 1, .found = 1};
+  auto small = dungeon::make_dungeon(drunkSize, drunkSize);
+  drunk.seconds = timed([&]() { dungeon::gen_drunk_dungeon(small.view, static_cast<unsigned>(seed)); });
+
+  Measurement chunked{.name = fmt::format("gen_chunked_dungeon/{}", size), .queries = 1};
+  auto map = dungeon::make_dungeon(size, size);
+  chunked.seconds = timed([&]() { dungeon::gen_chunked_dungeon(map.view, {.seed = seed}); });
+
+  Measurement serial{.name = fmt::format("gen_chunked_dungeon_1thread/{}", size), .queries = 1};
+  auto again = dungeon::make_dungeon(size, size);
+  serial.seconds = timed([&]() { dungeon::gen_chunked_dungeon(again.view, {.seed = seed, .threads = 1}); });
+
+  const bool deterministic = map.data == again.data;
+  chunked.found = serial.found = deterministic ? 1 : 0;
+  if (!deterministic)
+    spdlog::error("Thread count changed the generated map");
+
+  const auto components = dungeon::buildComponents(map.view);
+  const auto floor = std::count_if(map.data.begin(), map.data.end(), [](dungeon::Tile t) { return t != dungeon::Tile::Wall; });
+  spdlog::info("{} walkable tiles ({:.1f}%) in {} connected regions",
+    floor, 100. * floor / map.data.size(), components.labelParent.size());
+
+  report(args, {drunk, chunked, serial});
+  return deterministic && components.labelParent.size() == 1 ? 0 : 1;
+}
+
+// The policies of the best-first kernel against each other on the same queries.
+// 4-connected variants have to agree with aStar, fixed point within its rounding.
+int benchKernels(const Args& args)
+{
+  const int size = args.getInt("size", 256);
+  const int maps = args.getInt("maps", 5);
+  const int queries = args.getInt("queries", 100);
+  const auto seed = static_cast<unsigned>(args.getInt("seed", 1));
+
+  Measurement aStar{.name = "aStar"};
+  Measurement floatQuad{.name = "four/float/quaternary"};
+  Measurement floatBinary{.name = "four/float/binary"};
+  Measurement fixedQuad{.name = "four/fixed/quaternary"};
+  Measurement eight{.name = "eight/float/quaternary"};
+
+  std::size_t mismatches = 0;
+  for (int map = 0; map < maps; ++map)
+  {
+    auto dungeon = dungeon::make_dungeon(size, size);
+    dungeon::gen_drunk_dungeon(dungeon.view, seed + static_cast<unsigned>(map));
+
+    const dungeon::WalkableIndex walkable{dungeon.view};
+    std::mt19937 engine{static_cast<unsigned>(map)};
+    std::vector<glm::ivec2> endpoints(2 * std::size_t(queries));
+    walkable.sample(std::span{endpoints}, engine);
+
+    for (int q = 0; q < queries; ++q)
+    {
+      const auto start = endpoints[2 * q];
+      const auto finish = endpoints[2 * q + 1];
+
+      auto run = [&](Measurement& m, auto&& search)
+        {
+          float dist = dungeon::INF;
+          m.seconds += timed([&]() { dist = search(); });
+          ++m.queries;
+          m.found += dist < dungeon::INF ? 1 : 0;
+          return dist;
+        };
+
+      const float expected = run(aStar, [&]()
+        { return dungeon::aStar(dungeon.view, start, finish, 1.f, {.stats = &aStar.stats}).dist; });
+      const float floatDist = run(floatQuad, [&]()
+        { return dungeon::gridDistance(dungeon.view, start, finish, 1.f, nullptr, &floatQuad.stats); });
+      const float binaryDist = run(floatBinary, [&]()
+        {
+          return dungeon::gridDistance<dungeon::FourConnected, dungeon::FloatCost, dungeon::BinaryHeap>(
+            dungeon.view, start, finish, 1.f, nullptr, &floatBinary.stats);
+        });
+      const float fixedDist = run(fixedQuad, [&]()
+        {
+          return dungeon::gridDistance<dungeon::FourConnected, dungeon::FixedCost<>>(
+            dungeon.view, start, finish, 1.f, nullptr, &fixedQuad.stats);
+        });
+      const float eightDist = run(eight, [&]()
+        {
+          return dungeon::gridDistance<dungeon::EightConnected>(dungeon.view, start, finish, 1.f, nullptr, &eight.stats);
+        });
+
+      const float tolerance = 1e-3f * std::max(1.f, expected);
+      if (std::abs(floatDist - expected) > tolerance || std::abs(binaryDist - expected) > tolerance
+        || std::abs(fixedDist - expected) > tolerance + expected / 256 || eightDist > expected + tolerance)
+      {
+        spdlog::error("Kernels disagree from ({}, {}) to ({}, {}): aStar {}, float {}, binary {}, fixed {}, eight {}",
+          start.x, start.y, finish.x, finish.y, expected, floatDist, binaryDist, fixedDist, eightDist);
+        ++mismatches;
+      }
+    }
+  }
+
+  report(args, {aStar, floatQuad, floatBinary, fixedQuad, eight});
+  return mismatches == 0 ? 0 : 1;
+}
+
+// Textbook Dijkstra from start to every tile, shares nothing with the searches but weight()
+std::vector<float> oracleDists(dungeon::DungeonView view, glm::ivec2 start, const dungeon::ObstacleOverlay* overlay = nullptr)
+{
+  const int width = view.extent(1);
+  auto index = [width](glm::ivec2 v) { return static_cast<std::size_t>(v.y) * width + v.x; };
+
+  std::vector<float> dists(view.size(), dungeon::INF);
+  using Entry = std::pair<float, std::size_t>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<>> open;
+  dists[index(start)] = 0;
+  open.push({0.f, index(start)});
+  while (!open.empty())
+  {
+    const auto[dist, i] = open.top();
+    open.pop();
+    if (dist > dists[i])
+      continue;
+    const glm::ivec2 current{static_cast<int>(i % width), static_cast<int>(i / width)};
+    for (auto successor : dungeon::successorsFor(current, view, overlay))
+    {
+      const float successorDist = dist + dungeon::weight(view, current, successor, overlay);
+      if (successorDist < dists[index(successor)])
+      {
+        dists[index(successor)] = successorDist;
+        open.push({successorDist, index(successor)});
+      }
+    }
+  }
+  return dists;
+}
+
+// A search under test: its measurement, how often it was wrong, and how far from optimal it got
+struct Checked
+{
+  Measurement measurement;
+  std::size_t failures{0};
+  double worstRatio{1};
+};
+
+// Logs the first thing wrong with a returned path. It must be empty exactly when there is no way,
+// go from start to finish over passable 4-neighbours, and neither it nor the claimed cost
+// may exceed bound times the optimum plus detour. Searches never claim less than their path costs.
+// With an overlay its blockers are walls and its costs are charged.
+template<class Path>
+bool checkPath(Checked& checked, dungeon::DungeonView view, const Path& path, glm::ivec2 start, glm::ivec2 finish,
+  float optimal, float claimed, float bound, const dungeon::ObstacleOverlay* overlay = nullptr, float detour = 0)
+{
+  auto fail = [&](std::string_view what)
+    {
+      spdlog::error("{} ({}, {}) -> ({}, {}): {}", checked.measurement.name, start.x, start.y, finish.x, finish.y, what);
+      ++checked.failures;
+      return false;
+    };
+
+  if (optimal >= dungeon::INF)
+    return path.empty() || fail("found a way between disconnected tiles");
+  if (path.empty())
+    return fail(fmt::format("found nothing, the optimum is {}", optimal));
+  if (*path.begin() != start || path.back() != finish)
+    return fail("does not connect the endpoints");
+
+  float cost = 0;
+  std::optional<glm::ivec2> previous;
+  for (auto v : path)
+  {
+    if (!dungeon::isPassable(view, v, overlay))
+      return fail(fmt::format("crosses the wall at ({}, {})", v.x, v.y));
+    if (previous)
+    {
+      const auto step = glm::abs(v - *previous);
+      if (step.x + step.y != 1)
+        return fail(fmt::format("jumps from ({}, {}) to ({}, {})", previous->x, previous->y, v.x, v.y));
+      cost += dungeon::weight(view, *previous, v, overlay);
+    }
+    previous = v;
+  }
+
+  const float tolerance = 1e-3f * std::max(1.f, optimal);
+  if (cost < optimal - tolerance)
+    return fail(fmt::format("costs {}, less than the optimum {}", cost, optimal));
+  const float limit = bound * optimal + detour + tolerance;
+  if (cost > limit || claimed > limit)
+    return fail(fmt::format("costs {} and claims {}, the bound is {} x {} + {}", cost, claimed, bound, optimal, detour));
+  if (cost > claimed + tolerance)
+    return fail(fmt::format("claims {} but costs {}", claimed, cost));
+
+  checked.worstRatio = std::max(checked.worstRatio, optimal > 0 ? double(cost) / optimal : 1.);
+  return true;
+}
+
+// What the path costs with the overlay's costs charged, with checkPath making sure it is a path
+template<class Path>
+float pathCost(dungeon::DungeonView view, const Path& path, const dungeon::ObstacleOverlay* overlay = nullptr)
+{
+  float cost = 0;
+  std::optional<glm::ivec2> previous;
+  for (auto v : path)
+  {
+    if (previous)
+      cost += dungeon::weight(view, *previous, v, overlay);
+    previous = v;
+  }
+  return cost;
+}
+
+// name map query from.x from.y to.x to.y cost, one line per query, lines starting with # are comments.
+// Queries are keyed by everything but the cost, so a baseline of other maps matches nothing.
+// A cost of -1 means nothing was found.
+using PathBaseline = std::map<std::string, float>;
+
+std::string pathKey(std::string_view name, int map, int query, glm::ivec2 from, glm::ivec2 to)
+{
+  return fmt::format("{} {} {} {} {} {} {}", name, map, query, from.x, from.y, to.x, to.y);
+}
+
+PathBaseline loadPathBaseline(const std::string& path)
+{
+  PathBaseline result;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.starts_with('#'))
+      continue;
+    const auto split = line.find_last_of(' ');
+    if (split != std::string::npos)
+      result[line.substr(0, split)] = std::stof(line.substr(split + 1));
+  }
+  return result;
+}
+
+// name expanded seconds, one line per search, lines starting with # are comments.
+// Zero seconds leave the timing unchecked.
+using Baseline = std::map<std::string, std::pair<std::uint64_t, double>>;
+
+Baseline loadBaseline(const std::string& path)
+{
+  Baseline result;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.starts_with('#'))
+      continue;
+    std::istringstream fields(line);
+    std::string name;
+    std::uint64_t expanded = 0;
+    double seconds = 0;
+    if (fields >> name >> expanded >> seconds)
+      result[name] = {expanded, seconds};
+  }
+  return result;
+}
+
+// Every search against the oracle on seeded drunk maps, some also with an overlay,
+// then against a stored baseline.
+// Portal paths are not optimal and have no useful bound of their own, so every
+// hierarchical query is held to the cost it had in the stored path baseline instead.
+// Counters are deterministic for a given seed, so any growth there is a real regression;
+// timings get their own, looser slack. Only the search calls are timed, not the checks.
+int benchVerify(const Args& args)
+{
+  const int size = args.getInt("size", 64);
+  const int maps = args.getInt("maps", 1000);
+  const int queries = args.getInt("queries", 5);
+  const int cellSize = args.getInt("cell", 8);
+  // Building the hierarchy dwarfs everything else, it is only checked on some of the maps
+  const int hierarchyEvery = args.getInt("hierarchy_every", 10);
+  const int budget = args.getInt("budget", 64);
+  // Overlay tiles per map, never on an endpoint
+  const int blocked = args.getInt("blocked", 16);
+  const int costly = args.getInt("costly", 16);
+  const auto seed = static_cast<unsigned>(args.getInt("seed", 1));
+  const int slack = args.getInt("slack", 0);
+  // Negative leaves timings unchecked, e.g. in unoptimized builds or under ctest.
+  // Baseline totals below the floor are too short to compare and are skipped too.
+  const int timeSlack = args.getInt("time_slack", 50);
+  const double timeFloor = args.getInt("time_floor_ms", 50) / 1000.;
+
+  Checked aStar{{.name = "aStar"}};
+  Checked aStarFull{{.name = "aStar_full"}};
+  Checked weightedAStar{{.name = "aStar_eps2"}};
+  Checked sliced{{.name = "aStarSliced"}};
+  Checked araStar{{.name = "araStar"}};
+  Checked dstarLite{{.name = "dstarLite"}};
+  Checked aStarOverlay{{.name = "aStar_overlay"}};
+  Checked hierarchical{{.name = "hierarchicalSearch"}};
+  Checked hierarchicalOverlay{{.name = "hierarchicalSearch_overlay"}};
+  Checked contraction{{.name = "contractionSearch"}};
+  PathBaseline pathCosts;
+
+  for (int map = 0; map < maps; ++map)
+  {
+    auto dungeon = dungeon::make_dungeon(size, size);
+    dungeon::gen_drunk_dungeon(dungeon.view, seed + static_cast<unsigned>(map));
+    const auto hierarchy = map % hierarchyEvery == 0 ? dungeon::buildHierarchy(dungeon.view, cellSize) : dungeon::HierarchicalSearchData{};
+    const auto contracted = dungeon::buildContractionHierarchy(dungeon.view, 1);
+
+    const dungeon::WalkableIndex walkable{dungeon.view};
+    std::mt19937 engine{seed + static_cast<unsigned>(map)};
+    std::vector<glm::ivec2> endpoints(2 * std::size_t(queries));
+    walkable.sample(std::span{endpoints}, engine);
+
+    std::vector<std::pair<glm::ivec2, glm::ivec2>> portalQueries;
+    if (!hierarchy.portals.empty())
+      for (int q = 0; q < queries; ++q)
+        portalQueries.push_back(portalEndpoints(hierarchy, std::size_t(map) * queries + q));
+
+    std::unordered_set<glm::ivec2> reserved(endpoints.begin(), endpoints.end());
+    for (const auto&[from, to] : portalQueries)
+    {
+      reserved.insert(from);
+      reserved.insert(to);
+    }
+    std::vector<glm::ivec2> overlayTiles(std::size_t(blocked + costly));
+    walkable.sample(std::span{overlayTiles}, engine);
+    dungeon::ObstacleOverlay overlay;
+    for (std::size_t i = 0; i < overlayTiles.size(); ++i)
+    {
+      if (reserved.contains(overlayTiles[i]))
+        continue;
+      if (i < std::size_t(blocked))
+        overlay.block(overlayTiles[i]);
+      else
+        overlay.setCost(overlayTiles[i], 3);
+    }
+
+    auto at = [size](const std::vector<float>& dists, glm::ivec2 v) { return dists[static_cast<std::size_t>(v.y) * size + v.x]; };
+
+    auto run = [&](Checked& checked, auto&& search)
+      {
+        auto& m = checked.measurement;
+        const bool ok = search(m.stats, [&m](auto&& call) { return timedInto(m.seconds, call); });
+        ++m.queries;
+        m.found += ok ? 1 : 0;
+      };
+
+    for (int q = 0; q < queries; ++q)
+    {
+      const auto start = endpoints[2 * q];
+      const auto finish = endpoints[2 * q + 1];
+      const float optimal = at(oracleDists(dungeon.view, start), finish);
+      const float overlayOptimal = at(oracleDists(dungeon.view, start, &overlay), finish);
+
+      auto check = [&](Checked& checked, const auto& result, float bound)
+        { return checkPath(checked, dungeon.view, result.path, start, finish, optimal, result.dist, bound); };
+
+      run(aStar, [&](auto& stats, auto&& time)
+        { return check(aStar, time([&]() { return dungeon::aStar(dungeon.view, start, finish, 1.f, {.stats = &stats}); }), 1.f); });
+      run(aStarFull, [&](auto& stats, auto&& time)
+        {
+          const auto result = time([&]()
+            { return dungeon::aStar(dungeon.view, start, finish, 1.f, {.output = dungeon::SearchOutput::Full, .stats = &stats}); });
+          return check(aStarFull, result, 1.f);
+        });
+      run(weightedAStar, [&](auto& stats, auto&& time)
+        { return check(weightedAStar, time([&]() { return dungeon::aStar(dungeon.view, start, finish, 2.f, {.stats = &stats}); }), 2.f); });
+      run(sliced, [&](auto& stats, auto&& time)
+        {
+          const auto result = time([&]()
+            {
+              dungeon::ExpansionBudget slice;
+              dungeon::SearchResult result;
+              for (auto&& s : dungeon::aStarSliced(dungeon.view, start, finish, 1.f, slice, {.stats = &stats}))
+              {
+                if (s.solution)
+                  result = std::move(s.result);
+                slice.remaining = static_cast<std::size_t>(budget);
+              }
+              return result;
+            });
+          return check(sliced, result, 1.f);
+        });
+      run(araStar, [&](auto& stats, auto&& time)
+        {
+          // Every improvement within the initial eps, the last one optimal
+          const auto results = time([&]()
+            {
+              std::vector<dungeon::SearchResult> results;
+              for (auto&& result : dungeon::araStar(dungeon.view, start, finish, 3.f, {.stats = &stats}))
+                results.push_back(std::move(result));
+              return results;
+            });
+          bool ok = true;
+          for (const auto& result : results)
+            ok = check(araStar, result, 3.f) && ok;
+          return check(araStar, results.empty() ? dungeon::SearchResult{} : results.back(), 1.f) && ok;
+        });
+      run(dstarLite, [&](auto& stats, auto&& time)
+        {
+          dungeon::DStarLite planner{dungeon.view, start, finish};
+          time([&]() { planner.replan(&stats); return true; });
+          return checkPath(dstarLite, dungeon.view, planner.path(), start, finish, optimal, planner.dist(), 1.f);
+        });
+      run(contraction, [&](auto& stats, auto&& time)
+        { return check(contraction, time([&]() { return dungeon::contractionSearch(contracted, start, finish, {.stats = &stats}); }), 1.f); });
+      run(aStarOverlay, [&](auto& stats, auto&& time)
+        {
+          const auto result = time([&]() { return dungeon::aStar(dungeon.view, start, finish, 1.f, {.stats = &stats, .overlay = &overlay}); });
+          return checkPath(aStarOverlay, dungeon.view, result.path, start, finish, overlayOptimal, result.dist, 1.f, &overlay);
+        });
+
+      if (!portalQueries.empty())
+      {
+        const auto from = portalQueries[q].first;
+        const auto to = portalQueries[q].second;
+        const float portalOptimal = at(oracleDists(dungeon.view, from), to);
+        const float portalOverlayOptimal = at(oracleDists(dungeon.view, from, &overlay), to);
+        // Only checked for being a path no better than the optimum here, the cost is compared with the path baseline
+        auto record = [&](const Checked& checked, const dungeon::SearchResult& result, const dungeon::ObstacleOverlay* overlay)
+          {
+            pathCosts[pathKey(checked.measurement.name, map, q, from, to)] =
+              result.path.empty() ? -1.f : pathCost(dungeon.view, result.path, overlay);
+          };
+        run(hierarchical, [&](auto& stats, auto&& time)
+          {
+            const auto result = time([&]() { return dungeon::hierarchicalSearch(dungeon.view, hierarchy, from, to, {.stats = &stats}); });
+            record(hierarchical, result, nullptr);
+            return checkPath(hierarchical, dungeon.view, result.path, from, to, portalOptimal, result.dist, 1.f, nullptr, dungeon::INF);
+          });
+        // The overlay may cut every way the portal graph knows, then finding nothing is fine
+        run(hierarchicalOverlay, [&](auto& stats, auto&& time)
+          {
+            const auto result = time([&]()
+              { return dungeon::hierarchicalSearch(dungeon.view, hierarchy, from, to, {.stats = &stats, .overlay = &overlay}); });
+            record(hierarchicalOverlay, result, &overlay);
+            return !result.path.empty()
+              && checkPath(hierarchicalOverlay, dungeon.view, result.path, from, to, portalOverlayOptimal, result.dist, 1.f,
+                &overlay, dungeon::INF);
+          });
+      }
+    }
+  }
+
+  const std::vector<Checked*> all{&aStar, &aStarFull, &weightedAStar, &sliced, &araStar, &dstarLite, &contraction,
+    &aStarOverlay, &hierarchical, &hierarchicalOverlay};
+
+  std::size_t failures = 0;
+  std::vector<Measurement> measurements;
+  for (const auto* checked : all)
+  {
+    spdlog::info("{}: {} of {} queries wrong, worst path {:.3f}x the optimum",
+      checked->measurement.name, checked->failures, checked->measurement.queries, checked->worstRatio);
+    failures += checked->failures;
+    measurements.push_back(checked->measurement);
+  }
+
+  std::size_t regressions = 0;
+  const auto baselinePath = args.get("baseline", "");
+  if (!baselinePath.empty())
+  {
+    const auto baseline = loadBaseline(baselinePath);
+    if (baseline.empty())
+      spdlog::warn("No baseline in {}, nothing to compare with", baselinePath);
+    for (const auto& m : measurements)
+    {
+      auto it = baseline.find(m.name);
+      if (it == baseline.end())
+        continue;
+      const auto[expanded, seconds] = it->second;
+      if constexpr (dungeon::STATS_ENABLED)
+        if (m.stats[dungeon::Counter::Expanded] * 100 > expanded * (100 + slack))
+        {
+          spdlog::error("{} expands {} tiles, {} in the baseline", m.name, m.stats[dungeon::Counter::Expanded], expanded);
+          ++regressions;
+        }
+      if (timeSlack >= 0 && seconds >= timeFloor && m.seconds * 100 > seconds * (100 + timeSlack))
+      {
+        spdlog::error("{} took {:.3f}s, {:.3f}s in the baseline", m.name, m.seconds, seconds);
+        ++regressions;
+      }
+    }
+  }
+
+  const auto pathBaselinePath = args.get("path_baseline", "");
+  if (!pathBaselinePath.empty())
+  {
+    const auto baseline = loadPathBaseline(pathBaselinePath);
+    std::size_t unrecorded = 0;
+    for (const auto&[key, cost] : pathCosts)
+    {
+      auto it = baseline.find(key);
+      if (it == baseline.end())
+      {
+        ++unrecorded;
+        continue;
+      }
+      const float recorded = it->second;
+      if (recorded >= 0 && (cost < 0 || cost > recorded + 1e-3f * std::max(1.f, recorded)))
+      {
+        spdlog::error("{} costs {}, {} in the path baseline", key, cost, recorded);
+        ++regressions;
+      }
+    }
+    if (unrecorded > 0)
+      spdlog::warn("{} of {} hierarchical queries are not in {}, their costs are unchecked", unrecorded, pathCosts.size(), pathBaselinePath);
+  }
+
+  const auto savePathsPath = args.get("save_path_baseline", "");
+  if (!savePathsPath.empty())
+  {
+    std::ofstream file(savePathsPath);
+    for (const auto&[key, cost] : pathCosts)
+      file << key << ' ' << fmt::format("{}", cost) << '\n';
+  }
+
+  const auto savePath = args.get("save_baseline", "");
+  if (!savePath.empty())
+  {
+    std::ofstream file(savePath);
+    for (const auto& m : measurements)
+      file << m.name << ' ' << m.stats[dungeon::Counter::Expanded] << ' ' << m.seconds << '\n';
+  }
+
+  report(args, measurements);
+  return failures == 0 && regressions == 0 ? 0 : 1;
+}
+
+// Contraction hierarchy against aStar and hierarchicalSearch on the same static map.
+// The contraction queries have to cost exactly what aStar finds.
+int benchContraction(const Args& args)
+{
+  const int size = args.getInt("size", 256);
+  const int walls = args.getInt("walls", 25);
+  const int queries = args.getInt("queries", 200);
+  const int cellSize = args.getInt("cell", 16);
+  const auto threads = static_cast<unsigned>(args.getInt("threads", 0));
+
+  auto map = randomMap(size, walls, static_cast<unsigned>(size));
+  const auto components = dungeon::buildComponents(map.view);
+
+  Measurement build{.name = "buildContractionHierarchy", .queries = 1, .found = 1};
+  dungeon::ContractionHierarchy contraction;
+  build.seconds = timed([&]() { contraction = dungeon::buildContractionHierarchy(map.view, threads, &build.stats); });
+
+  Measurement buildPortals{.name = "buildHierarchy", .queries = 1, .found = 1};
+  dungeon::HierarchicalSearchData hierarchy;
+  buildPortals.seconds = timed([&]() { hierarchy = dungeon::buildHierarchy(map.view, cellSize, &buildPortals.stats); });
+
+  spdlog::info("{} nodes, {} arcs of which {} shortcuts, {:.1f} MiB", contraction.tileOf.size(), contraction.arcs.size(),
+    contraction.shortcuts, contraction.memoryBytes() / double(1 << 20));
+
+  Measurement aStar{.name = "aStar"};
+  Measurement contracted{.name = "contractionSearch"};
+  Measurement portals{.name = "hierarchicalSearch"};
+
+  std::mt19937 engine{static_cast<unsigned>(size)};
+  std::uniform_int_distribution<int> coord{0, size - 1};
+  std::size_t mismatches = 0;
+  for (int q = 0; q < queries; ++q)
+  {
+    glm::ivec2 start{coord(engine), coord(engine)};
+    glm::ivec2 finish{coord(engine), coord(engine)};
+    if (!dungeon::isPassable(map.view, start) || !dungeon::isPassable(map.view, finish)
+      || !dungeon::connected(components, start, finish))
+    {
+      --q;
+      continue;
+    }
+
+    dungeon::SearchResult expected;
+    aStar.seconds += timed([&]() { expected = dungeon::aStar(map.view, start, finish, 1.f, {.stats = &aStar.stats}); });
+    ++aStar.queries;
+    aStar.found += expected.path.empty() ? 0 : 1;
+
+    dungeon::SearchResult actual;
+    contracted.seconds += timed([&]() { actual = dungeon::contractionSearch(contraction, start, finish, {.stats = &contracted.stats}); });
+    ++contracted.queries;
+    contracted.found += actual.path.empty() ? 0 : 1;
+
+    if (std::abs(actual.dist - expected.dist) > 1e-3f * std::max(1.f, expected.dist) || actual.path.back() != finish)
+    {
+      spdlog::error("Contraction hierarchy disagrees on ({}, {}) -> ({}, {}): {} instead of {}",
+        start.x, start.y, finish.x, finish.y, actual.dist, expected.dist);
+      ++mismatches;
+    }
+
+    if (!hierarchy.portals.empty())
+    {
+      const auto endpoints = portalEndpoints(hierarchy, std::size_t(q));
+      bool found = false;
+      portals.seconds += timed([&]()
+        {
+          found = !dungeon::hierarchicalSearch(map.view, hierarchy, endpoints.first, endpoints.second,
+            {.stats = &portals.stats}).path.empty();
+        });
+      ++portals.queries;
+      portals.found += found ? 1 : 0;
+    }
+  }
+
+  auto perQuery = [](const Measurement& m) { return m.queries == 0 ? 0. : m.seconds / m.queries; };
+  spdlog::info("Per query: aStar {:.1f}us, contraction {:.1f}us ({:.0f}x), hierarchical {:.1f}us",
+    perQuery(aStar) * 1e6, perQuery(contracted) * 1e6, perQuery(aStar) / std::max(perQuery(contracted), 1e-12),
+    perQuery(portals) * 1e6);
+
+  report(args, {build, buildPortals, aStar, contracted, portals});
+  return mismatches == 0 ? 0 : 1;
+}
+
+// First-move database: build, size, a round trip through a file, then whole paths step
+// by step against aStar. Every path has to cost what aStar finds.
+int benchFirstMoves(const Args& args)
+{
+  const int size = args.getInt("size", 128);
+  const int walls = args.getInt("walls", 25);
+  const int queries = args.getInt("queries", 200);
+  const auto threads = static_cast<unsigned>(args.getInt("threads", 0));
+  const auto path = args.get("file", "firstmoves.bin");
+
+  auto map = randomMap(size, walls, static_cast<unsigned>(size));
+  const auto components = dungeon::buildComponents(map.view);
+
+  Measurement build{.name = "buildFirstMoves", .queries = 1, .found = 1};
+  dungeon::FirstMoveDatabase built;
+  build.seconds = timed([&]() { built = dungeon::buildFirstMoves(map.view, threads, &build.stats); });
+
+  Measurement save{.name = "saveFirstMoves", .queries = 1};
+  save.seconds = timed([&]() { save.found = dungeon::saveFirstMoves(path, built) ? 1 : 0; });
+
+  Measurement load{.name = "loadFirstMoves", .queries = 1};
+  std::optional<dungeon::FirstMoveDatabase> loaded;
+  load.seconds = timed([&]() { loaded = dungeon::loadFirstMoves(path); });
+  load.found = loaded ? 1 : 0;
+  if (!loaded)
+  {
+    spdlog::error("Could not load {} back", path);
+    return 1;
+  }
+
+  const auto sources = built.firstRun.size() - 1;
+  spdlog::info("{} sources, {} runs ({:.1f} per source), {:.1f} MiB, {:.2f} bytes per source and target",
+    sources, built.runs.size(), double(built.runs.size()) / std::max<std::size_t>(sources, 1),
+    built.memoryBytes() / double(1 << 20), built.memoryBytes() / std::max(double(sources) * sources, 1.));
+
+  Measurement aStar{.name = "aStar"};
+  Measurement steps{.name = "firstMoves_path"};
+
+  std::mt19937 engine{static_cast<unsigned>(size)};
+  std::uniform_int_distribution<int> coord{0, size - 1};
+  std::size_t mismatches = 0;
+  std::size_t stepCount = 0;
+  for (int q = 0; q < queries; ++q)
+  {
+    const glm::ivec2 start{coord(engine), coord(engine)};
+    const glm::ivec2 finish{coord(engine), coord(engine)};
+    if (!dungeon::isPassable(map.view, start) || !dungeon::isPassable(map.view, finish)
+      || !dungeon::connected(components, start, finish))
+    {
+      --q;
+      continue;
+    }
+
+    dungeon::SearchResult expected;
+    aStar.seconds += timed([&]() { expected = dungeon::aStar(map.view, start, finish, 1.f, {.stats = &aStar.stats}); });
+    ++aStar.queries;
+    aStar.found += expected.path.empty() ? 0 : 1;
+
+    dungeon::CompressedPath actual;
+    steps.seconds += timed([&]() { actual = loaded->path(start, finish); });
+    ++steps.queries;
+    steps.found += actual.empty() ? 0 : 1;
+    stepCount += actual.size();
+
+    float cost = 0;
+    if (!actual.empty())
+    {
+      auto it = actual.begin();
+      for (auto previous = *it++; it != actual.end(); previous = *it++)
+        cost += dungeon::weight(map.view, previous, *it);
+    }
+    if (actual.empty() || std::abs(cost - expected.dist) > 1e-3f * std::max(1.f, expected.dist))
+    {
+      spdlog::error("First moves disagree on ({}, {}) -> ({}, {}): {} instead of {}",
+        start.x, start.y, finish.x, finish.y, cost, expected.dist);
+      ++mismatches;
+    }
+  }
+
+  spdlog::info("{:.0f}ns per step", steps.seconds / std::max<std::size_t>(stepCount, 1) * 1e9);
+  report(args, {build, save, load, aStar, steps});
+  return mismatches == 0 ? 0 : 1;
+}
+
+// Whole-map distance fields: delta-stepping on one and on all threads against the oracle Dijkstra.
+// Meant for --size 4096, distances have to match exactly since every path adds up its steps in order.
+int benchField(const Args& args)
+{
+  const int size = args.getInt("size", 1024);
+  const int walls = args.getInt("walls", 25);
+  const int sources = args.getInt("sources", 3);
+  const auto threads = static_cast<unsigned>(args.getInt("threads", 0));
+  const auto delta = static_cast<float>(args.getInt("delta", 1 + static_cast<int>(dungeon::WATER_PENALTY)));
+
+  auto map = randomMap(size, walls, static_cast<unsigned>(size));
+  // Some water, so that a small --delta has heavy steps to deal with
+  std::mt19937 engine{static_cast<unsigned>(size)};
+  std::uniform_int_distribution<int> coord{0, size - 1};
+  for (int i = 0; i < size * size / 20; ++i)
+  {
+    auto& tile = map.view(coord(engine), coord(engine));
+    if (tile == dungeon::Tile::Floor)
+      tile = dungeon::Tile::Water;
+  }
+  const dungeon::WalkableIndex walkable{map.view};
+
+  Measurement oracle{.name = "oracle"};
+  Measurement serial{.name = "distanceField_1"};
+  Measurement parallel{.name = fmt::format("distanceField_{}", threads == 0 ? std::thread::hardware_concurrency() : threads)};
+
+  std::size_t mismatches = 0;
+  for (int s = 0; s < sources; ++s)
+  {
+    const auto source = walkable.sample(engine);
+
+    std::vector<float> expected;
+    oracle.seconds += timed([&]() { expected = oracleDists(map.view, source); });
+    ++oracle.queries;
+
+    auto run = [&](Measurement& m, unsigned count)
+      {
+        dungeon::Dists dists;
+        m.seconds += timed([&]()
+          { dists = dungeon::distanceField(map.view, source, {.delta = delta, .threads = count, .stats = &m.stats}); });
+        ++m.queries;
+
+        const auto view = dists.to_mdspan();
+        std::size_t wrong = 0;
+        for (std::size_t i = 0; i < expected.size(); ++i)
+          wrong += view.data_handle()[i] != expected[i] ? 1 : 0;
+        m.found += wrong == 0 ? 1 : 0;
+        if (wrong != 0)
+          spdlog::error("{} from ({}, {}): {} tiles differ from the oracle", m.name, source.x, source.y, wrong);
+        mismatches += wrong;
+      };
+    run(serial, 1);
+    run(parallel, threads);
+  }
+
+  spdlog::info("{:.2f}x over one thread, {:.2f}x over the oracle",
+    serial.seconds / std::max(parallel.seconds, 1e-9), oracle.seconds / std::max(parallel.seconds, 1e-9));
+  report(args, {oracle, serial, parallel});
+  return mismatches == 0 ? 0 : 1;
+}
+
+// Batches of queries with everything on the heap against one arena per batch, released in one go.
+// Both have to find the same paths.
+int benchArena(const Args& args)
+{
+  const int size = args.getInt("size", 200);
+  const int batches = args.getInt("batches", 20);
+  const int batchSize = args.getInt("batch", 100);
+  const int cellSize = args.getInt("cell", 10);
+  const auto arenaBytes = static_cast<std::size_t>(args.getInt("arena_kb", 4096)) << 10;
+
+  auto map = dungeon::make_dungeon(size, size);
+  dungeon::gen_drunk_dungeon(map.view, static_cast<unsigned>(size));
+  const auto hierarchy = dungeon::buildHierarchy(map.view, cellSize);
+  const dungeon::WalkableIndex walkable{map.view};
+  std::mt19937 engine{static_cast<unsigned>(size)};
+
+  Measurement heapAStar{.name = "aStar_heap"};
+  Measurement arenaAStar{.name = "aStar_arena"};
+  Measurement heapAra{.name = "araStar_heap"};
+  Measurement arenaAra{.name = "araStar_arena"};
+  Measurement heapHierarchical{.name = "hierarchicalSearch_heap"};
+  Measurement arenaHierarchical{.name = "hierarchicalSearch_arena"};
+
+  // Reused by every batch, the arena only goes upstream once it is full
+  std::vector<std::byte> buffer(arenaBytes);
+  std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size()};
+
+  std::size_t mismatches = 0;
+  for (int batch = 0; batch < batches; ++batch)
+  {
+    std::vector<glm::ivec2> endpoints(2 * std::size_t(batchSize));
+    walkable.sample(std::span{endpoints}, engine);
+
+    // The results of a batch stay around until it is done, like a frame's worth of agent paths
+    auto runBatch = [&](Measurement& m, std::pmr::memory_resource* memory, auto&& search)
+      {
+        std::vector<dungeon::SearchResult> results;
+        results.reserve(batchSize);
+        m.seconds += timed([&]()
+          {
+            for (int q = 0; q < batchSize; ++q)
+              results.push_back(search(endpoints[2 * q], endpoints[2 * q + 1], dungeon::SearchContext{.stats = &m.stats, .memory = memory}));
+          });
+        m.queries += results.size();
+        for (const auto& result : results)
+          m.found += result.path.empty() ? 0 : 1;
+        return results;
+      };
+
+    auto compare = [&](std::string_view name, const std::vector<dungeon::SearchResult>& heap, const std::vector<dungeon::SearchResult>& arena)
+      {
+        for (std::size_t q = 0; q < heap.size(); ++q)
+          if (heap[q].path.size() != arena[q].path.size() || heap[q].dist != arena[q].dist)
+          {
+            spdlog::error("{} differs with an arena on query {} of batch {}", name, q, batch);
+            ++mismatches;
+          }
+      };
+
+    auto aStar = [&](glm::ivec2 start, glm::ivec2 finish, const dungeon::SearchContext& context)
+      { return dungeon::aStar(map.view, start, finish, 1.f, context); };
+    auto araStar = [&](glm::ivec2 start, glm::ivec2 finish, const dungeon::SearchContext& context)
+      {
+        dungeon::ExpansionBudget unlimited{dungeon::ExpansionBudget::UNLIMITED};
+        std::optional<dungeon::SearchResult> last;
+        for (auto&& slice : dungeon::araStarSliced(map.view, start, finish, 3.f, unlimited, context))
+          if (slice.solution)
+            last.emplace(std::move(slice.result));
+        return last ? std::move(*last) : dungeon::SearchResult{};
+      };
+    // The random endpoints only pick the portals
+    auto hierarchical = [&](glm::ivec2 start, glm::ivec2 finish, const dungeon::SearchContext& context)
+      {
+        const auto[from, to] = portalEndpoints(hierarchy, std::size_t(start.x * 7919 + start.y + finish.x * 104729 + finish.y));
+        return dungeon::hierarchicalSearch(map.view, hierarchy, from, to, context);
+      };
+
+    compare("aStar", runBatch(heapAStar, nullptr, aStar), runBatch(arenaAStar, &arena, aStar));
+    arena.release();
+    compare("araStar", runBatch(heapAra, nullptr, araStar), runBatch(arenaAra, &arena, araStar));
+    arena.release();
+    if (!hierarchy.portals.empty())
+      compare("hierarchicalSearch", runBatch(heapHierarchical, nullptr, hierarchical),
+        runBatch(arenaHierarchical, &arena, hierarchical));
+    arena.release();
+  }
+
+  report(args, {heapAStar, arenaAStar, heapAra, arenaAra, heapHierarchical, arenaHierarchical});
+  return mismatches == 0 ? 0 : 1;
+}
+
+// Replays a trace recorded by the app (pathsearch <hierarchy file> <trace file>) on its own map.
+// --pace recorded starts every query at its recorded time, max runs them back to back.
+// Queries are handed out in order to --threads workers, each runs with the overlay of its time.
+int benchReplay(const Args& args)
+{
+  const auto path = args.get("trace", "queries.trace");
+  const auto threads = static_cast<unsigned>(std::max(1, args.getInt("threads", 1)));
+  const bool recordedPace = args.get("pace", "max") == "recorded";
+  const int cellSize = args.getInt("cell", 10);
+
+  const auto trace = dungeon::loadQueryTrace(path);
+  if (!trace)
+  {
+    spdlog::error("Could not load {}", path);
+    return 1;
+  }
+  const auto view = trace->dungeon.view;
+
+  struct Query
+  {
+    dungeon::TraceEvent event;
+    std::shared_ptr<const dungeon::ObstacleOverlay> overlay;
+  };
+  std::vector<Query> queries;
+  dungeon::ObstacleOverlay overlay;
+  auto snapshot = std::make_shared<const dungeon::ObstacleOverlay>();
+  bool hierarchical = false;
+  for (const auto& event : trace->events)
+  {
+    if (event.kind == dungeon::TraceEvent::Kind::SetCost)
+    {
+      if (event.cost == 0)
+        overlay.reset(event.start);
+      else
+        overlay.setCost(event.start, event.cost);
+      snapshot = std::make_shared<const dungeon::ObstacleOverlay>(overlay);
+      continue;
+    }
+    queries.push_back({event, snapshot});
+    hierarchical = hierarchical || event.algorithm == dungeon::TraceAlgorithm::Hierarchical;
+  }
+
+  std::optional<dungeon::HierarchicalSearchData> hierarchy;
+  if (hierarchical)
+  {
+    if (view.extent(0) % cellSize != 0 || view.extent(1) % cellSize != 0)
+    {
+      spdlog::error("The {}x{} map can't be cut into cells of {}, see --cell", view.extent(1), view.extent(0), cellSize);
+      return 1;
+    }
+    hierarchy = dungeon::buildHierarchy(view, cellSize);
+  }
+
+  // Indexed by TraceAlgorithm
+  static constexpr std::array<std::string_view, 4> NAMES{"aStar", "araStar", "hierarchicalSearch", "dstarLite"};
+
+  // Per worker, merged at the end
+  struct Worker
+  {
+    std::array<Measurement, NAMES.size()> measurements;
+    Clock::duration worstLag{};
+    // Kept between queries like the app does, so the planner gets to repair its tree
+    dungeon::ObstacleOverlay plannerOverlay;
+    std::optional<dungeon::DStarLite> planner;
+  };
+  std::vector<Worker> workers(threads);
+
+  auto run = [&](Worker& worker, const Query& query)
+    {
+      const auto start = query.event.start;
+      const auto finish = query.event.finish;
+      const auto* overlay = query.overlay.get();
+      auto& m = worker.measurements[static_cast<std::size_t>(query.event.algorithm)];
+
+      bool found = false;
+      m.seconds += timed([&]()
+        {
+          switch (query.event.algorithm)
+          {
+            case dungeon::TraceAlgorithm::AStar:
+              found = !dungeon::aStar(view, start, finish, 1.f, {.stats = &m.stats, .overlay = overlay}).path.empty();
+              break;
+
+            case dungeon::TraceAlgorithm::AraStar:
+              for (const auto& result : dungeon::araStar(view, start, finish, 3.f, {.stats = &m.stats, .overlay = overlay}))
+                found = !result.path.empty();
+              break;
+
+            case dungeon::TraceAlgorithm::Hierarchical:
+              found = !dungeon::hierarchicalSearch(view, *hierarchy, start, finish, {.stats = &m.stats, .overlay = overlay})
+                .path.empty();
+              break;
+
+            case dungeon::TraceAlgorithm::Incremental:
+            {
+              // Same bookkeeping as Game::incrementalSearch
+              std::vector<glm::ivec2> changed;
+              for (const auto&[v, cost] : *query.overlay)
+                if (worker.plannerOverlay.extraCost(v) != cost)
+                  changed.push_back(v);
+              for (const auto&[v, cost] : worker.plannerOverlay)
+                if (query.overlay->extraCost(v) != cost)
+                  changed.push_back(v);
+              worker.plannerOverlay = *query.overlay;
+
+              if (!worker.planner || worker.planner->goal() != finish)
+              {
+                worker.planner.emplace(view, start, finish, &worker.plannerOverlay);
+              }
+              else
+              {
+                for (auto v : changed)
+                  worker.planner->tileChanged(v);
+                if (worker.planner->start() != start)
+                  worker.planner->moveStart(start);
+              }
+              worker.planner->replan(&m.stats);
+              found = !worker.planner->path().empty();
+              break;
+            }
+          }
+        });
+      ++m.queries;
+      m.found += found ? 1 : 0;
+    };
+
+  Measurement total{.name = "replay", .queries = queries.size()};
+  std::atomic<std::size_t> next{0};
+  total.seconds = timed([&]()
+    {
+      const auto begin = Clock::now();
+      std::vector<std::jthread> pool;
+      for (auto& worker : workers)
+        pool.emplace_back([&, self = &worker]()
+          {
+            for (auto i = next++; i < queries.size(); i = next++)
+            {
+              if (recordedPace)
+              {
+                const auto due = begin + queries[i].event.time;
+                std::this_thread::sleep_until(due);
+                self->worstLag = std::max(self->worstLag, Clock::now() - due);
+              }
+              run(*self, queries[i]);
+            }
+          });
+    });
+
+  std::vector<Measurement> measurements;
+  Clock::duration worstLag{};
+  for (std::size_t a = 0; a < NAMES.size(); ++a)
+  {
+    Measurement merged{.name = std::string{NAMES[a]}};
+    for (const auto& worker : workers)
+    {
+      const auto& m = worker.measurements[a];
+      merged.queries += m.queries;
+      merged.found += m.found;
+      merged.seconds += m.seconds;
+      merged.stats += m.stats;
+    }
+    if (merged.queries > 0)
+      measurements.push_back(std::move(merged));
+  }
+  for (const auto& worker : workers)
+    worstLag = std::max(worstLag, worker.worstLag);
+  measurements.push_back(total);
+
+  spdlog::info("{} queries and {} overlay changes over {:.1f}s of recording",
+    queries.size(), trace->events.size() - queries.size(),
+    trace->events.empty() ? 0. : std::chrono::duration<double>(trace->events.back().time).count());
+  if (recordedPace)
+    spdlog::info("Worst start behind the recorded time: {:.2f}ms", std::chrono::duration<double, std::milli>(worstLag).count());
+  report(args, measurements);
+  return 0;
+}
+
+// Growing crowds with random distinct starts and goals on one map. WHCA* must never put two agents
+// on one tile or let them swap places, independent aStar paths walked in lockstep show what it avoids.
+int benchCooperative(const Args& args)
+{
+  const int size = args.getInt("size", 64);
+  const int walls = args.getInt("walls", 20);
+  const int minAgents = args.getInt("min_agents", 8);
+  const int maxAgents = args.getInt("max_agents", 256);
+  const int maxTicks = args.getInt("ticks", 400);
+  const dungeon::CooperativeParams defaults;
+  const int window = args.getInt("window", defaults.window);
+  const int interval = args.getInt("interval", window / 2);
+
+  auto map = randomMap(size, walls, static_cast<unsigned>(size));
+  const auto components = dungeon::buildComponents(map.view);
+  const dungeon::WalkableIndex walkable{map.view};
+
+  std::vector<Measurement> measurements;
+  std::size_t collisions = 0;
+  for (int agents = minAgents; agents <= maxAgents; agents *= 2)
+  {
+    // Distinct starts and distinct goals, each goal reachable from its start
+    std::mt19937 engine{static_cast<unsigned>(agents)};
+    std::unordered_set<glm::ivec2> usedStarts;
+    std::unordered_set<glm::ivec2> usedGoals;
+    std::vector<Query> queries;
+    while (queries.size() < static_cast<std::size_t>(agents))
+    {
+      const auto start = walkable.sample(engine);
+      const auto goal = walkable.sample(engine);
+      if (usedStarts.contains(start) || usedGoals.contains(goal) || !dungeon::connected(components, start, goal))
+        continue;
+      usedStarts.insert(start);
+      usedGoals.insert(goal);
+      queries.push_back({start, goal});
+    }
+
+    Measurement whca{.name = fmt::format("whca_{}", agents), .queries = queries.size()};
+    dungeon::CooperativePlanner planner{map.view, {.window = window, .replanInterval = interval, .stats = &whca.stats}};
+    for (const auto&[start, goal] : queries)
+      planner.addAgent(start, goal);
+
+    auto arrived = [&]()
+      {
+        std::size_t result = 0;
+        for (dungeon::CooperativePlanner::AgentId a = 0; a < planner.agentCount(); ++a)
+          result += planner.position(a) == planner.goal(a) ? 1 : 0;
+        return result;
+      };
+
+    std::size_t lastArrival = 0;
+    std::vector<glm::ivec2> previous(planner.agentCount());
+    for (int tick = 0; tick < maxTicks && arrived() < planner.agentCount(); ++tick)
+    {
+      for (dungeon::CooperativePlanner::AgentId a = 0; a < planner.agentCount(); ++a)
+        previous[a] = planner.position(a);
+      whca.seconds += timed([&]() { planner.tick(); });
+
+      std::unordered_map<glm::ivec2, dungeon::CooperativePlanner::AgentId> occupied;
+      std::unordered_map<glm::ivec2, dungeon::CooperativePlanner::AgentId> wasOccupied;
+      for (dungeon::CooperativePlanner::AgentId a = 0; a < planner.agentCount(); ++a)
+        wasOccupied.emplace(previous[a], a);
+      for (dungeon::CooperativePlanner::AgentId a = 0; a < planner.agentCount(); ++a)
+      {
+        const auto position = planner.position(a);
+        const auto[it, inserted] = occupied.try_emplace(position, a);
+        if (!inserted)
+        {
+          spdlog::error("{} agents: {} and {} share ({}, {}) at tick {}", agents, a, it->second, position.x, position.y, tick);
+          ++collisions;
+        }
+
+        const auto before = wasOccupied.find(position);
+        if (before != wasOccupied.end() && before->second > a && planner.position(before->second) == previous[a])
+        {
+          spdlog::error("{} agents: {} and {} swap places at tick {}", agents, a, before->second, tick);
+          ++collisions;
+        }
+      }
+      lastArrival = tick + 1;
+    }
+    whca.found = arrived();
+
+    // Independent paths walked one tile per tick, every extra agent on a tile counts
+    std::vector<std::vector<glm::ivec2>> paths;
+    for (const auto&[start, goal] : queries)
+    {
+      const auto result = dungeon::aStar(map.view, start, goal, 1.f);
+      paths.emplace_back(result.path.begin(), result.path.end());
+    }
+    std::size_t independentCollisions = 0;
+    for (std::size_t tick = 0; tick < static_cast<std::size_t>(maxTicks); ++tick)
+    {
+      auto at = [&paths](std::size_t a, std::size_t t) { return paths[a][std::min(t, paths[a].size() - 1)]; };
+      std::unordered_set<glm::ivec2> occupied;
+      for (std::size_t a = 0; a < paths.size(); ++a)
+        independentCollisions += occupied.insert(at(a, tick)).second ? 0 : 1;
+    }
+
+    spdlog::info("{} agents: {} arrived in {} ticks, {:.0f} agent-ticks/s, {} blocked reservations, {} KiB of reservations;"
+      " independent aStar paths would collide {} times",
+      agents, whca.found, lastArrival, double(agents) * lastArrival / std::max(whca.seconds, 1e-9),
+      planner.conflicts(), planner.reservations().memoryBytes() >> 10, independentCollisions);
+    measurements.push_back(whca);
+  }
+
+  report(args, measurements);
+  return collisions == 0 ? 0 : 1;
+}
+
+// One agent travelling through an endless world in hops of a few chunks, with a memory cap
+// small enough that chunks behind it are evicted. Paths are checked step by step against a
+// second world with the same seed that never evicts anything, so a chunk that came back
+// different from before or a portal matched across the wrong border shows up as a wall.
+int benchWorld(const Args& args)
+{
+  const dungeon::WorldParams defaults;
+  const dungeon::WorldParams params{
+    .seed = static_cast<std::uint64_t>(args.getInt("seed", 1)),
+    .chunkSize = args.getInt("chunk", defaults.chunkSize),
+    .cellSize = args.getInt("cell", defaults.cellSize),
+    .memoryCap = static_cast<std::size_t>(args.getInt("cap_kib", 2048)) << 10,
+    .prefetchRadius = args.getInt("prefetch", 1),
+    .threads = static_cast<unsigned>(args.getInt("threads", 0)),
+  };
+  const int hops = args.getInt("hops", 200);
+  const int hopLength = args.getInt("hop", 3 * params.chunkSize);
+
+  dungeon::WorldStreamer world{params};
+  dungeon::WorldStreamer reference{{.seed = params.seed, .chunkSize = params.chunkSize, .cellSize = params.cellSize,
+    .memoryCap = std::numeric_limits<std::size_t>::max(), .prefetchRadius = 0, .threads = 1}};
+
+  // The walkable tile closest to v, ring by ring
+  auto walkableNear = [&world](glm::ivec2 v)
+    {
+      for (int ring = 0;; ++ring)
+        for (int y = -ring; y <= ring; ++y)
+          for (int x = -ring; x <= ring; ++x)
+            if (std::max(std::abs(x), std::abs(y)) == ring && world.get(v + glm::ivec2{x, y}) != dungeon::Tile::Wall)
+              return v + glm::ivec2{x, y};
+    };
+
+  std::mt19937 engine{static_cast<unsigned>(params.seed)};
+  std::uniform_real_distribution<float> angle{0.f, 6.2831853f};
+  Measurement measurement{.name = "world", .queries = static_cast<std::size_t>(hops)};
+  std::size_t broken = 0;
+  double pathLength = 0;
+
+  auto position = walkableNear({0, 0});
+  for (int hop = 0; hop < hops; ++hop)
+  {
+    const auto direction = angle(engine);
+    const auto goal = walkableNear(position + glm::ivec2{glm::vec2{std::cos(direction), std::sin(direction)} * float(hopLength)});
+    const std::array focus{position};
+    world.setFocus(focus);
+
+    dungeon::SearchResult result;
+    measurement.seconds += timed([&]() { result = world.findPath(position, goal, &measurement.stats); });
+    if (result.path.empty())
+    {
+      spdlog::error("Hop {}: no path from ({}, {}) to ({}, {})", hop, position.x, position.y, goal.x, goal.y);
+      ++broken;
+      continue;
+    }
+
+    // Steps are 4-neighbours by construction of CompressedPath, only the tiles are left to check
+    for (auto v : result.path)
+      if (reference.get(v) == dungeon::Tile::Wall)
+      {
+        spdlog::error("Hop {}: the path runs into a wall at ({}, {})", hop, v.x, v.y);
+        ++broken;
+        break;
+      }
+    if (result.path.front() != position || result.path.back() != goal)
+    {
+      spdlog::error("Hop {}: the path does not join ({}, {}) to ({}, {})", hop, position.x, position.y, goal.x, goal.y);
+      ++broken;
+    }
+
+    ++measurement.found;
+    pathLength += result.dist;
+    position = goal;
+  }
+
+  const auto counters = world.counters();
+  spdlog::info("{} hops, {:.0f} tiles on average, {:.2f}ms per path; {} chunks and {} hierarchies loaded in {} KiB;"
+    " {} generated ({} while a search waited), {} hierarchies built, {} evicted",
+    hops, pathLength / std::max<std::size_t>(measurement.found, 1), 1000 * measurement.seconds / std::max(hops, 1),
+    counters.loadedChunks, counters.hierarchies, counters.memoryBytes >> 10,
+    counters.generated, counters.generatedInline, counters.hierarchiesBuilt, counters.evicted);
+  report(args, {measurement});
+  return broken == 0 ? 0 : 1;
+}
+
+// Stands in for a baked bitmap, the cache only ever holds and hands out the pointer
+struct FakeChunk
+{
+  int level;
+  glm::ivec2 chunk;
+  std::uint64_t lastUsed;
+  // Every chunk alive, and the level and lastUsed of the ones dropped since the caller last looked
+  std::unordered_set<FakeChunk*>* alive;
+  std::vector<std::pair<int, std::uint64_t>>* dropped;
+};
+
+struct FakeChunkDeleter
+{
+  void operator()(FakeChunk* chunk) const
+  {
+    chunk->alive->erase(chunk);
+    chunk->dropped->emplace_back(chunk->level, chunk->lastUsed);
+    delete chunk;
+  }
+};
+
+// TileLayer's chunk cache under the camera of the app zooming in and out of a large map and
+// panning across it, without a display: bakes only count the tiles they would sample. Checks
+// every frame that the level keeps a baked tile between 1x and 2x its size on screen, that a
+// frame bakes past BAKE_TILES_PER_FRAME only with its last chunk, that every chunk is drawn from
+// the right part of itself or a coarser one, that a chunk is left blank only when neither is
+// baked, that the cache stays within MAX_CHUNKS unless every chunk in it was used this frame and
+// that the ones dropped were the least recently used, MAX_LEVEL after all others. Each still
+// camera has to be drawn entirely from its own level within --settle frames.
+int benchTiles(const Args& args)
+{
+  using Cache = TileCache<FakeChunk, FakeChunkDeleter>;
+  // Only its extent matters to the cache
+  const glm::ivec2 mapSize{args.getInt("size", 16384)};
+  const glm::vec2 screen{args.getInt("width", 3840), args.getInt("height", 2160)};
+  const int settle = args.getInt("settle", 240);
+  const int pan = args.getInt("pan", 64);
+
+  std::unordered_set<FakeChunk*> alive;
+  std::vector<std::pair<int, std::uint64_t>> dropped;
+  Cache cache;
+
+  // The camera of Application and Game: the wheel position z scales exp(z / 10)
+  glm::vec2 camPos = glm::vec2{mapSize} / 2.f;
+  float z = 0;
+  auto tilePixels = [&]() { return std::exp(z / 10.f) * 0.05f * (screen.x + screen.y) / 2.f; };
+  // Far enough out for the whole map to fit on screen
+  const float zOut = std::floor(10.f * std::log(std::min(screen.x, screen.y) / float(std::max(mapSize.x, mapSize.y)) / tilePixels()));
+  // The farthest out still drawn from level 0 chunks, where the most of them are on screen
+  const float zWide = std::floor(10.f * std::log(Cache::TILE_PIXELS / 2.f / tilePixels())) + 1;
+
+  struct Phase
+  {
+    std::string name;
+    int frames{0};
+    std::size_t baked{0};
+    std::size_t bakedTiles{0};
+    int maxFrameTiles{0};
+    std::size_t coarser{0};
+    std::size_t blanks{0};
+    std::size_t dropped{0};
+    std::size_t maxChunks{0};
+    int coveredAfter{-1};
+    int settledAfter{-1};
+  };
+  std::vector<Phase> phases;
+  std::size_t failures = 0;
+  auto fail = [&failures](const std::string& what)
+    {
+      if (failures++ < 10)
+        spdlog::error("{}", what);
+    };
+
+  std::uint64_t frame = 0;
+  // One frame at the current camera, true once every chunk on screen was drawn from its own level
+  auto step = [&](Phase& phase)
+    {
+      ++frame;
+      ++phase.frames;
+      const float tp = tilePixels();
+      const auto a = (-screen / 2.f) / tp + camPos;
+      const auto b = (screen / 2.f) / tp + camPos;
+      const auto min = glm::clamp(glm::ivec2(glm::floor(a)), glm::ivec2{0}, mapSize);
+      const auto max = glm::clamp(glm::ivec2(glm::ceil(b)), glm::ivec2{0}, mapSize);
+
+      const int level = Cache::level(tp);
+      const float bakedPixels = Cache::TILE_PIXELS / static_cast<float>(1 << level);
+      if ((level > 0 && bakedPixels < tp) || (level < Cache::MAX_LEVEL && bakedPixels >= 2 * tp))
+        fail(fmt::format("Frame {}: level {} bakes {} pixels per tile for {} on screen", frame, level, bakedPixels, tp));
+
+      std::set<std::tuple<int, int, int>> before;
+      for (auto* chunk : alive)
+        before.emplace(chunk->level, chunk->chunk.x, chunk->chunk.y);
+      dropped.clear();
+
+      std::vector<int> bakes;
+      const int span = Cache::CHUNK << level;
+      std::set<std::pair<int, int>> drawn;
+      std::size_t coarser = 0;
+      cache.frame(level, min, max,
+        [&](int bakeLevel, glm::ivec2 chunk)
+          {
+            bakes.push_back(Cache::bakeCost(bakeLevel));
+            Cache::BitmapPtr bitmap{new FakeChunk{bakeLevel, chunk, frame, &alive, &dropped}};
+            alive.insert(bitmap.get());
+            return bitmap;
+          },
+        [&](const Cache::Patch& patch)
+          {
+            auto& from = *patch.bitmap;
+            from.lastUsed = frame;
+            const auto chunk = patch.origin / span;
+            if (!drawn.emplace(chunk.x, chunk.y).second)
+              fail(fmt::format("Frame {}: chunk ({}, {}) of level {} drawn twice", frame, chunk.x, chunk.y, level));
+
+            const int fromSpan = Cache::CHUNK << from.level;
+            const float scale = Cache::BITMAP_PIXELS / static_cast<float>(fromSpan);
+            if (patch.tiles != span || from.level < level || patch.origin % span != glm::ivec2{0}
+              || glm::any(glm::lessThan(patch.origin, from.chunk * fromSpan))
+              || glm::any(glm::greaterThan(patch.origin + patch.tiles, (from.chunk + 1) * fromSpan))
+              || patch.size != static_cast<float>(patch.tiles) * scale
+              || patch.offset != glm::vec2{patch.origin - from.chunk * fromSpan} * scale)
+              fail(fmt::format("Frame {}: tiles ({}, {}) + {} at level {} drawn from a wrong part of chunk ({}, {}) of level {}",
+                frame, patch.origin.x, patch.origin.y, patch.tiles, level, from.chunk.x, from.chunk.y, from.level));
+            coarser += from.level > level ? 1 : 0;
+          });
+
+      int tiles = 0;
+      for (std::size_t i = 0; i < bakes.size(); ++i)
+      {
+        if (i + 1 < bakes.size() && tiles + bakes[i] >= Cache::BAKE_TILES_PER_FRAME)
+          fail(fmt::format("Frame {}: baked {} chunks past the budget", frame, bakes.size() - i - 1));
+        tiles += bakes[i];
+      }
+      phase.baked += bakes.size();
+      phase.bakedTiles += static_cast<std::size_t>(tiles);
+      phase.maxFrameTiles = std::max(phase.maxFrameTiles, tiles);
+
+      // A chunk baked this frame is drawn, so whatever could have stood in for a blank one was there before
+      std::size_t blanks = 0;
+      if (glm::all(glm::lessThan(min, max)))
+        for (int y = min.y / span; y <= (max.y - 1) / span; ++y)
+          for (int x = min.x / span; x <= (max.x - 1) / span; ++x)
+          {
+            if (drawn.contains({x, y}))
+              continue;
+            ++blanks;
+            for (int up = 0; level + up <= Cache::MAX_LEVEL; ++up)
+              if (before.contains({level + up, x >> up, y >> up}))
+                fail(fmt::format("Frame {}: chunk ({}, {}) of level {} left blank with level {} baked", frame, x, y, level, level + up));
+          }
+      phase.blanks += blanks;
+      phase.coarser += coarser;
+      if (blanks == 0 && phase.coveredAfter < 0)
+        phase.coveredAfter = phase.frames;
+
+      // Dropped in the order of MAX_LEVEL last, then least recently used
+      auto rank = [](int chunkLevel, std::uint64_t lastUsed) { return std::pair{chunkLevel == Cache::MAX_LEVEL, lastUsed}; };
+      auto firstKept = std::pair{true, std::numeric_limits<std::uint64_t>::max()};
+      bool allUsed = true;
+      for (auto* chunk : alive)
+        if (chunk->lastUsed != frame)
+        {
+          firstKept = std::min(firstKept, rank(chunk->level, chunk->lastUsed));
+          allUsed = false;
+        }
+      if (cache.size() != alive.size())
+        fail(fmt::format("Frame {}: the cache holds {} chunks, {} are alive", frame, cache.size(), alive.size()));
+      if (alive.size() > Cache::MAX_CHUNKS && !allUsed)
+        fail(fmt::format("Frame {}: {} chunks kept, some not used this frame", frame, alive.size()));
+      for (const auto&[droppedLevel, lastUsed] : dropped)
+        if (lastUsed == frame || rank(droppedLevel, lastUsed) > firstKept)
+          fail(fmt::format("Frame {}: dropped a chunk of level {} last used in frame {} before one last used in frame {}",
+            frame, droppedLevel, lastUsed, firstKept.second));
+      phase.dropped += dropped.size();
+      phase.maxChunks = std::max(phase.maxChunks, alive.size());
+      return blanks == 0 && coarser == 0;
+    };
+
+  auto still = [&](std::string name)
+    {
+      auto& phase = phases.emplace_back(Phase{.name = std::move(name)});
+      for (int i = 0; i < settle && phase.settledAfter < 0; ++i)
+        if (step(phase))
+          phase.settledAfter = phase.frames;
+      if (phase.settledAfter < 0)
+        fail(fmt::format("{}: chunks still missing after {} frames", phase.name, settle));
+    };
+
+  // A notch of the wheel per frame around a point off the center of the screen, which stays
+  // under the mouse like in Game::wheel, so the view also drifts
+  auto zoom = [&](std::string name, float to)
+    {
+      auto& phase = phases.emplace_back(Phase{.name = std::move(name)});
+      const glm::vec2 mouse = screen * glm::vec2{0.2f, 0.1f};
+      while (z != to)
+      {
+        const auto pivot = camPos + mouse / tilePixels();
+        z = to > z ? std::min(z + 1, to) : std::max(z - 1, to);
+        camPos = pivot - mouse / tilePixels();
+        step(phase);
+      }
+    };
+
+  z = zOut;
+  still("overview");
+  zoom("zoom in", 0);
+  still("close up");
+  zoom("zoom out to level 0", zWide);
+  still("level 0");
+  {
+    // A screen width per frame, every frame needs a fresh set of level 0 chunks
+    auto& phase = phases.emplace_back(Phase{.name = "pan"});
+    for (int i = 0; i < pan; ++i)
+    {
+      camPos.x = std::fmod(camPos.x + screen.x / tilePixels(), static_cast<float>(mapSize.x));
+      step(phase);
+    }
+  }
+  still("after pan");
+  zoom("zoom out", zOut);
+  still("overview again");
+
+  for (const auto& p : phases)
+    spdlog::info("{}: {} frames, {} chunks baked from {} tiles, at most {} tiles a frame; {} drawn from a coarser level,"
+      " {} left blank; {} dropped, at most {} kept{}{}",
+      p.name, p.frames, p.baked, p.bakedTiles, p.maxFrameTiles, p.coarser, p.blanks, p.dropped, p.maxChunks,
+      p.coveredAfter >= 0 ? fmt::format(", covered after {} frames", p.coveredAfter) : "",
+      p.settledAfter >= 0 ? fmt::format(", all of its level after {}", p.settledAfter) : "");
+  if (failures > 0)
+    spdlog::error("{} checks failed", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+const std::map<std::string, std::function<int(const Args&)>> MODES{
+  {"queries", benchQueries},
+  {"serialize", benchSerialize},
+  {"layouts", benchLayouts},
+  {"replan", benchReplan},
+  {"snapshots", benchSnapshots},
+  {"sliced", benchSliced},
+  {"sparse", benchSparse},
+  {"generate", benchGenerate},
+  {"kernels", benchKernels},
+  {"verify", benchVerify},
+  {"contraction", benchContraction},
+  {"firstmoves", benchFirstMoves},
+  {"field", benchField},
+  {"arena", benchArena},
+  {"replay", benchReplay},
+  {"cooperative", benchCooperative},
+  {"world", benchWorld},
+  {"tiles", benchTiles},
+};
+
+}
+
+int main(int argc, char** argv)
+{
+  const std::string mode = argc > 1 ? argv[1] : "queries";
+
+  auto it = MODES.find(mode);
+  if (it == MODES.end())
+  {
+    spdlog::error("Unknown mode '{}'", mode);
+    for (const auto&[name, _] : MODES)
+      spdlog::info("Available: {} [--key value]...", name);
+    return 1;
+  }
+
+  if constexpr (!dungeon::STATS_ENABLED)
+    spdlog::warn("Built without PATHSEARCH_STATS, only timings will be reported");
+
+  return it->second(Args(argc, argv, 2));
+}
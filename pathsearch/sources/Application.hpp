@@ -11,7 +11,9 @@ class Application
   , public Game<Application>
 {
 public:
-  Application(int, char**)
+  // pathsearch [hierarchy file] [query trace to record]
+  Application(int argc, char** argv)
+    : Game<Application>{argc > 1 ? argv[1] : nullptr, argc > 2 ? argv[2] : nullptr}
   {
   }
 
@@ -5,7 +5,9 @@
 #include <glm/glm.hpp>
 #include <function2/function2.hpp>
 #include <limits>
+#include <memory>
 #include <optional>
+#include <utility>
 #include <spdlog/fmt/fmt.h>
 #include <allegro5/keycodes.h>
 #include <allegro5/allegro5.h>
@@ -17,28 +19,51 @@
 #include "dungeon/pathsearch.hpp"
 #include "glm/geometric.hpp"
 #include "imgui.h"
+#include "render.hpp"
 #include "util.hpp"
 
+#include "dungeon/dstarLite.hpp"
 #include "dungeon/dungeon.hpp"
 #include "dungeon/dungeonGenerator.hpp"
 #include "dungeon/dungeonUtils.hpp"
+#include "dungeon/grid.hpp"
+#include "dungeon/queryTrace.hpp"
+#include "dungeon/searchWorker.hpp"
+#include "dungeon/serialization.hpp"
+#include "dungeon/smoothing.hpp"
 
 
 template<class Derived>
 class Game
 {
  public:
-  Game()
-    : dungeon_{dungeon::make_dungeon(50, 50)}
+  // With a hierarchy file the map and its preprocessing are loaded from it,
+  // or saved to it if it is missing or stale. With a trace file every query is recorded to it.
+  explicit Game(const char* hierarchyFile = nullptr, const char* traceFile = nullptr)
   {
-    dungeon::gen_drunk_dungeon(dungeon_.view);
+    if (auto loaded = hierarchyFile ? dungeon::loadHierarchy(hierarchyFile) : std::nullopt)
+    {
+      dungeon_.view = loaded->dungeon;
+      hierarchicalData_ = std::move(loaded->hierarchy);
+      mapStorage_ = std::move(loaded->storage);
+    }
+    else
+    {
+      dungeon_ = dungeon::make_dungeon(50, 50);
+      dungeon::gen_drunk_dungeon(dungeon_.view);
 
+      hierarchicalData_ = dungeon::buildHierarchy(dungeon_.view, 10, &buildStats_);
 
-    hierarchicalData_ = dungeon::buildHierarchy(dungeon_.view, 10);
+      if (hierarchyFile)
+        dungeon::saveHierarchy(hierarchyFile, dungeon_.view, hierarchicalData_);
+    }
 
     searchStart_ = dungeon::find_walkable_tile(dungeon_.view);
     searchEnd_ = dungeon::find_walkable_tile(dungeon_.view);
 
+    if (traceFile)
+      recorder_.emplace(traceFile, dungeon_.view);
+
     restartSearch();
   }
 
@@ -61,11 +86,60 @@ class Game
 
   void drawGui()
   {
+    receiveSearchResults();
+
     ImGui::Begin("Kek");
     ImGui::Checkbox("Additional debug info", &additionalDebugInfo_);
+    if (ImGui::Checkbox("Smooth path", &smoothPath_))
+      updateSmoothedPath();
+
+    int mode = static_cast<int>(searchMode_);
+    ImGui::RadioButton("Hierarchical", &mode, static_cast<int>(SearchMode::Hierarchical));
+    ImGui::RadioButton("Anytime (ARA*)", &mode, static_cast<int>(SearchMode::Anytime));
+    ImGui::RadioButton("Incremental (D* Lite)", &mode, static_cast<int>(SearchMode::Incremental));
+    if (mode != static_cast<int>(searchMode_))
+    {
+      searchMode_ = static_cast<SearchMode>(mode);
+      incremental_.reset();
+      restartSearch();
+    }
+    if (searchWorker_.busy())
+      ImGui::Text("Searching...");
+
+    if constexpr (dungeon::STATS_ENABLED)
+    {
+      auto showStats = [](const char* title, const dungeon::SearchStats& stats)
+        {
+          if (!ImGui::CollapsingHeader(title))
+            return;
+          for (std::size_t i = 0; i < dungeon::COUNTER_NAMES.size(); ++i)
+            ImGui::Text("%s: %llu", dungeon::COUNTER_NAMES[i].data(), static_cast<unsigned long long>(stats.counters[i]));
+          for (std::size_t i = 0; i < dungeon::PHASE_NAMES.size(); ++i)
+            if (stats.seconds[i] > 0)
+              ImGui::Text("%s: %.3f ms", dungeon::PHASE_NAMES[i].data(), stats.seconds[i] * 1000.);
+        };
+      showStats("Last search", searchStats_);
+      showStats("Hierarchy build", buildStats_);
+    }
     ImGui::End();
   }
 
+  void keyDown(int keycode)
+  {
+    // Toggles a temporary blocker under the cursor, the hierarchy is left alone
+    if (keycode == ALLEGRO_KEY_B)
+    {
+      const auto v = tileUnderCursor();
+      if (overlay_.blocked(v))
+        overlay_.reset(v);
+      else
+        overlay_.block(v);
+      if (recorder_)
+        recorder_->costChanged(v, overlay_.extraCost(v));
+      restartSearch();
+    }
+  }
+
   void mouseDown(unsigned int button)
   {
     switch (button)
@@ -84,13 +158,19 @@ class Game
     switch (button)
     {
       case 1:
-        searchStart_ = glm::ivec2(self().screenToWorld(mousePosition_));
-        restartSearch();
+        if (const auto tile = tileUnderCursor(); dungeon::inBounds(tile, dungeon_.view.extents()))
+        {
+          searchStart_ = tile;
+          restartSearch();
+        }
         break;
 
       case 2:
-        searchEnd_ = glm::ivec2(self().screenToWorld(mousePosition_));
-        restartSearch();
+        if (const auto tile = tileUnderCursor(); dungeon::inBounds(tile, dungeon_.view.extents()))
+        {
+          searchEnd_ = tile;
+          restartSearch();
+        }
         break;
 
       case 3:
@@ -102,83 +182,144 @@ class Game
     }
   }
 
+  glm::ivec2 tileUnderCursor()
+  {
+    return glm::ivec2(glm::floor(self().screenToWorld(mousePosition_)));
+  }
+
+  // Hands the query to the worker, whatever it is still doing becomes stale.
+  // Searches only read the map and the hierarchy, which never change,
+  // everything else they need is captured by value.
   void restartSearch()
   {
-    searchResult_ = dungeon::hierarchicalSearch(dungeon_.view, hierarchicalData_, searchStart_, searchEnd_);
+    const auto start = searchStart_;
+    const auto end = searchEnd_;
+    auto overlay = std::make_shared<const dungeon::ObstacleOverlay>(overlay_);
+
+    if (recorder_)
+    {
+      constexpr dungeon::TraceAlgorithm ALGORITHMS[]{
+        dungeon::TraceAlgorithm::Hierarchical, dungeon::TraceAlgorithm::AraStar, dungeon::TraceAlgorithm::Incremental};
+      recorder_->query(ALGORITHMS[static_cast<int>(searchMode_)], start, end);
+    }
+
+    switch (searchMode_)
+    {
+      case SearchMode::Hierarchical:
+        searchWorker_.submit([this, start, end, overlay](dungeon::ExpansionBudget& budget, dungeon::SearchStats* stats)
+          {
+            return dungeon::hierarchicalSearchSliced(dungeon_.view, hierarchicalData_, start, end, budget,
+              {.stats = stats, .overlay = overlay.get()});
+          });
+        break;
+
+      case SearchMode::Anytime:
+        searchWorker_.submit([this, start, end, overlay](dungeon::ExpansionBudget& budget, dungeon::SearchStats* stats)
+          {
+            return dungeon::araStarSliced(dungeon_.view, start, end, 3.f, budget,
+              {.output = dungeon::SearchOutput::Full, .stats = stats, .overlay = overlay.get()});
+          });
+        break;
+
+      case SearchMode::Incremental:
+        if (!incremental_)
+          incremental_ = std::make_shared<IncrementalState>();
+        searchWorker_.submit([this, state = incremental_, start, end, overlay](dungeon::ExpansionBudget& budget, dungeon::SearchStats* stats)
+          { return incrementalSearch(dungeon_.view, state, start, end, *overlay, budget, stats); });
+        break;
+    }
   }
 
   void draw()
   {
-    static auto wallSprite = self().loadSprite(PROJECT_SOURCE_DIR "/pathsearch/resources/wall_mid.png");
-    static auto floorSprite = self().loadSprite(PROJECT_SOURCE_DIR "/pathsearch/resources/floor_1.png");
-    static auto waterSprite = self().loadSprite(PROJECT_SOURCE_DIR "/pathsearch/resources/water.png");
+    if (!tilesReady_)
+    {
+      auto wallSprite = self().loadSprite(PROJECT_SOURCE_DIR "/pathsearch/resources/wall_mid.png");
+      auto floorSprite = self().loadSprite(PROJECT_SOURCE_DIR "/pathsearch/resources/floor_1.png");
+      auto waterSprite = self().loadSprite(PROJECT_SOURCE_DIR "/pathsearch/resources/water.png");
+
+      const std::array<std::pair<dungeon::Tile, ALLEGRO_BITMAP*>, 3> sprites{{
+        {dungeon::Tile::Floor, self().getSpriteBitmap(floorSprite)},
+        {dungeon::Tile::Wall, self().getSpriteBitmap(wallSprite)},
+        {dungeon::Tile::Water, self().getSpriteBitmap(waterSprite)},
+      }};
+      tileLayer_.setSprites(sprites);
+      tilesReady_ = true;
+    }
 
-    auto bitmapFor = [&](dungeon::Tile tile)
-      {
-        switch (tile)
-        {
-          case dungeon::Tile::Floor:
-            return self().getSpriteBitmap(floorSprite);
+    // Everything below only looks at what is on screen
+    const auto view = visibleTiles();
+    const auto viewMin = view.first;
+    const auto viewMax = view.second;
+    const auto tilePixels = self().worldToScreen({1, 0}).x - self().worldToScreen({0, 0}).x;
+    auto visible = [viewMin, viewMax](glm::ivec2 v) { return glm::all(glm::greaterThanEqual(v, viewMin)) && glm::all(glm::lessThan(v, viewMax)); };
 
-          case dungeon::Tile::Wall:
-            return self().getSpriteBitmap(wallSprite);
+    tileLayer_.draw(dungeon_.view, viewMin, viewMax, [this](glm::vec2 v) { return self().worldToScreen(v); });
 
-          case dungeon::Tile::Water:
-            return self().getSpriteBitmap(waterSprite);
-        }
-      };
+    const auto& dists = searchResult_.dists;
+    if (viewMax.y <= dists.extent(0) && viewMax.x <= dists.extent(1))
+    {
+      for (int y = viewMin.y; y < viewMax.y; ++y)
+        for (int x = viewMin.x; x < viewMax.x; ++x)
+          if (dists(y, x) != dungeon::INF)
+            quads_.add(self().worldToScreen({x, y}), self().worldToScreen(glm::ivec2{x, y} + glm::ivec2{1, 1}), al_map_rgba(255, 255, 0, 32));
+    }
 
-    for (int y = 0; y < dungeon_.view.extent(0); ++y)
-      for (int x = 0; x < dungeon_.view.extent(1); ++x)
-      {
-        auto min = self().worldToScreen({x, y});
-        auto max = self().worldToScreen(glm::ivec2{x, y} + glm::ivec2{1, 1});
+    for (const auto&[v, cost] : overlay_)
+      if (visible(v))
+        quads_.add(self().worldToScreen(v), self().worldToScreen(v + glm::ivec2{1, 1}),
+          al_map_rgba(255, 0, 0, cost == dungeon::ObstacleOverlay::BLOCKED ? 96 : 32));
 
-        auto bmp = bitmapFor(dungeon_.view(y, x));
-        al_draw_scaled_bitmap(
-          bmp,
-          0, 0, al_get_bitmap_width(bmp), al_get_bitmap_height(bmp),
-          min.x, min.y, max.x - min.x, max.y - min.y, ALLEGRO_FLIP_VERTICAL);
+    for (auto v : searchResult_.path)
+      if (visible(v))
+        quads_.add(self().worldToScreen(v), self().worldToScreen(v + glm::ivec2{1, 1}), al_map_rgba(0, 255, 0, 32));
 
-        if (x < searchResult_.dists.extent(0) && y < searchResult_.dists.extent(1) && searchResult_.dists(y, x) != dungeon::INF)
-        {
-          al_draw_filled_rectangle(min.x, min.y, max.x, max.y, al_map_rgba(255, 255, 0, 32));
-          if (additionalDebugInfo_)
-            al_draw_text(self().getFont(), al_map_rgba(255, 255, 225, 255), min.x, min.y, {},
-              fmt::format("{}", searchResult_.dists(y, x)).c_str());
-        }
-      }
+    quads_.draw();
 
-    for (auto v : searchResult_.path)
+    // Unreadable anyway once tiles get small
+    if (additionalDebugInfo_ && tilePixels >= 24 && viewMax.y <= dists.extent(0) && viewMax.x <= dists.extent(1))
     {
-      auto min = self().worldToScreen(v);
-      auto max = self().worldToScreen(v + glm::ivec2{1, 1});
+      for (int y = viewMin.y; y < viewMax.y; ++y)
+        for (int x = viewMin.x; x < viewMax.x; ++x)
+          if (dists(y, x) != dungeon::INF)
+          {
+            const auto pos = self().worldToScreen({x, y});
+            al_draw_text(self().getFont(), al_map_rgba(255, 255, 225, 255), pos.x, pos.y, {},
+              fmt::format("{}", dists(y, x)).c_str());
+          }
+    }
 
-      al_draw_filled_rectangle(min.x, min.y, max.x, max.y, al_map_rgba(0, 255, 0, 32));
+    for (std::size_t i = 1; i < smoothedPath_.size(); ++i)
+    {
+      auto from = self().worldToScreen(glm::vec2{smoothedPath_[i - 1]} + 0.5f);
+      auto to = self().worldToScreen(glm::vec2{smoothedPath_[i]} + 0.5f);
+      al_draw_line(from.x, from.y, to.x, to.y, al_map_rgba(0, 255, 255, 200), 3);
     }
 
     if (hierarchicalData_.cellSize > 0)
     {
-      for (int y = 0; y < dungeon_.view.extent(0) / hierarchicalData_.cellSize; ++y)
+      const auto cellSize = hierarchicalData_.cellSize;
+      const auto cellsMin = viewMin / cellSize;
+      const auto cellsMax = glm::min((viewMax + cellSize - 1) / cellSize,
+        glm::ivec2{dungeon_.view.extent(1), dungeon_.view.extent(0)} / cellSize);
+      for (int y = cellsMin.y; y < cellsMax.y; ++y)
       {
-        for (int x = 0; x < dungeon_.view.extent(1) / hierarchicalData_.cellSize; ++x)
+        for (int x = cellsMin.x; x < cellsMax.x; ++x)
         {
-          const auto cellStart = glm::ivec2{x, y} * hierarchicalData_.cellSize;
+          const auto cellStart = glm::ivec2{x, y} * cellSize;
           auto min = self().worldToScreen(cellStart);
-          auto max = self().worldToScreen(cellStart + hierarchicalData_.cellSize);
+          auto max = self().worldToScreen(cellStart + cellSize);
 
           al_draw_rectangle(min.x, min.y, max.x, max.y, al_map_rgba(255, 255, 255, 100), 2);
 
           if (additionalDebugInfo_)
           {
-            const auto cellMid = self().worldToScreen(glm::vec2{cellStart} + hierarchicalData_.cellSize / 2.f);
+            const auto cellMid = self().worldToScreen(glm::vec2{cellStart} + cellSize / 2.f);
 
-            auto[b, e] = hierarchicalData_.cellToPortalList.equal_range(glm::ivec2{x, y});
-            while (b != e)
+            for (auto portal : hierarchicalData_.portalsOfCell(glm::ivec2{x, y}))
             {
-              const auto pPos = self().worldToScreen(hierarchicalData_.portals[b->second].midpoint());
+              const auto pPos = self().worldToScreen(hierarchicalData_.portals[portal].midpoint());
               al_draw_line(cellMid.x, cellMid.y, pPos.x, pPos.y, al_map_rgba(255, 0, 0, 200), 3);
-              ++b;
             }
           }
         }
@@ -187,6 +328,9 @@ class Game
 
     for (const auto& p : hierarchicalData_.portals)
     {
+      if (glm::any(glm::lessThanEqual(p.bottomRight, viewMin)) || glm::any(glm::greaterThanEqual(p.topLeft, viewMax)))
+        continue;
+
       auto min = self().worldToScreen(p.topLeft);
       auto max = self().worldToScreen(p.bottomRight);
 
@@ -194,10 +338,10 @@ class Game
 
       if (p.contains(self().screenToWorld(mousePosition_)))
       {
-        for (const auto&[q, adj] : p.adjacent)
+        for (const auto& adj : hierarchicalData_.edgesOf(p))
         {
           auto pPos = self().worldToScreen(p.midpoint());
-          auto qPos = self().worldToScreen(hierarchicalData_.portals[q].midpoint());
+          auto qPos = self().worldToScreen(hierarchicalData_.portals[adj.to].midpoint());
           al_draw_line(pPos.x, pPos.y, qPos.x, qPos.y, al_map_rgba(255, 0, 0, 200), 3);
           auto tPos = (pPos + qPos) / 2.f;
           al_draw_text(self().getFont(), al_map_rgba(0, 0, 0, 255), tPos.x, tPos.y, {}, std::to_string(adj.dist).c_str());
@@ -207,20 +351,113 @@ class Game
   }
 
  private:
+  enum class SearchMode
+  {
+    Hierarchical,
+    Anytime,
+    Incremental,
+  };
+
+  // Only ever touched by searches on the worker thread
+  struct IncrementalState
+  {
+    // What the planner currently sees
+    dungeon::ObstacleOverlay overlay;
+    std::optional<dungeon::DStarLite> planner;
+  };
+
   Derived& self() { return *static_cast<Derived*>(this); }
   const Derived& self() const { return *static_cast<const Derived*>(this); }
 
+  // Tiles [min, max) that are at least partially on screen
+  std::pair<glm::ivec2, glm::ivec2> visibleTiles()
+  {
+    const auto a = self().screenToWorld({0, 0});
+    const auto b = self().screenToWorld({Derived::kWidth, Derived::kHeight});
+    const glm::ivec2 extent{dungeon_.view.extent(1), dungeon_.view.extent(0)};
+    return {
+      glm::clamp(glm::ivec2(glm::floor(glm::min(a, b))), glm::ivec2{0}, extent),
+      glm::clamp(glm::ivec2(glm::ceil(glm::max(a, b))), glm::ivec2{0}, extent),
+    };
+  }
+
+  // Anytime solutions replace each other as they arrive, the frame never waits for them
+  void receiveSearchResults()
+  {
+    auto update = searchWorker_.take();
+    if (!update)
+      return;
+    searchResult_ = std::move(update->result);
+    searchStats_ = update->stats;
+    updateSmoothedPath();
+  }
+
+  void updateSmoothedPath()
+  {
+    smoothedPath_ = smoothPath_ ? dungeon::smoothPath(dungeon_.view, searchResult_.path, &overlay_) : std::vector<glm::ivec2>{};
+  }
+
+  // Brings the planner up to date with the query, then repairs its tree
+  static dungeon::SlicedSearch incrementalSearch(dungeon::DungeonView dungeon, std::shared_ptr<IncrementalState> state,
+    glm::ivec2 start, glm::ivec2 goal, dungeon::ObstacleOverlay overlay, dungeon::ExpansionBudget& budget, dungeon::SearchStats* stats)
+  {
+    // Diffed rather than recorded: requests replaced before they ran never saw their changes
+    std::vector<glm::ivec2> changed;
+    for (const auto&[v, cost] : overlay)
+      if (state->overlay.extraCost(v) != cost)
+        changed.push_back(v);
+    for (const auto&[v, cost] : state->overlay)
+      if (overlay.extraCost(v) != cost)
+        changed.push_back(v);
+    state->overlay = std::move(overlay);
+
+    // Keeps its tree while only the start moves or blockers change
+    auto& planner = state->planner;
+    if (!planner || planner->goal() != goal)
+    {
+      planner.emplace(dungeon, start, goal, &state->overlay);
+    }
+    else
+    {
+      for (auto v : changed)
+        planner->tileChanged(v);
+      if (planner->start() != start)
+        planner->moveStart(start);
+    }
+
+    for (auto&& slice : planner->replanSliced(budget, stats))
+      co_yield std::move(slice);
+  }
+
  private:
   glm::vec2 mousePosition_{};
   bool dragging_{false};
 
   bool additionalDebugInfo_;
+  bool smoothPath_{false};
+  SearchMode searchMode_{SearchMode::Hierarchical};
 
   glm::ivec2 searchStart_;
   glm::ivec2 searchEnd_;
 
   dungeon::HierarchicalSearchData hierarchicalData_;
+  dungeon::SearchStats buildStats_;
+  dungeon::SearchStats searchStats_;
+  dungeon::ObstacleOverlay overlay_;
+  std::shared_ptr<IncrementalState> incremental_;
+  std::optional<dungeon::QueryRecorder> recorder_;
   dungeon::SearchResult searchResult_;
+  std::vector<glm::ivec2> smoothedPath_;
+
+  // Has to be baked again whenever dungeon_ changes
+  TileLayer tileLayer_;
+  bool tilesReady_{false};
+  QuadBatch quads_;
 
   dungeon::Dungeon dungeon_;
+  // Backs dungeon_.view when the map came from a hierarchy file
+  std::shared_ptr<const void> mapStorage_;
+
+  // Last, its searches read the members above until it is destroyed
+  dungeon::SearchWorker searchWorker_;
 };
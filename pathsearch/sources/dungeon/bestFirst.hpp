@@ -0,0 +1,386 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "grid.hpp"
+#include "overlay.hpp"
+#include "pathsearch.hpp"
+#include "searchStats.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+
+namespace dungeon
+{
+
+// The one best-first search loop behind aStar, araStar, the portal search and the cell
+// re-planning of hierarchicalSearch, see bestFirst() at the bottom.
+// Graph, neighbourhood, cost type, heuristic and open list are compile-time policies,
+// so every variant gets its weight() and heuristic calls inlined.
+
+
+// Neighbourhoods, in the order successors are visited
+
+struct FourConnected
+{
+  static constexpr std::array OFFSETS{glm::ivec2{0, 1}, glm::ivec2{0, -1}, glm::ivec2{1, 0}, glm::ivec2{-1, 0}};
+};
+
+// Diagonal steps may not cut a wall corner
+struct EightConnected
+{
+  static constexpr std::array OFFSETS{
+    glm::ivec2{0, 1}, glm::ivec2{0, -1}, glm::ivec2{1, 0}, glm::ivec2{-1, 0},
+    glm::ivec2{1, 1}, glm::ivec2{1, -1}, glm::ivec2{-1, 1}, glm::ivec2{-1, -1}};
+};
+
+
+// Cost types. Value is what the search adds up and compares, UNREACHED plus any edge still fits it.
+
+struct FloatCost
+{
+  using Value = float;
+  static constexpr Value UNREACHED = INF;
+
+  static Value from(float cost) { return cost; }
+  static Value lowerBound(float cost) { return cost; }
+  static float toFloat(Value cost) { return cost; }
+};
+
+// Steps of 1/Scale. Integer sums do not depend on the order they were added in,
+// so equal paths tie exactly. Paths may cost up to about 4M with the default scale.
+template<int Scale = 256>
+struct FixedCost
+{
+  using Value = std::int32_t;
+  static constexpr Value UNREACHED = std::numeric_limits<Value>::max() / 2;
+
+  static Value from(float cost) { return cost >= INF ? UNREACHED : static_cast<Value>(cost * Scale + 0.5f); }
+  // Rounded down, heuristics stay admissible
+  static Value lowerBound(float cost) { return cost >= INF ? UNREACHED : static_cast<Value>(cost * Scale); }
+  static float toFloat(Value cost) { return cost >= UNREACHED ? INF : static_cast<float>(cost) / Scale; }
+};
+
+
+// Heuristics
+
+template<class Cost>
+struct EuclideanHeuristic
+{
+  glm::ivec2 finish;
+  float eps{1};
+
+  typename Cost::Value operator()(glm::ivec2 v) const { return Cost::lowerBound(eps * ivecDist(v, finish)); }
+};
+
+// Plain Dijkstra
+template<class Cost>
+struct ZeroHeuristic
+{
+  typename Cost::Value operator()(const auto&) const { return 0; }
+};
+
+
+// Open lists. Entries are never updated in place, the search skips stale ones when they are popped.
+
+// Min-heap with Arity children per node: shallower than a binary heap, and the children share cache lines
+template<class Priority, class Node, int Arity>
+class DaryHeap
+{
+ public:
+  struct Entry
+  {
+    Priority priority;
+    Node node;
+  };
+
+  explicit DaryHeap(std::pmr::memory_resource* memory = std::pmr::get_default_resource()) : entries_{memory} {}
+
+  bool empty() const { return entries_.empty(); }
+  std::size_t size() const { return entries_.size(); }
+  const Entry& top() const { return entries_.front(); }
+
+  void reserve(std::size_t size) { entries_.reserve(size); }
+  void clear() { entries_.clear(); }
+
+  void push(Priority priority, Node node)
+  {
+    entries_.push_back(Entry{priority, node});
+    for (auto i = entries_.size() - 1; i > 0;)
+    {
+      const auto parent = (i - 1) / Arity;
+      if (!(entries_[i].priority < entries_[parent].priority))
+        break;
+      std::swap(entries_[i], entries_[parent]);
+      i = parent;
+    }
+  }
+
+  Entry pop()
+  {
+    auto result = entries_.front();
+    entries_.front() = entries_.back();
+    entries_.pop_back();
+
+    for (std::size_t i = 0;;)
+    {
+      const auto first = i * Arity + 1;
+      if (first >= entries_.size())
+        break;
+      auto best = first;
+      for (auto child = first + 1; child < std::min(first + Arity, entries_.size()); ++child)
+        if (entries_[child].priority < entries_[best].priority)
+          best = child;
+      if (!(entries_[best].priority < entries_[i].priority))
+        break;
+      std::swap(entries_[i], entries_[best]);
+      i = best;
+    }
+    return result;
+  }
+
+ private:
+  std::pmr::vector<Entry> entries_;
+};
+
+template<class Priority, class Node>
+using BinaryHeap = DaryHeap<Priority, Node, 2>;
+
+template<class Priority, class Node>
+using QuaternaryHeap = DaryHeap<Priority, Node, 4>;
+
+
+// Distance stores
+
+// Map-sized, for SearchOutput::Full, doubles as the debug distance field.
+// Handed out as Dists, so it always lives on the heap.
+template<class Layout>
+class DenseDists
+{
+ public:
+  template<class View>
+  explicit DenseDists(View dungeon, std::pmr::memory_resource* = nullptr)
+    : dists_{DungeonExtents{dungeon.extent(0), dungeon.extent(1)}, INF}
+  {
+  }
+
+  float get(glm::ivec2 v) const { return dists_(v.y, v.x); }
+  void set(glm::ivec2 v, float dist) { dists_(v.y, v.x) = dist; }
+
+  Dists toDists() const
+  {
+    if constexpr (std::is_same_v<Layout, std::experimental::layout_right>)
+      return dists_;
+    else
+      return relayout<std::experimental::layout_right>(dists_.to_mdspan());
+  }
+
+ private:
+  BasicDists<Layout> dists_;
+};
+
+// Only remembers the visited tiles, so memory scales with the search instead of the map
+template<class Cost = FloatCost>
+class SparseDists
+{
+ public:
+  template<class View>
+  explicit SparseDists(View, std::pmr::memory_resource* memory = std::pmr::get_default_resource()) : dists_{memory} {}
+
+  typename Cost::Value get(glm::ivec2 v) const
+  {
+    auto it = dists_.find(v);
+    return it == dists_.end() ? Cost::UNREACHED : it->second;
+  }
+  void set(glm::ivec2 v, typename Cost::Value dist) { dists_.insert_or_assign(v, dist); }
+
+  Dists toDists() const { return {}; }
+
+ private:
+  std::pmr::unordered_map<glm::ivec2, typename Cost::Value> dists_;
+};
+
+// Nodes that are indices, e.g. portals
+template<class Cost = FloatCost>
+class IndexedDists
+{
+ public:
+  explicit IndexedDists(std::size_t size, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+    : dists_(size, Cost::UNREACHED, memory) {}
+
+  typename Cost::Value get(std::size_t v) const { return dists_[v]; }
+  void set(std::size_t v, typename Cost::Value dist) { dists_[v] = dist; }
+
+ private:
+  std::pmr::vector<typename Cost::Value> dists_;
+};
+
+
+// Graphs call f(successor, cost, edge...) for every neighbour, the edge is passed on to the hooks
+
+// Tiles of a map, optionally confined to a rectangle
+template<class View, class Neighbourhood, class Cost>
+class GridGraph
+{
+ public:
+  using Node = glm::ivec2;
+
+  GridGraph(View dungeon, const ObstacleOverlay* overlay)
+    : GridGraph{dungeon, overlay, glm::ivec2{0, 0}, glm::ivec2{std::numeric_limits<int>::max()}}
+  {
+  }
+
+  // Tiles outside [min, max) do not exist
+  GridGraph(View dungeon, const ObstacleOverlay* overlay, glm::ivec2 min, glm::ivec2 max)
+    : dungeon_{dungeon}
+    , overlay_{overlay}
+    , min_{glm::max(min, glm::ivec2{0, 0})}
+    , max_{glm::min(max, glm::ivec2{static_cast<int>(dungeon.extent(1)), static_cast<int>(dungeon.extent(0))})}
+  {
+  }
+
+  bool passable(glm::ivec2 v) const
+  {
+    return v.x >= min_.x && v.y >= min_.y && v.x < max_.x && v.y < max_.y
+      && dungeon_(v.y, v.x) != Tile::Wall && (overlay_ == nullptr || !overlay_->blocked(v));
+  }
+
+  template<class F>
+  void forEachSuccessor(glm::ivec2 v, F&& f) const
+  {
+    for (auto offset : Neighbourhood::OFFSETS)
+    {
+      const auto successor = v + offset;
+      if (!passable(successor))
+        continue;
+      if (offset.x != 0 && offset.y != 0
+        && (!passable(glm::ivec2{v.x + offset.x, v.y}) || !passable(glm::ivec2{v.x, v.y + offset.y})))
+        continue;
+      f(successor, Cost::from(weight(dungeon_, v, successor, overlay_)));
+    }
+  }
+
+ private:
+  View dungeon_;
+  const ObstacleOverlay* overlay_;
+  glm::ivec2 min_;
+  glm::ivec2 max_;
+};
+
+
+// What a search does differently, derive and hide the hooks that need to change
+template<class Node, class CostValue>
+struct SearchHooks
+{
+  // Checked before expanding the best open node, e.g. whether it is the finish
+  bool done(CostValue, const Node&) const { return false; }
+  void expanded(const Node&) {}
+  // A cheaper way to `to` was found, along the given edge for graphs that pass one
+  template<class... Edge>
+  void relaxed(const Node&, const Node&, const Edge&...) {}
+  // Whether an improved node goes (back) on the open list
+  bool reopen(const Node&) { return true; }
+};
+
+// Plain A*, stops once the finish is the best open node
+template<class CostValue>
+struct StopAtFinish : SearchHooks<glm::ivec2, CostValue>
+{
+  glm::ivec2 finish;
+
+  bool done(CostValue, glm::ivec2 top) const { return top == finish; }
+};
+
+// Expands the best open node until hooks.done() holds for it, the open list runs dry
+// or the budget is spent. Returns false only in the last case, calling it again resumes the search.
+template<class Graph, class Heuristic, class Open, class DistStore, class Hooks>
+bool bestFirst(const Graph& graph, const Heuristic& heuristic, Open& open, DistStore& dists, Hooks& hooks,
+  ExpansionBudget& budget, SearchStats* stats)
+{
+  while (!open.empty())
+  {
+    if (hooks.done(open.top().priority, open.top().node))
+      return true;
+    if (budget.remaining == 0)
+      return false;
+
+    const auto entry = open.pop();
+    const auto priority = entry.priority;
+    const auto current = entry.node;
+    count(stats, Counter::Pops);
+
+    const auto dist = dists.get(current);
+
+    // A cheaper entry for this node has been pushed since, nothing can improve
+    if (priority > dist + heuristic(current))
+    {
+      count(stats, Counter::StalePops);
+      continue;
+    }
+    count(stats, Counter::Expanded);
+    --budget.remaining;
+    hooks.expanded(current);
+
+    graph.forEachSuccessor(current, [&](const auto& successor, auto cost, const auto&... edge)
+      {
+        const auto successorDist = dist + cost;
+        const auto oldDist = dists.get(successor);
+        if (!(successorDist < oldDist))
+          return;
+
+        dists.set(successor, successorDist);
+        hooks.relaxed(current, successor, edge...);
+        if (!hooks.reopen(successor))
+          return;
+
+        const auto successorH = heuristic(successor);
+        // The old entry was ordered before the current one, hence it was popped already
+        if constexpr (STATS_ENABLED)
+          if (oldDist + successorH < priority)
+            count(stats, Counter::Reopened);
+
+        open.push(successorDist + successorH, successor);
+        count(stats, Counter::Pushes);
+      });
+  }
+  return true;
+}
+
+
+// Cost of the cheapest way only. For the neighbourhoods and cost types aStar does not
+// offer, CompressedPath can't hold the diagonal steps of EightConnected anyway.
+template<class Neighbourhood = FourConnected, class Cost = FloatCost, template<class, class> class Open = QuaternaryHeap, class View>
+float gridDistance(View dungeon, glm::ivec2 start, glm::ivec2 finish, float eps = 1,
+  const ObstacleOverlay* overlay = nullptr, SearchStats* stats = nullptr)
+{
+  using Value = typename Cost::Value;
+
+  const GridGraph<View, Neighbourhood, Cost> graph{dungeon, overlay};
+  if (!graph.passable(start))
+    return INF;
+
+  const EuclideanHeuristic<Cost> heuristic{finish, eps};
+  Open<Value, glm::ivec2> open;
+  SparseDists<Cost> dists{dungeon};
+
+  StopAtFinish<Value> hooks{{}, finish};
+
+  open.push(heuristic(start), start);
+  dists.set(start, 0);
+  count(stats, Counter::Pushes);
+
+  ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+  bestFirst(graph, heuristic, open, dists, hooks, unlimited, stats);
+  return Cost::toFloat(dists.get(finish));
+}
+
+}
@@ -0,0 +1,245 @@
+#include "components.hpp"
+#include "grid.hpp"
+#include "assert.hpp"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <thread>
+
+
+namespace dungeon
+{
+
+// Splits the rows into horizontal stripes and runs fn(yBegin, yEnd, stripe) for every one of them concurrently
+template<class F>
+static void forEachStripe(int height, int stripes, F&& fn)
+{
+  std::vector<std::jthread> workers;
+  workers.reserve(stripes);
+  for (int i = 0; i < stripes; ++i)
+    workers.emplace_back([&fn, i, height, stripes]()
+      {
+        fn(height * i / stripes, height * (i + 1) / stripes, i);
+      });
+}
+
+static std::uint32_t findRoot(const std::vector<std::uint32_t>& parent, std::uint32_t i)
+{
+  while (parent[i] != i)
+    i = parent[i];
+  return i;
+}
+
+// Roots always end up being the smallest index of their set.
+// This allows the stripes to be processed independently
+static void unite(std::vector<std::uint32_t>& parent, std::uint32_t a, std::uint32_t b)
+{
+  auto halve = [&parent](std::uint32_t i)
+    {
+      while (parent[i] != i)
+      {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+      }
+      return i;
+    };
+
+  a = halve(a);
+  b = halve(b);
+  if (a != b)
+    parent[std::max(a, b)] = std::min(a, b);
+}
+
+Components buildComponents(DungeonView dungeon)
+{
+  const int width = dungeon.extent(1);
+  const int height = dungeon.extent(0);
+
+  Components result{.width = width, .height = height};
+
+  const auto size = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+  std::vector<std::uint32_t> parent(size, Components::NONE);
+  std::vector<std::uint32_t> labels(size, Components::NONE);
+
+  const int stripes = std::clamp(height / 64, 1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+
+  auto idx = [width](int y, int x) { return static_cast<std::uint32_t>(y * width + x); };
+
+  // Independent union-find inside of every stripe
+  forEachStripe(height, stripes, [&](int yBegin, int yEnd, int)
+    {
+      for (int y = yBegin; y < yEnd; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+          if (dungeon(y, x) == Tile::Wall)
+            continue;
+          parent[idx(y, x)] = idx(y, x);
+          if (x > 0 && dungeon(y, x - 1) != Tile::Wall)
+            unite(parent, idx(y, x - 1), idx(y, x));
+          if (y > yBegin && dungeon(y - 1, x) != Tile::Wall)
+            unite(parent, idx(y - 1, x), idx(y, x));
+        }
+    });
+
+  // Stitch the stripes together
+  for (int i = 1; i < stripes; ++i)
+  {
+    const int y = height * i / stripes;
+    for (int x = 0; x < width; ++x)
+      if (dungeon(y, x) != Tile::Wall && dungeon(y - 1, x) != Tile::Wall)
+        unite(parent, idx(y - 1, x), idx(y, x));
+  }
+
+  // Give roots compact ids, prefix sums over per-stripe root counts keep them deterministic
+  std::vector<std::uint32_t> rootCounts(stripes + 1, 0);
+  forEachStripe(height, stripes, [&](int yBegin, int yEnd, int stripe)
+    {
+      for (auto i = idx(yBegin, 0); i < idx(yEnd, 0); ++i)
+        if (parent[i] == i)
+          ++rootCounts[stripe + 1];
+    });
+  std::partial_sum(rootCounts.begin(), rootCounts.end(), rootCounts.begin());
+
+  forEachStripe(height, stripes, [&](int yBegin, int yEnd, int stripe)
+    {
+      auto next = rootCounts[stripe];
+      for (auto i = idx(yBegin, 0); i < idx(yEnd, 0); ++i)
+        if (parent[i] == i)
+          labels[i] = next++;
+    });
+
+  // Roots precede their members, but may live in another stripe, hence the separate pass
+  forEachStripe(height, stripes, [&](int yBegin, int yEnd, int)
+    {
+      for (auto i = idx(yBegin, 0); i < idx(yEnd, 0); ++i)
+        if (parent[i] != Components::NONE && parent[i] != i)
+          labels[i] = labels[findRoot(parent, i)];
+    });
+
+  result.labels = SharedArray{std::move(labels)};
+  result.labelParent.resize(rootCounts.back());
+  std::iota(result.labelParent.begin(), result.labelParent.end(), 0u);
+
+  return result;
+}
+
+std::uint32_t Components::componentOf(glm::ivec2 v) const
+{
+  if (v.x < 0 || v.y < 0 || v.x >= width || v.y >= height)
+    return NONE;
+  const auto label = labels[static_cast<std::size_t>(v.y) * width + v.x];
+  return label == NONE ? NONE : labelParent[label];
+}
+
+bool connected(const Components& components, glm::ivec2 a, glm::ivec2 b)
+{
+  const auto ca = components.componentOf(a);
+  return ca != Components::NONE && ca == components.componentOf(b);
+}
+
+// labelParent always points straight to the root, so merging is linear in the amount of labels,
+// which is tiny compared to the map
+static void mergeLabels(Components& components, std::uint32_t a, std::uint32_t b)
+{
+  const auto ra = components.labelParent[a];
+  const auto rb = components.labelParent[b];
+  if (ra == rb)
+    return;
+  const auto root = std::min(ra, rb);
+  const auto other = std::max(ra, rb);
+  for (auto& p : components.labelParent)
+    if (p == other)
+      p = root;
+}
+
+// Removing a tile can only split its region if its open 4-neighbours
+// are not connected to each other by the ring of 8 tiles around it
+static bool mightSplit(DungeonView dungeon, glm::ivec2 pos)
+{
+  constexpr std::array RING{
+    glm::ivec2{0, -1}, glm::ivec2{1, -1}, glm::ivec2{1, 0}, glm::ivec2{1, 1},
+    glm::ivec2{0, 1}, glm::ivec2{-1, 1}, glm::ivec2{-1, 0}, glm::ivec2{-1, -1}};
+
+  // Start the walk right after a closed tile so that runs don't wrap around
+  std::size_t first = RING.size();
+  for (std::size_t i = 0; i < RING.size(); ++i)
+    if (!isPassable(dungeon, pos + RING[i]))
+    {
+      first = i + 1;
+      break;
+    }
+
+  if (first == RING.size())
+    return false;
+
+  int runsWithNeighbours = 0;
+  bool inRun = false;
+  bool runHasNeighbour = false;
+  for (std::size_t k = 0; k <= RING.size(); ++k)
+  {
+    const auto i = (first + k) % RING.size();
+    const bool open = k < RING.size() && isPassable(dungeon, pos + RING[i]);
+    if (open)
+    {
+      inRun = true;
+      // Even ring positions are the 4-neighbours
+      runHasNeighbour = runHasNeighbour || i % 2 == 0;
+    }
+    else if (inRun)
+    {
+      runsWithNeighbours += runHasNeighbour ? 1 : 0;
+      inRun = false;
+      runHasNeighbour = false;
+    }
+  }
+
+  return runsWithNeighbours > 1;
+}
+
+void updateComponents(Components& components, DungeonView dungeon, glm::ivec2 pos)
+{
+  NG_ASSERT(components.width == dungeon.extent(1) && components.height == dungeon.extent(0));
+
+  const auto index = static_cast<std::size_t>(pos.y) * components.width + pos.x;
+  auto label = components.labels[index];
+  const bool open = dungeon(pos.y, pos.x) != Tile::Wall;
+
+  if (open == (label != Components::NONE))
+    return;
+
+  if (open)
+  {
+    for (auto offset : std::array{
+      glm::ivec2{0, 1}, glm::ivec2{0, -1}, glm::ivec2{1, 0}, glm::ivec2{-1, 0}})
+    {
+      const auto other = components.componentOf(pos + offset);
+      if (other == Components::NONE)
+        continue;
+      if (label == Components::NONE)
+        label = other;
+      else
+        mergeLabels(components, label, other);
+    }
+
+    if (label == Components::NONE)
+    {
+      label = static_cast<std::uint32_t>(components.labelParent.size());
+      components.labelParent.push_back(label);
+    }
+  }
+  else
+  {
+    label = Components::NONE;
+    if (mightSplit(dungeon, pos))
+    {
+      components = buildComponents(dungeon);
+      return;
+    }
+  }
+
+  // Labels loaded from a file are copied on the first edit
+  components.labels.modify([&](auto& labels) { labels[index] = label; });
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "sharedArray.hpp"
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// Labels 4-connected regions of walkable tiles, so that queries between
+// different regions can be rejected without running a search.
+// Every tile stores a label, labels are merged through a tiny union-find
+// when a wall is dug out, so lookups stay O(1) between rebuilds.
+struct Components
+{
+  static constexpr std::uint32_t NONE = static_cast<std::uint32_t>(-1);
+
+  int width{0};
+  int height{0};
+  // May point into a mapped hierarchy file, see serialization.hpp
+  SharedArray<std::uint32_t> labels;
+  // Union-find over labels, not over tiles
+  std::vector<std::uint32_t> labelParent;
+
+  std::uint32_t componentOf(glm::ivec2 v) const;
+};
+
+Components buildComponents(DungeonView dungeon);
+
+// Must be called after dungeon(pos) has been changed.
+// Digging only merges labels, placing a wall triggers a rebuild only if it might split a region.
+void updateComponents(Components& components, DungeonView dungeon, glm::ivec2 pos);
+
+bool connected(const Components& components, glm::ivec2 a, glm::ivec2 b);
+
+}
@@ -0,0 +1,54 @@
+#include "compressedPath.hpp"
+#include "assert.hpp"
+
+#include <algorithm>
+
+
+namespace dungeon
+{
+
+void CompressedPath::push_back(glm::ivec2 v)
+{
+  if (size_ == 0)
+  {
+    front_ = back_ = v;
+    size_ = 1;
+    return;
+  }
+
+  if (v == back_)
+    return;
+
+  const glm::ivec2 delta = v - back_;
+  const auto dir = static_cast<std::uint8_t>(std::find(std::begin(steps::OFFSETS), std::end(steps::OFFSETS), delta) - std::begin(steps::OFFSETS));
+  // Checked in release too, a bad step would be stored as a run that decodes to other tiles
+  NG_VERIFYF(dir < 4, "Compressed paths must be 4-connected");
+
+  if (!runs_.empty() && (runs_.back() & steps::DIR_MASK) == dir && steps::length(runs_.back()) < steps::MAX_RUN)
+    runs_.back() = steps::encode(dir, steps::length(runs_.back()) + 1);
+  else
+    runs_.push_back(steps::encode(dir, 1));
+
+  back_ = v;
+  ++size_;
+}
+
+CompressedPath CompressedPath::reversed() const
+{
+  CompressedPath result{runs_.get_allocator().resource()};
+  result.front_ = back_;
+  result.back_ = front_;
+  result.size_ = size_;
+  result.runs_.reserve(runs_.size());
+  std::transform(runs_.rbegin(), runs_.rend(), std::back_inserter(result.runs_),
+    [](std::uint8_t run) { return static_cast<std::uint8_t>(run ^ 2); });
+  return result;
+}
+
+void CompressedPath::clear()
+{
+  size_ = 0;
+  runs_.clear();
+}
+
+}
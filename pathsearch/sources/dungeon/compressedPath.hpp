@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// A 4-connected path stored as its first tile plus run-length encoded steps.
+// Every byte holds a direction in the low 2 bits and (run length - 1) in the upper 6,
+// so straight corridors of up to 64 tiles cost a single byte instead of 8 per tile.
+namespace steps
+{
+
+constexpr std::uint8_t DIR_BITS = 2;
+constexpr std::uint8_t DIR_MASK = (1 << DIR_BITS) - 1;
+constexpr int MAX_RUN = 1 << (8 - DIR_BITS);
+
+// Right, down, left, up: opposite directions differ in the second bit
+constexpr glm::ivec2 OFFSETS[4]{{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+
+constexpr glm::ivec2 offset(std::uint8_t run) { return OFFSETS[run & DIR_MASK]; }
+constexpr int length(std::uint8_t run) { return (run >> DIR_BITS) + 1; }
+constexpr std::uint8_t encode(std::uint8_t dir, int length) { return static_cast<std::uint8_t>(((length - 1) << DIR_BITS) | dir); }
+
+}
+
+class CompressedPathIterator
+{
+ public:
+  using iterator_concept = std::forward_iterator_tag;
+  using iterator_category = std::input_iterator_tag;
+  using value_type = glm::ivec2;
+  using difference_type = std::ptrdiff_t;
+  using reference = glm::ivec2;
+  using pointer = void;
+
+  CompressedPathIterator() = default;
+  CompressedPathIterator(std::span<const std::uint8_t> runs, glm::ivec2 pos, std::size_t index)
+    : run_{runs.data()}, runsEnd_{runs.data() + runs.size()}, pos_{pos}, index_{index} {}
+
+  glm::ivec2 operator*() const { return pos_; }
+
+  CompressedPathIterator& operator++()
+  {
+    ++index_;
+    // Stepping past the last tile
+    if (run_ == runsEnd_)
+      return *this;
+
+    pos_ += steps::offset(*run_);
+    if (++taken_ == steps::length(*run_))
+    {
+      ++run_;
+      taken_ = 0;
+    }
+    return *this;
+  }
+
+  CompressedPathIterator operator++(int) { auto copy = *this; ++*this; return copy; }
+
+  friend bool operator==(const CompressedPathIterator& a, const CompressedPathIterator& b) { return a.index_ == b.index_; }
+
+ private:
+  const std::uint8_t* run_{nullptr};
+  const std::uint8_t* runsEnd_{nullptr};
+  int taken_{0};
+  glm::ivec2 pos_{};
+  std::size_t index_{0};
+};
+
+// Non-owning, used for paths that live in a shared pool
+struct CompressedPathView
+{
+  using iterator = CompressedPathIterator;
+  using const_iterator = CompressedPathIterator;
+  using value_type = glm::ivec2;
+
+  glm::ivec2 first{};
+  glm::ivec2 last{};
+  std::size_t count{0};
+  std::span<const std::uint8_t> runs;
+
+  CompressedPathIterator begin() const { return {runs, first, 0}; }
+  CompressedPathIterator end() const { return {{}, last, count}; }
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  glm::ivec2 front() const { return first; }
+  glm::ivec2 back() const { return last; }
+};
+
+class CompressedPath
+{
+ public:
+  using iterator = CompressedPathIterator;
+  using const_iterator = CompressedPathIterator;
+  using value_type = glm::ivec2;
+
+  CompressedPath() = default;
+  // The runs live in memory, copies go back to the default resource
+  explicit CompressedPath(std::pmr::memory_resource* memory) : runs_{memory} {}
+
+  // Consecutive duplicates are dropped, anything else must be a 4-neighbour of back()
+  void push_back(glm::ivec2 v);
+
+  template<class It>
+  void append(It first, It last)
+  {
+    for (; first != last; ++first)
+      push_back(*first);
+  }
+
+  template<class Range>
+  void append(const Range& range) { append(std::begin(range), std::end(range)); }
+
+  // O(runs), handy for backtracking from the finish
+  CompressedPath reversed() const;
+
+  void clear();
+
+  CompressedPathView view() const { return {front_, back_, size_, runs_}; }
+  operator CompressedPathView() const { return view(); }
+
+  CompressedPathIterator begin() const { return view().begin(); }
+  CompressedPathIterator end() const { return view().end(); }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  glm::ivec2 front() const { return front_; }
+  glm::ivec2 back() const { return back_; }
+
+  const std::pmr::vector<std::uint8_t>& runs() const { return runs_; }
+  std::size_t memoryUsage() const { return sizeof(*this) + runs_.capacity(); }
+
+ private:
+  glm::ivec2 front_{};
+  glm::ivec2 back_{};
+  std::size_t size_{0};
+  std::pmr::vector<std::uint8_t> runs_;
+};
+
+}
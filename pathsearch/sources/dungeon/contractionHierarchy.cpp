@@ -0,0 +1,480 @@
+#include "contractionHierarchy.hpp"
+#include "dungeon/bestFirst.hpp"
+#include "dungeon/components.hpp"
+#include "dungeon/grid.hpp"
+#include "assert.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory_resource>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+struct Edge
+{
+  std::uint32_t to;
+  float cost;
+  std::uint32_t middle;
+};
+
+using Adjacency = std::vector<std::vector<Edge>>;
+
+enum class State : std::uint8_t
+{
+  Remaining,
+  // Being contracted this round
+  Selected,
+  Contracted,
+};
+
+struct Shortcut
+{
+  std::uint32_t a;
+  std::uint32_t b;
+  float cost;
+  std::uint32_t middle;
+};
+
+// Runs fn(i, worker) for every i < count on a pool of threads, indices are handed out in batches
+template<class F>
+void parallelFor(std::size_t count, unsigned threads, F&& fn)
+{
+  constexpr std::size_t BATCH = 64;
+
+  std::atomic<std::size_t> next{0};
+  std::vector<std::jthread> workers;
+  workers.reserve(threads);
+  for (unsigned worker = 0; worker < threads; ++worker)
+    workers.emplace_back([&fn, &next, count, worker]()
+      {
+        for (auto begin = next.fetch_add(BATCH); begin < count; begin = next.fetch_add(BATCH))
+          for (auto i = begin; i < std::min(begin + BATCH, count); ++i)
+            fn(i, worker);
+      });
+}
+
+// Node-sized, but only the touched entries are reset between searches
+class ScratchDists
+{
+ public:
+  explicit ScratchDists(std::size_t size) : dists_(size, INF) {}
+
+  float get(std::uint32_t v) const { return dists_[v]; }
+  void set(std::uint32_t v, float dist)
+  {
+    if (dists_[v] == INF)
+      touched_.push_back(v);
+    dists_[v] = dist;
+  }
+
+  void reset()
+  {
+    for (auto v : touched_)
+      dists_[v] = INF;
+    touched_.clear();
+  }
+
+ private:
+  std::vector<float> dists_;
+  std::vector<std::uint32_t> touched_;
+};
+
+// Remaining nodes only, minus the one being contracted
+struct WitnessGraph
+{
+  const Adjacency& adjacency;
+  const std::vector<State>& state;
+  std::uint32_t skip;
+
+  template<class F>
+  void forEachSuccessor(std::uint32_t v, F&& f) const
+  {
+    for (const auto& edge : adjacency[v])
+      if (edge.to != skip && state[edge.to] == State::Remaining)
+        f(edge.to, edge.cost);
+  }
+};
+
+struct WitnessHooks : SearchHooks<std::uint32_t, float>
+{
+  float limit;
+
+  bool done(float priority, std::uint32_t) const { return priority > limit; }
+};
+
+// Bounded Dijkstra between the neighbours of a node, one per thread.
+// Giving up early only costs a superfluous shortcut, never a wrong distance.
+class WitnessSearch
+{
+ public:
+  static constexpr std::size_t MAX_SETTLED = 256;
+
+  explicit WitnessSearch(std::size_t nodes) : dists_{nodes} {}
+
+  // The shortcuts that keep the distances between the neighbours of v once it is gone
+  void shortcutsOf(std::uint32_t v, const Adjacency& adjacency, const std::vector<State>& state, std::vector<Shortcut>& out)
+  {
+    const auto& edges = adjacency[v];
+    for (std::size_t i = 0; i + 1 < edges.size(); ++i)
+    {
+      const auto& from = edges[i];
+      float limit = 0;
+      for (auto j = i + 1; j < edges.size(); ++j)
+        limit = std::max(limit, from.cost + edges[j].cost);
+
+      dists_.reset();
+      open_.clear();
+      dists_.set(from.to, 0);
+      open_.push(0.f, from.to);
+
+      WitnessHooks hooks{{}, limit};
+      ExpansionBudget budget{MAX_SETTLED};
+      bestFirst(WitnessGraph{adjacency, state, v}, ZeroHeuristic<FloatCost>{}, open_, dists_, hooks, budget, nullptr);
+
+      for (auto j = i + 1; j < edges.size(); ++j)
+      {
+        const float via = from.cost + edges[j].cost;
+        if (dists_.get(edges[j].to) > via)
+          out.push_back({from.to, edges[j].to, via, v});
+      }
+    }
+  }
+
+ private:
+  ScratchDists dists_;
+  BinaryHeap<float, std::uint32_t> open_;
+};
+
+void addOrImprove(std::vector<Edge>& edges, std::uint32_t to, float cost, std::uint32_t middle)
+{
+  auto it = std::find_if(edges.begin(), edges.end(), [to](const Edge& e) { return e.to == to; });
+  if (it == edges.end())
+    edges.push_back({to, cost, middle});
+  else if (cost < it->cost)
+    *it = {to, cost, middle};
+}
+
+// Spreads equal priorities evenly over the map, ids alone would contract row by row
+std::uint32_t tieBreak(std::uint32_t v)
+{
+  return v * 2654435761u;
+}
+
+}
+
+std::size_t ContractionHierarchy::memoryBytes() const
+{
+  return nodeOf.size() * sizeof(std::uint32_t) + tileOf.size() * sizeof(glm::ivec2)
+    + firstArc.size() * sizeof(std::uint32_t) + arcs.size() * sizeof(Arc);
+}
+
+ContractionHierarchy buildContractionHierarchy(DungeonView dungeon, unsigned threads, SearchStats* stats)
+{
+  PhaseTimer timer{stats, Phase::Total};
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  ContractionHierarchy result{.width = dungeon.extent(1), .height = dungeon.extent(0)};
+  result.nodeOf.assign(static_cast<std::size_t>(result.width) * result.height, ContractionHierarchy::NONE);
+
+  // Build-time ids are in row-major order, renumbered by rank at the end
+  std::vector<glm::ivec2> tiles;
+  for (int y = 0; y < result.height; ++y)
+    for (int x = 0; x < result.width; ++x)
+      if (dungeon(y, x) != Tile::Wall)
+      {
+        result.nodeOf[static_cast<std::size_t>(y) * result.width + x] = static_cast<std::uint32_t>(tiles.size());
+        tiles.push_back({x, y});
+      }
+
+  const auto nodes = tiles.size();
+  Adjacency adjacency(nodes);
+  for (std::uint32_t v = 0; v < nodes; ++v)
+    for (auto successor : successorsFor(tiles[v], dungeon))
+      adjacency[v].push_back({result.node(successor), weight(dungeon, tiles[v], successor), ContractionHierarchy::NONE});
+
+  std::vector<WitnessSearch> witnesses;
+  witnesses.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i)
+    witnesses.emplace_back(nodes);
+  std::vector<std::vector<Shortcut>> scratch(threads);
+
+  std::vector<State> state(nodes, State::Remaining);
+  std::vector<int> deletedNeighbours(nodes, 0);
+  std::vector<int> priority(nodes, 0);
+
+  auto updatePriorities = [&](const std::vector<std::uint32_t>& which)
+    {
+      parallelFor(which.size(), threads, [&](std::size_t i, unsigned worker)
+        {
+          const auto v = which[i];
+          scratch[worker].clear();
+          witnesses[worker].shortcutsOf(v, adjacency, state, scratch[worker]);
+          priority[v] = 2 * static_cast<int>(scratch[worker].size()) - static_cast<int>(adjacency[v].size()) + deletedNeighbours[v];
+        });
+    };
+
+  auto before = [&](std::uint32_t a, std::uint32_t b)
+    {
+      return priority[a] != priority[b] ? priority[a] < priority[b]
+        : tieBreak(a) != tieBreak(b) ? tieBreak(a) < tieBreak(b) : a < b;
+    };
+
+  std::vector<std::uint32_t> remaining(nodes);
+  for (std::uint32_t v = 0; v < nodes; ++v)
+    remaining[v] = v;
+  updatePriorities(remaining);
+
+  std::vector<std::uint32_t> order;
+  order.reserve(nodes);
+  std::vector<std::vector<Edge>> upward(nodes);
+  std::vector<std::uint8_t> chosen(nodes, 0);
+  std::vector<std::uint8_t> dirty(nodes, 0);
+
+  while (!remaining.empty())
+  {
+    // Nodes that come before all their neighbours. None of them are adjacent,
+    // and witnesses avoid all of them, so they can be contracted at the same time.
+    parallelFor(remaining.size(), threads, [&](std::size_t i, unsigned)
+      {
+        const auto v = remaining[i];
+        chosen[v] = std::all_of(adjacency[v].begin(), adjacency[v].end(), [&](const Edge& e) { return before(v, e.to); });
+      });
+
+    std::vector<std::uint32_t> selected;
+    for (auto v : remaining)
+      if (chosen[v])
+      {
+        selected.push_back(v);
+        state[v] = State::Selected;
+      }
+
+    std::vector<std::vector<Shortcut>> shortcuts(selected.size());
+    parallelFor(selected.size(), threads, [&](std::size_t i, unsigned worker)
+      {
+        witnesses[worker].shortcutsOf(selected[i], adjacency, state, shortcuts[i]);
+      });
+
+    std::vector<std::uint32_t> touched;
+    for (std::size_t i = 0; i < selected.size(); ++i)
+    {
+      const auto v = selected[i];
+      order.push_back(v);
+      upward[v] = std::move(adjacency[v]);
+      adjacency[v] = {};
+      state[v] = State::Contracted;
+
+      for (const auto& s : shortcuts[i])
+      {
+        addOrImprove(adjacency[s.a], s.b, s.cost, s.middle);
+        addOrImprove(adjacency[s.b], s.a, s.cost, s.middle);
+      }
+      for (const auto& e : upward[v])
+      {
+        auto& edges = adjacency[e.to];
+        edges.erase(std::find_if(edges.begin(), edges.end(), [v](const Edge& back) { return back.to == v; }));
+        ++deletedNeighbours[e.to];
+        if (!dirty[e.to])
+        {
+          dirty[e.to] = 1;
+          touched.push_back(e.to);
+        }
+      }
+    }
+
+    std::erase_if(remaining, [&](std::uint32_t v) { return state[v] != State::Remaining; });
+    for (auto v : touched)
+      dirty[v] = 0;
+    updatePriorities(touched);
+  }
+
+  std::vector<std::uint32_t> rank(nodes);
+  for (std::uint32_t r = 0; r < nodes; ++r)
+    rank[order[r]] = r;
+
+  result.tileOf.resize(nodes);
+  result.firstArc.reserve(nodes + 1);
+  for (std::uint32_t r = 0; r < nodes; ++r)
+  {
+    const auto v = order[r];
+    result.tileOf[r] = tiles[v];
+    result.firstArc.push_back(static_cast<std::uint32_t>(result.arcs.size()));
+    for (const auto& e : upward[v])
+    {
+      const auto middle = e.middle == ContractionHierarchy::NONE ? ContractionHierarchy::NONE : rank[e.middle];
+      result.arcs.push_back({rank[e.to], e.cost, middle});
+      result.shortcuts += middle != ContractionHierarchy::NONE ? 1 : 0;
+    }
+  }
+  result.firstArc.push_back(static_cast<std::uint32_t>(result.arcs.size()));
+
+  for (auto& node : result.nodeOf)
+    if (node != ContractionHierarchy::NONE)
+      node = rank[node];
+
+  return result;
+}
+
+
+namespace
+{
+
+// Visited nodes only, a query touches a few hundred of them
+class NodeDists
+{
+ public:
+  explicit NodeDists(std::pmr::memory_resource* memory) : dists_{memory} {}
+
+  float get(std::uint32_t v) const
+  {
+    auto it = dists_.find(v);
+    return it == dists_.end() ? INF : it->second;
+  }
+  void set(std::uint32_t v, float dist) { dists_.insert_or_assign(v, dist); }
+
+ private:
+  std::pmr::unordered_map<std::uint32_t, float> dists_;
+};
+
+struct UpwardGraph
+{
+  const ContractionHierarchy& hierarchy;
+
+  template<class F>
+  void forEachSuccessor(std::uint32_t v, F&& f) const
+  {
+    for (auto i = hierarchy.firstArc[v]; i < hierarchy.firstArc[v + 1]; ++i)
+      f(hierarchy.arcs[i].to, hierarchy.arcs[i].cost, i);
+  }
+};
+
+struct UpwardHooks : SearchHooks<std::uint32_t, float>
+{
+  struct Step
+  {
+    std::uint32_t from;
+    std::uint32_t arc;
+  };
+
+  explicit UpwardHooks(std::pmr::memory_resource* memory) : previous{memory} {}
+
+  std::pmr::unordered_map<std::uint32_t, Step> previous;
+
+  void relaxed(std::uint32_t from, std::uint32_t to, std::uint32_t arc) { previous.insert_or_assign(to, Step{from, arc}); }
+};
+
+// The second search stops once it can't improve on the best meeting point
+struct MeetingHooks : UpwardHooks
+{
+  const NodeDists& forward;
+  const NodeDists& backward;
+  float best{INF};
+  std::uint32_t meeting{ContractionHierarchy::NONE};
+
+  bool done(float priority, std::uint32_t) const { return priority >= best; }
+  void expanded(std::uint32_t v)
+  {
+    const float dist = forward.get(v) + backward.get(v);
+    if (dist < best)
+    {
+      best = dist;
+      meeting = v;
+    }
+  }
+};
+
+// The shortcut between a higher node and a lower one is stored with the lower one
+std::uint32_t middleOf(const ContractionHierarchy& hierarchy, std::uint32_t lower, std::uint32_t higher)
+{
+  for (const auto& arc : hierarchy.arcsOf(lower))
+    if (arc.to == higher)
+      return arc.middle;
+  NG_ASSERT(false);
+  return ContractionHierarchy::NONE;
+}
+
+// Appends the tiles after from up to and including to
+void unpack(const ContractionHierarchy& hierarchy, std::uint32_t from, std::uint32_t to, std::uint32_t middle, CompressedPath& path)
+{
+  if (middle == ContractionHierarchy::NONE)
+  {
+    path.push_back(hierarchy.tileOf[to]);
+    return;
+  }
+  unpack(hierarchy, from, middle, middleOf(hierarchy, middle, from), path);
+  unpack(hierarchy, middle, to, middleOf(hierarchy, middle, to), path);
+}
+
+}
+
+SearchResult contractionSearch(const ContractionHierarchy& hierarchy, glm::ivec2 start, glm::ivec2 finish, const SearchContext& context)
+{
+  NG_ASSERT(context.overlay == nullptr);
+
+  const auto source = hierarchy.node(start);
+  const auto target = hierarchy.node(finish);
+  if (source == ContractionHierarchy::NONE || target == ContractionHierarchy::NONE
+    || (context.components != nullptr && !connected(*context.components, start, finish)))
+    return {};
+
+  PhaseTimer timer{context.stats, Phase::Total};
+
+  const UpwardGraph graph{hierarchy};
+  const ZeroHeuristic<FloatCost> heuristic;
+  BinaryHeap<float, std::uint32_t> open{context.resource()};
+  ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+
+  // The whole upward space of the start, every dist in it is final
+  NodeDists forward{context.resource()};
+  UpwardHooks forwardHooks{context.resource()};
+  forward.set(source, 0);
+  open.push(0.f, source);
+  count(context.stats, Counter::Pushes);
+  bestFirst(graph, heuristic, open, forward, forwardHooks, unlimited, context.stats);
+
+  NodeDists backward{context.resource()};
+  MeetingHooks backwardHooks{UpwardHooks{context.resource()}, forward, backward};
+  open.clear();
+  backward.set(target, 0);
+  open.push(0.f, target);
+  count(context.stats, Counter::Pushes);
+  bestFirst(graph, heuristic, open, backward, backwardHooks, unlimited, context.stats);
+
+  if (backwardHooks.meeting == ContractionHierarchy::NONE)
+    return {};
+
+  // Down from the meeting point to the start, then unpacked the other way round
+  std::pmr::vector<std::uint32_t> up{context.resource()};
+  for (auto v = backwardHooks.meeting; v != source; v = forwardHooks.previous.at(v).from)
+    up.push_back(forwardHooks.previous.at(v).arc);
+
+  SearchResult result{.path = CompressedPath{context.resource()}};
+  result.path.push_back(start);
+  auto from = source;
+  for (auto it = up.rbegin(); it != up.rend(); ++it)
+  {
+    const auto& arc = hierarchy.arcs[*it];
+    unpack(hierarchy, from, arc.to, arc.middle, result.path);
+    from = arc.to;
+  }
+  for (auto v = backwardHooks.meeting; v != target;)
+  {
+    const auto step = backwardHooks.previous.at(v);
+    unpack(hierarchy, v, step.from, hierarchy.arcs[step.arc].middle, result.path);
+    v = step.from;
+  }
+
+  if (context.output != SearchOutput::Path)
+    result.dist = backwardHooks.best;
+  return result;
+}
+
+}
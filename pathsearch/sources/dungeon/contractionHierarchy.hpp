@@ -0,0 +1,62 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "pathsearch.hpp"
+#include "searchStats.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// Contraction hierarchy (Geisberger et al.) over the walkable tiles of a map that never changes,
+// with the weight() costs. Tiles are contracted one by one, shortcuts keep the distances
+// between the remaining ones, so a query only ever has to go up in rank from both ends.
+// Nodes are numbered by rank, every arc of a node leads to a higher one.
+struct ContractionHierarchy
+{
+  static constexpr std::uint32_t NONE = static_cast<std::uint32_t>(-1);
+
+  struct Arc
+  {
+    std::uint32_t to;
+    float cost;
+    // The node this shortcut bypasses, NONE for a step between neighbouring tiles
+    std::uint32_t middle;
+  };
+
+  int width{0};
+  int height{0};
+  // Row-major, NONE for walls
+  std::vector<std::uint32_t> nodeOf;
+  std::vector<glm::ivec2> tileOf;
+  // Arcs of node n are arcs[firstArc[n], firstArc[n + 1])
+  std::vector<std::uint32_t> firstArc;
+  std::vector<Arc> arcs;
+  std::size_t shortcuts{0};
+
+  std::uint32_t node(glm::ivec2 v) const
+  {
+    return v.x >= 0 && v.y >= 0 && v.x < width && v.y < height ? nodeOf[static_cast<std::size_t>(v.y) * width + v.x] : NONE;
+  }
+
+  std::span<const Arc> arcsOf(std::uint32_t n) const
+    { return std::span{arcs}.subspan(firstArc[n], firstArc[n + 1] - firstArc[n]); }
+
+  std::size_t memoryBytes() const;
+};
+
+// Nodes are ordered by edge difference plus contracted neighbours, every round contracts
+// an independent set of local minima in parallel. threads == 0 means one per hardware thread.
+ContractionHierarchy buildContractionHierarchy(DungeonView dungeon, unsigned threads = 0, SearchStats* stats = nullptr);
+
+// Upward searches from both ends, then the shortcuts on the best meeting point are unpacked into tiles.
+// Same cost as aStar with eps = 1. Overlays are not supported, dists are never returned.
+SearchResult contractionSearch(const ContractionHierarchy& hierarchy, glm::ivec2 start, glm::ivec2 finish,
+  const SearchContext& context = {});
+
+}
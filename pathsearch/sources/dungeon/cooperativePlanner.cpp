@@ -0,0 +1,263 @@
+#include "cooperativePlanner.hpp"
+#include "dungeon/bestFirst.hpp"
+#include "dungeon/deltaStepping.hpp"
+#include "dungeon/grid.hpp"
+#include "assert.hpp"
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+
+namespace dungeon
+{
+
+bool ReservationTable::reserve(glm::ivec2 v, int time, std::uint32_t agent)
+{
+  NG_ASSERT(v.x >= 0 && v.y >= 0 && v.x < MAX_COORD && v.y < MAX_COORD && time >= 0 && time <= MAX_TIME);
+
+  // At most half full
+  if (2 * (size_ + 1) > slots_.size())
+    grow();
+
+  auto& slot = slots_[slotOf(key(v, time))];
+  if (slot.key != EMPTY)
+    return slot.agent == agent;
+
+  slot = Slot{key(v, time), agent};
+  ++size_;
+  return true;
+}
+
+std::uint32_t ReservationTable::owner(glm::ivec2 v, int time) const
+{
+  if (slots_.empty())
+    return NONE;
+  return slots_[slotOf(key(v, time))].agent;
+}
+
+void ReservationTable::clear()
+{
+  std::fill(slots_.begin(), slots_.end(), Slot{});
+  size_ = 0;
+}
+
+// The slot holding the key, or the empty one where it would go
+std::size_t ReservationTable::slotOf(std::uint64_t key) const
+{
+  const auto mask = slots_.size() - 1;
+  // Fibonacci hashing, the packed keys differ mostly in their low bits
+  auto i = static_cast<std::size_t>((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+  while (slots_[i].key != EMPTY && slots_[i].key != key)
+    i = (i + 1) & mask;
+  return i;
+}
+
+void ReservationTable::grow()
+{
+  auto old = std::move(slots_);
+  slots_.assign(std::max<std::size_t>(64, 2 * old.size()), Slot{});
+  for (const auto& slot : old)
+    if (slot.key != EMPTY)
+      slots_[slotOf(slot.key)] = slot;
+}
+
+namespace
+{
+
+constexpr float WAIT_COST = 1;
+
+struct SpaceTimeNode
+{
+  glm::ivec2 tile;
+  int time;
+};
+
+std::uint64_t keyOf(const SpaceTimeNode& node)
+{
+  return std::uint64_t(std::uint32_t(node.tile.x)) << 40 | std::uint64_t(std::uint32_t(node.tile.y)) << 16 | std::uint64_t(node.time);
+}
+
+// Waits and 4-connected moves up to the end of the window, around everything other agents reserved
+struct SpaceTimeGraph
+{
+  GridGraph<DungeonView, FourConnected, FloatCost> grid;
+  const ReservationTable& reservations;
+  std::uint32_t agent;
+  int window;
+
+  bool free(glm::ivec2 from, glm::ivec2 to, int time) const
+  {
+    const auto owner = reservations.owner(to, time + 1);
+    if (owner != ReservationTable::NONE && owner != agent)
+      return false;
+    // Swapping places with whoever is in `to` now
+    const auto there = reservations.owner(to, time);
+    return there == ReservationTable::NONE || there == agent || reservations.owner(from, time + 1) != there;
+  }
+
+  template<class F>
+  void forEachSuccessor(const SpaceTimeNode& node, F&& f) const
+  {
+    if (node.time >= window)
+      return;
+    if (free(node.tile, node.tile, node.time))
+      f(SpaceTimeNode{node.tile, node.time + 1}, WAIT_COST);
+    grid.forEachSuccessor(node.tile, [&](glm::ivec2 to, float cost)
+      {
+        if (free(node.tile, to, node.time))
+          f(SpaceTimeNode{to, node.time + 1}, cost);
+      });
+  }
+};
+
+// The exact distance to the goal, ignoring other agents.
+// The field is grown outward from the goal, and overlay costs are charged for the tile
+// entered, so it holds goal -> n: extra(n) is counted and extra(goal) is not. Walking
+// n -> goal is the other way around, both are swapped back here.
+struct GoalDistance
+{
+  const Dists& toGoal;
+  glm::ivec2 goal;
+  const ObstacleOverlay* overlay;
+
+  float operator()(const SpaceTimeNode& node) const
+  {
+    const float dist = toGoal(node.tile.y, node.tile.x);
+    if (overlay == nullptr || dist == INF || node.tile == goal)
+      return dist;
+    return dist - overlay->extraCost(node.tile) + overlay->extraCost(goal);
+  }
+};
+
+class SpaceTimeDists
+{
+ public:
+  float get(const SpaceTimeNode& node) const
+  {
+    auto it = dists_.find(keyOf(node));
+    return it == dists_.end() ? INF : it->second;
+  }
+  void set(const SpaceTimeNode& node, float dist) { dists_.insert_or_assign(keyOf(node), dist); }
+
+ private:
+  std::unordered_map<std::uint64_t, float> dists_;
+};
+
+// Ends at the end of the window, or at the goal once nobody needs it for the rest of the window
+struct WindowHooks : SearchHooks<SpaceTimeNode, float>
+{
+  const ReservationTable& reservations;
+  std::uint32_t agent;
+  glm::ivec2 goal;
+  int window;
+  std::unordered_map<std::uint64_t, SpaceTimeNode> previous;
+
+  bool done(float, const SpaceTimeNode& top) const
+  {
+    if (top.time >= window)
+      return true;
+    if (top.tile != goal)
+      return false;
+    for (int t = top.time + 1; t <= window; ++t)
+      if (const auto owner = reservations.owner(goal, t); owner != ReservationTable::NONE && owner != agent)
+        return false;
+    return true;
+  }
+
+  void relaxed(const SpaceTimeNode& from, const SpaceTimeNode& to) { previous.insert_or_assign(keyOf(to), from); }
+};
+
+}
+
+CooperativePlanner::CooperativePlanner(DungeonView dungeon, const CooperativeParams& params)
+  : dungeon_{dungeon}, params_{params}
+{
+  NG_ASSERT(params_.replanInterval > 0 && params_.replanInterval <= params_.window && params_.window <= ReservationTable::MAX_TIME);
+  NG_ASSERT(dungeon_.extent(0) < ReservationTable::MAX_COORD && dungeon_.extent(1) < ReservationTable::MAX_COORD);
+}
+
+CooperativePlanner::AgentId CooperativePlanner::addAgent(glm::ivec2 position, glm::ivec2 goal)
+{
+  NG_ASSERT(isPassable(dungeon_, position, params_.overlay));
+  agents_.push_back(Agent{.position = position, .goal = goal});
+  // Newcomers join the next replan
+  sinceReplan_ = 0;
+  return static_cast<AgentId>(agents_.size() - 1);
+}
+
+void CooperativePlanner::setGoal(AgentId agent, glm::ivec2 goal)
+{
+  if (agents_[agent].goal == goal)
+    return;
+  agents_[agent].goal = goal;
+  agents_[agent].toGoal = {};
+}
+
+void CooperativePlanner::tick()
+{
+  PhaseTimer timer{params_.stats, Phase::Total};
+
+  if (sinceReplan_ == 0)
+    replan();
+
+  ++sinceReplan_;
+  for (auto& agent : agents_)
+    agent.position = agent.plan[std::min<std::size_t>(sinceReplan_, agent.plan.size() - 1)];
+  if (sinceReplan_ == params_.replanInterval)
+    sinceReplan_ = 0;
+  ++ticks_;
+}
+
+void CooperativePlanner::replan()
+{
+  reservations_.clear();
+  // Where everybody is now, so that nobody plans to swap places with an agent planned after it
+  for (AgentId i = 0; i < agents_.size(); ++i)
+    reservations_.reserve(agents_[i].position, 0, i);
+
+  for (std::size_t n = 0; n < agents_.size(); ++n)
+    plan(static_cast<AgentId>((n + replans_) % agents_.size()));
+  ++replans_;
+}
+
+void CooperativePlanner::plan(AgentId id)
+{
+  auto& agent = agents_[id];
+  if (agent.toGoal.size() == 0)
+    agent.toGoal = distanceField(dungeon_, agent.goal, {.overlay = params_.overlay, .threads = 1});
+
+  agent.plan.assign(1, agent.position);
+
+  if (agent.toGoal(agent.position.y, agent.position.x) < INF)
+  {
+    const SpaceTimeGraph graph{{dungeon_, params_.overlay}, reservations_, id, params_.window};
+    const GoalDistance heuristic{agent.toGoal, agent.goal, params_.overlay};
+    BinaryHeap<float, SpaceTimeNode> open;
+    SpaceTimeDists dists;
+    WindowHooks hooks{{}, reservations_, id, agent.goal, params_.window, {}};
+
+    const SpaceTimeNode start{agent.position, 0};
+    dists.set(start, 0);
+    open.push(heuristic(start), start);
+    count(params_.stats, Counter::Pushes);
+    ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+    bestFirst(graph, heuristic, open, dists, hooks, unlimited, params_.stats);
+
+    // The search leaves the node it stopped at on the open list. Nothing left means every way got blocked.
+    if (!open.empty())
+    {
+      std::vector<glm::ivec2> reversed;
+      for (auto node = open.top().node; node.time > 0; node = hooks.previous.at(keyOf(node)))
+        reversed.push_back(node.tile);
+      agent.plan.insert(agent.plan.end(), reversed.rbegin(), reversed.rend());
+    }
+  }
+
+  // Stays put after arriving early, done() made sure the goal is free until the window ends
+  agent.plan.resize(static_cast<std::size_t>(params_.window) + 1, agent.plan.back());
+  for (int t = 0; t <= params_.window; ++t)
+    if (!reservations_.reserve(agent.plan[t], t, id))
+      ++conflicts_;
+}
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "overlay.hpp"
+#include "pathsearch.hpp"
+#include "searchStats.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// Which agent holds a tile at a time step. Open addressing over (x, y, time) packed
+// into 64 bits with linear probing, 12 bytes per slot. It is only ever cleared as a
+// whole, so entries are never removed one by one and there are no tombstones.
+class ReservationTable
+{
+ public:
+  static constexpr std::uint32_t NONE = static_cast<std::uint32_t>(-1);
+  // Coordinates and times have to stay below these
+  static constexpr int MAX_COORD = (1 << 24) - 1;
+  static constexpr int MAX_TIME = (1 << 16) - 1;
+
+  // False if another agent holds it already, which keeps it
+  bool reserve(glm::ivec2 v, int time, std::uint32_t agent);
+  std::uint32_t owner(glm::ivec2 v, int time) const;
+
+  // Keeps the capacity
+  void clear();
+
+  std::size_t size() const { return size_; }
+  std::size_t memoryBytes() const { return slots_.capacity() * sizeof(Slot); }
+
+ private:
+  static constexpr std::uint64_t EMPTY = ~std::uint64_t{0};
+
+  struct Slot
+  {
+    std::uint64_t key{EMPTY};
+    std::uint32_t agent{NONE};
+  };
+
+  static std::uint64_t key(glm::ivec2 v, int time)
+    { return std::uint64_t(v.x) << 40 | std::uint64_t(v.y) << 16 | std::uint64_t(time); }
+  std::size_t slotOf(std::uint64_t key) const;
+  void grow();
+
+  std::vector<Slot> slots_;
+  std::size_t size_{0};
+};
+
+struct CooperativeParams
+{
+  // Time steps every agent plans ahead, the reservations of all agents cover them
+  int window{16};
+  // Ticks between replans, at most the window. Half of it in WHCA*.
+  int replanInterval{8};
+  // Extra blocked or costly tiles, must outlive the planner.
+  // Goal distances are computed with it once per goal, later changes are not seen by them.
+  const ObstacleOverlay* overlay{nullptr};
+  // Accumulated into, not reset
+  SearchStats* stats{nullptr};
+};
+
+// Windowed hierarchical cooperative A* (Silver): every replan, agents search the
+// (tile, time) graph one after another and reserve their way through the next window,
+// so later agents route around earlier ones instead of colliding and replanning.
+// Moves cost weight(), waiting costs a plain step. Past the window the exact distance
+// to the goal is used, a map-sized distance field per agent grown from the goal and
+// corrected for overlay costs being charged in the other direction. The order rotates every
+// replan, so no agent always has to give way. Not thread-safe.
+class CooperativePlanner
+{
+ public:
+  using AgentId = std::uint32_t;
+
+  explicit CooperativePlanner(DungeonView dungeon, const CooperativeParams& params = {});
+
+  // The position must be walkable and not taken by another agent
+  AgentId addAgent(glm::ivec2 position, glm::ivec2 goal);
+  // Taken into account at the next replan
+  void setGoal(AgentId agent, glm::ivec2 goal);
+
+  // Moves every agent one step along its plan, replanning all of them first when it is time
+  void tick();
+
+  glm::ivec2 position(AgentId agent) const { return agents_[agent].position; }
+  glm::ivec2 goal(AgentId agent) const { return agents_[agent].goal; }
+  std::size_t agentCount() const { return agents_.size(); }
+  std::uint64_t ticks() const { return ticks_; }
+  // Reservations that could not be made because no plan avoided them, 0 unless agents got boxed in
+  std::uint64_t conflicts() const { return conflicts_; }
+  const ReservationTable& reservations() const { return reservations_; }
+
+ private:
+  struct Agent
+  {
+    glm::ivec2 position;
+    glm::ivec2 goal;
+    // Empty until the first replan with this goal
+    Dists toGoal;
+    // Tile at every time step since the last replan
+    std::vector<glm::ivec2> plan;
+  };
+
+  void replan();
+  void plan(AgentId agent);
+
+  DungeonView dungeon_;
+  CooperativeParams params_;
+  std::vector<Agent> agents_;
+  ReservationTable reservations_;
+  std::uint64_t ticks_{0};
+  std::uint64_t replans_{0};
+  std::uint64_t conflicts_{0};
+  int sinceReplan_{0};
+};
+
+}
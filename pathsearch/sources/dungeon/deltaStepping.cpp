@@ -0,0 +1,279 @@
+#include "deltaStepping.hpp"
+#include "dungeon/bestFirst.hpp"
+#include "assert.hpp"
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <thread>
+#include <vector>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+// Row-major tile index, same as in Dists
+using Node = std::uint32_t;
+
+class DeltaStepping
+{
+ public:
+  DeltaStepping(DungeonView dungeon, float* dists, const DistanceFieldParams& params, unsigned threads)
+    : dungeon_{dungeon}
+    , graph_{dungeon, params.overlay}
+    , dists_{dists}
+    , delta_{params.delta}
+    , locals_(threads)
+    , barrier_{static_cast<std::ptrdiff_t>(threads), Advance{this}}
+  {
+    // Without a step heavier than delta the heavy phases can be skipped
+    float heaviest = 1 + WATER_PENALTY;
+    if (params.overlay != nullptr)
+      for (const auto& entry : *params.overlay)
+        if (entry.second != ObstacleOverlay::BLOCKED)
+          heaviest = std::max(heaviest, 1 + WATER_PENALTY + entry.second);
+    hasHeavy_ = heaviest > delta_;
+    // Light steps land in the current or the next bucket and the steps of the map itself
+    // a few further, those buckets are reused round-robin. Overlay costs can be arbitrarily
+    // large, what they push further away waits in Local::far.
+    bucketCount_ = static_cast<std::size_t>(std::min((1 + WATER_PENALTY) / delta_, float(MAX_RING))) + 2;
+
+    for (auto& local : locals_)
+      local.buckets.resize(bucketCount_);
+  }
+
+  void run(glm::ivec2 source)
+  {
+    const auto node = index(source);
+    dists_[node] = 0;
+    locals_.front().buckets[0].push_back(node);
+
+    {
+      std::vector<std::jthread> workers;
+      workers.reserve(locals_.size() - 1);
+      for (unsigned thread = 1; thread < locals_.size(); ++thread)
+        workers.emplace_back([this, thread]() { work(locals_[thread]); });
+      work(locals_.front());
+    }
+  }
+
+  std::uint64_t expanded() const
+  {
+    std::uint64_t result = 0;
+    for (const auto& local : locals_)
+      result += local.expanded;
+    return result;
+  }
+
+  std::uint64_t pushes() const
+  {
+    std::uint64_t result = 0;
+    for (const auto& local : locals_)
+      result += local.pushes;
+    return result;
+  }
+
+ private:
+  enum class Step
+  {
+    Light,
+    Heavy,
+    Done,
+  };
+
+  // Owned by one thread, gathered between the phases
+  struct alignas(64) Local
+  {
+    std::vector<std::vector<Node>> buckets;
+    // Buckets past the ring by their index, sparse since only overlay costs get there
+    std::map<std::size_t, std::vector<Node>> far;
+    // Scanned in the light phases of the current bucket
+    std::vector<Node> settled;
+    std::uint64_t expanded{0};
+    std::uint64_t pushes{0};
+  };
+
+  struct Advance
+  {
+    DeltaStepping* self;
+    void operator()() noexcept { self->advance(); }
+  };
+
+  // Nodes of a phase are handed out in batches
+  static constexpr std::size_t BATCH = 256;
+  // Caps the ring for tiny deltas
+  static constexpr std::size_t MAX_RING = 64;
+  // Dists this far out share a bucket instead of overflowing the cast
+  static constexpr float MAX_BUCKET = 0x1p62f;
+
+  Node index(glm::ivec2 v) const { return static_cast<Node>(v.y) * static_cast<Node>(dungeon_.extent(1)) + v.x; }
+  glm::ivec2 tile(Node v) const
+  {
+    const auto width = static_cast<Node>(dungeon_.extent(1));
+    return {static_cast<int>(v % width), static_cast<int>(v / width)};
+  }
+
+  std::size_t bucketOf(float dist) const { return static_cast<std::size_t>(std::min(dist / delta_, MAX_BUCKET)); }
+
+  void relax(Local& local, Node v, float dist)
+  {
+    std::atomic_ref<float> slot{dists_[v]};
+    for (auto old = slot.load(std::memory_order_relaxed); dist < old;)
+      if (slot.compare_exchange_weak(old, dist, std::memory_order_relaxed))
+      {
+        const auto bucket = bucketOf(dist);
+        if (bucket - current_ < bucketCount_)
+          local.buckets[bucket % bucketCount_].push_back(v);
+        else
+          local.far[bucket].push_back(v);
+        ++local.pushes;
+        return;
+      }
+  }
+
+  template<bool Light>
+  void scan(Local& local, Node v)
+  {
+    const auto dist = std::atomic_ref<float>{dists_[v]}.load(std::memory_order_relaxed);
+    graph_.forEachSuccessor(tile(v), [&](glm::ivec2 successor, float cost)
+      {
+        if ((cost <= delta_) == Light)
+          relax(local, index(successor), dist + cost);
+      });
+  }
+
+  void work(Local& local)
+  {
+    for (;;)
+    {
+      barrier_.arrive_and_wait();
+      if (step_ == Step::Done)
+        return;
+
+      const auto size = frontier_.size();
+      for (auto begin = next_.fetch_add(BATCH); begin < size; begin = next_.fetch_add(BATCH))
+        for (auto i = begin; i < std::min(begin + BATCH, size); ++i)
+          if (step_ == Step::Light)
+          {
+            ++local.expanded;
+            if (hasHeavy_)
+              local.settled.push_back(frontier_[i]);
+            scan<true>(local, frontier_[i]);
+          }
+          else
+          {
+            scan<false>(local, frontier_[i]);
+          }
+    }
+  }
+
+  // Moves what the threads collected into the frontier, listOf(local) picks the list
+  template<class F>
+  bool gather(F&& listOf)
+  {
+    frontier_.clear();
+    for (auto& local : locals_)
+    {
+      auto& items = listOf(local);
+      frontier_.insert(frontier_.end(), items.begin(), items.end());
+      items.clear();
+    }
+    next_ = 0;
+    return !frontier_.empty();
+  }
+
+  bool gatherBucket(std::size_t bucket)
+  {
+    gather([this, bucket](Local& local) -> auto& { return local.buckets[bucket % bucketCount_]; });
+    for (auto& local : locals_)
+      if (auto it = local.far.find(bucket); it != local.far.end())
+      {
+        frontier_.insert(frontier_.end(), it->second.begin(), it->second.end());
+        local.far.erase(it);
+      }
+    return !frontier_.empty();
+  }
+
+  // Barrier completion, runs on one thread while the others wait.
+  // Light phases repeat while they refill the current bucket, then the heavy steps
+  // of everything it settled go once, then on to the next non-empty bucket.
+  void advance()
+  {
+    if (step_ == Step::Light)
+    {
+      if (gatherBucket(current_))
+        return;
+      if (hasHeavy_ && gather([](Local& local) -> auto& { return local.settled; }))
+      {
+        step_ = Step::Heavy;
+        return;
+      }
+    }
+
+    // The ring only has to be searched up to the nearest far bucket
+    auto nearestFar = std::numeric_limits<std::size_t>::max();
+    for (const auto& local : locals_)
+      if (!local.far.empty())
+        nearestFar = std::min(nearestFar, local.far.begin()->first);
+
+    for (std::size_t k = 1; k < bucketCount_ && current_ + k <= nearestFar; ++k)
+      if (gatherBucket(current_ + k))
+      {
+        current_ += k;
+        step_ = Step::Light;
+        return;
+      }
+    if (nearestFar != std::numeric_limits<std::size_t>::max())
+    {
+      gatherBucket(nearestFar);
+      current_ = nearestFar;
+      step_ = Step::Light;
+      return;
+    }
+    step_ = Step::Done;
+  }
+
+  DungeonView dungeon_;
+  GridGraph<DungeonView, FourConnected, FloatCost> graph_;
+  float* dists_;
+  float delta_;
+  bool hasHeavy_{false};
+  std::size_t bucketCount_{0};
+
+  std::vector<Local> locals_;
+  std::barrier<Advance> barrier_;
+
+  // Written by advance() only, the barrier publishes them
+  Step step_{Step::Light};
+  std::size_t current_{0};
+  std::vector<Node> frontier_;
+  std::atomic<std::size_t> next_{0};
+};
+
+}
+
+Dists distanceField(DungeonView dungeon, glm::ivec2 source, const DistanceFieldParams& params)
+{
+  NG_ASSERT(params.delta > 0);
+  NG_ASSERT(dungeon.size() <= std::size_t{1} << 32);
+  PhaseTimer timer{params.stats, Phase::Total};
+
+  Dists result{DungeonExtents{dungeon.extent(0), dungeon.extent(1)}, INF};
+  if (!isPassable(dungeon, source, params.overlay))
+    return result;
+
+  const auto threads = params.threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : params.threads;
+  DeltaStepping search{dungeon, result.to_mdspan().data_handle(), params, threads};
+  search.run(source);
+
+  count(params.stats, Counter::Expanded, search.expanded());
+  count(params.stats, Counter::Pushes, search.pushes());
+  return result;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "grid.hpp"
+#include "overlay.hpp"
+#include "pathsearch.hpp"
+#include "searchStats.hpp"
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+struct DistanceFieldParams
+{
+  // Extra blocked or costly tiles
+  const ObstacleOverlay* overlay{nullptr};
+  // Width of a bucket. Steps up to delta are light and relaxed until their bucket settles,
+  // heavier ones once afterwards. The default keeps every step of a map without overlay light.
+  float delta{1 + WATER_PENALTY};
+  // 0 means one per hardware thread
+  unsigned threads{0};
+  // Accumulated into, not reset
+  SearchStats* stats{nullptr};
+};
+
+// Distances from the source to every tile by parallel delta-stepping (Meyer and Sanders),
+// INF where there is no way. Tiles are kept in buckets of width delta, all threads relax
+// the current bucket together and meet on a barrier between the phases.
+// Same distances as Dijkstra, for debug views, flow fields and heuristic tables.
+Dists distanceField(DungeonView dungeon, glm::ivec2 source, const DistanceFieldParams& params = {});
+
+}
@@ -0,0 +1,212 @@
+#include "dstarLite.hpp"
+#include "grid.hpp"
+#include "pathsearch.hpp"
+
+#include <algorithm>
+#include <array>
+
+
+namespace dungeon
+{
+
+static constexpr std::array NEIGHBOURS{glm::ivec2{0, 1}, glm::ivec2{0, -1}, glm::ivec2{1, 0}, glm::ivec2{-1, 0}};
+
+DStarLite::DStarLite(DungeonView dungeon, glm::ivec2 start, glm::ivec2 goal, const ObstacleOverlay* overlay)
+  : dungeon_{dungeon}
+  , overlay_{overlay}
+  , start_{start}
+  , goal_{goal}
+  , last_{start}
+{
+  auto& n = node(goal_);
+  n.rhs = 0;
+  n.queued = calculateKey(goal_);
+  n.inQueue = true;
+  queue_.push({n.queued, goal_});
+}
+
+DStarLite::Node& DStarLite::node(glm::ivec2 v)
+{
+  return nodes_.try_emplace(v, Node{INF, INF, {}}).first->second;
+}
+
+float DStarLite::g(glm::ivec2 v) const
+{
+  auto it = nodes_.find(v);
+  return it == nodes_.end() ? INF : it->second.g;
+}
+
+float DStarLite::rhs(glm::ivec2 v) const
+{
+  auto it = nodes_.find(v);
+  return it == nodes_.end() ? INF : it->second.rhs;
+}
+
+float DStarLite::cost(glm::ivec2 from, glm::ivec2 to) const
+{
+  if (!isPassable(dungeon_, from, overlay_) || !isPassable(dungeon_, to, overlay_))
+    return INF;
+  return weight(dungeon_, from, to, overlay_);
+}
+
+DStarLite::Key DStarLite::calculateKey(glm::ivec2 v) const
+{
+  const float m = std::min(g(v), rhs(v));
+  return {m + ivecDist(start_, v) + keyOffset_, m};
+}
+
+void DStarLite::updateVertex(glm::ivec2 v, SearchStats* stats)
+{
+  auto& n = node(v);
+
+  if (v != goal_)
+  {
+    float best = INF;
+    for (auto offset : NEIGHBOURS)
+      if (inBounds(v + offset, dungeon_.extents()))
+        best = std::min(best, cost(v, v + offset) + g(v + offset));
+    n.rhs = best;
+  }
+
+  n.inQueue = n.g != n.rhs;
+  if (n.inQueue)
+  {
+    n.queued = calculateKey(v);
+    queue_.push({n.queued, v});
+    count(stats, Counter::Pushes);
+  }
+}
+
+void DStarLite::tileChanged(glm::ivec2 pos)
+{
+  changed_.push_back(pos);
+}
+
+void DStarLite::moveStart(glm::ivec2 start)
+{
+  // Keys already in the queue stay valid lower bounds when shifted by the distance moved
+  keyOffset_ += ivecDist(last_, start);
+  last_ = start;
+  start_ = start;
+}
+
+bool DStarLite::replan(SearchStats* stats, ExpansionBudget* budget)
+{
+  PhaseTimer timer{stats, Phase::Total};
+
+  // Every edge into or out of a changed tile may have a new cost
+  for (auto v : changed_)
+  {
+    if (!inBounds(v, dungeon_.extents()))
+      continue;
+    updateVertex(v, stats);
+    for (auto offset : NEIGHBOURS)
+      if (isPassable(dungeon_, v + offset, overlay_))
+        updateVertex(v + offset, stats);
+  }
+  changed_.clear();
+
+  while (!queue_.empty())
+  {
+    if (budget != nullptr && budget->remaining == 0)
+      return false;
+
+    const auto[key, u] = queue_.top();
+    auto& n = nodes_.find(u)->second;
+
+    if (!n.inQueue || !(key == n.queued))
+    {
+      queue_.pop();
+      count(stats, Counter::StalePops);
+      continue;
+    }
+
+    if (!(key < calculateKey(start_)) && rhs(start_) <= g(start_))
+      break;
+
+    queue_.pop();
+    count(stats, Counter::Pops);
+
+    const Key newKey = calculateKey(u);
+    if (key < newKey)
+    {
+      n.queued = newKey;
+      queue_.push({newKey, u});
+      count(stats, Counter::Pushes);
+      continue;
+    }
+
+    count(stats, Counter::Expanded);
+    if (budget != nullptr)
+      --budget->remaining;
+    n.inQueue = false;
+
+    if (n.g > n.rhs)
+    {
+      n.g = n.rhs;
+    }
+    else
+    {
+      n.g = INF;
+      updateVertex(u, stats);
+    }
+
+    for (auto offset : NEIGHBOURS)
+      if (isPassable(dungeon_, u + offset, overlay_))
+        updateVertex(u + offset, stats);
+  }
+  return true;
+}
+
+SlicedSearch DStarLite::replanSliced(ExpansionBudget& budget, SearchStats* stats)
+{
+  while (!replan(stats, &budget))
+    co_yield SearchSlice{};
+
+  SearchSlice solution{.solution = true, .result = {.path = path()}};
+  if (!solution.result.path.empty())
+    solution.result.dist = dist();
+  co_yield std::move(solution);
+}
+
+CompressedPath DStarLite::path() const
+{
+  CompressedPath result;
+  if (dist() >= INF)
+    return result;
+
+  result.push_back(start_);
+
+  // Following the cheapest successor can't loop on a consistent tree, the limit guards against misuse
+  for (auto current = start_; current != goal_;)
+  {
+    glm::ivec2 best = current;
+    float bestCost = INF;
+    for (auto offset : NEIGHBOURS)
+    {
+      if (!inBounds(current + offset, dungeon_.extents()))
+        continue;
+      const float c = cost(current, current + offset) + g(current + offset);
+      if (c < bestCost)
+      {
+        best = current + offset;
+        bestCost = c;
+      }
+    }
+
+    if (best == current || result.size() > nodes_.size())
+      return {};
+
+    current = best;
+    result.push_back(current);
+  }
+
+  return result;
+}
+
+float DStarLite::dist() const
+{
+  return std::min(g(start_), rhs(start_));
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "compressedPath.hpp"
+#include "overlay.hpp"
+#include "pathsearch.hpp"
+#include "searchStats.hpp"
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+
+namespace dungeon
+{
+
+// Per-agent D* Lite planner (Koenig & Likhachev). Searches backwards from the goal
+// and keeps its state between calls, so after a tile change or an agent step only
+// the part of the search tree that is actually affected gets repaired.
+// Nodes are stored sparsely, memory follows the explored area rather than the map.
+class DStarLite
+{
+ public:
+  // The map and the overlay are observed, not copied: report every change through tileChanged
+  DStarLite(DungeonView dungeon, glm::ivec2 start, glm::ivec2 goal, const ObstacleOverlay* overlay = nullptr);
+
+  // Must be called after dungeon(pos) or the overlay at pos has changed
+  void tileChanged(glm::ivec2 pos);
+
+  // Usually one step along path(), but any position works
+  void moveStart(glm::ivec2 start);
+
+  // Brings the solution up to date, cheap when little changed since the last call.
+  // Returns false when the budget ran out first, calling again carries on with the repair.
+  bool replan(SearchStats* stats = nullptr, ExpansionBudget* budget = nullptr);
+
+  // replan() as a coroutine, the solution is path() and dist(). The planner must outlive it.
+  SlicedSearch replanSliced(ExpansionBudget& budget, SearchStats* stats = nullptr);
+
+  // From start to goal, empty if the goal can't be reached. Only valid after replan().
+  CompressedPath path() const;
+  float dist() const;
+
+  glm::ivec2 start() const { return start_; }
+  glm::ivec2 goal() const { return goal_; }
+  std::size_t nodeCount() const { return nodes_.size(); }
+
+ private:
+  struct Key
+  {
+    float primary;
+    float secondary;
+
+    friend bool operator<(const Key& a, const Key& b)
+      { return a.primary < b.primary || (a.primary == b.primary && a.secondary < b.secondary); }
+    friend bool operator==(const Key&, const Key&) = default;
+  };
+
+  struct Node
+  {
+    float g;
+    float rhs;
+    // Key of the live queue entry, entries with any other key are stale
+    Key queued;
+    bool inQueue{false};
+  };
+
+  using Entry = std::pair<Key, glm::ivec2>;
+
+  struct Later
+  {
+    bool operator()(const Entry& a, const Entry& b) const { return b.first < a.first; }
+  };
+
+  Node& node(glm::ivec2 v);
+  float g(glm::ivec2 v) const;
+  float rhs(glm::ivec2 v) const;
+  float cost(glm::ivec2 from, glm::ivec2 to) const;
+  Key calculateKey(glm::ivec2 v) const;
+  void updateVertex(glm::ivec2 v, SearchStats* stats);
+
+  DungeonView dungeon_;
+  const ObstacleOverlay* overlay_;
+  glm::ivec2 start_;
+  glm::ivec2 goal_;
+  // Start position the current key offset was computed for
+  glm::ivec2 last_;
+  float keyOffset_{0};
+
+  std::unordered_map<glm::ivec2, Node> nodes_;
+  std::priority_queue<Entry, std::vector<Entry>, Later> queue_;
+  // Changes since the last replan, deferred so that bursts of edits are cheap
+  std::vector<glm::ivec2> changed_;
+};
+
+}
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <span>
 #include <vector>
 #include <experimental/mdspan>
+#include "layouts.hpp"
 
 
 namespace dungeon
@@ -15,7 +18,25 @@ enum Tile : char
   Water = '~'
 };
 
-using DungeonView = std::experimental::mdspan<Tile, std::experimental::extents<int, std::dynamic_extent, std::dynamic_extent>>;
+using DungeonExtents = std::experimental::extents<int, std::dynamic_extent, std::dynamic_extent>;
+// Coordinates still fit an int, flat indices of maps past 46k x 46k do not
+using LargeDungeonExtents = std::experimental::extents<std::int64_t, std::dynamic_extent, std::dynamic_extent>;
+
+template<class Layout, class Accessor = std::experimental::default_accessor<Tile>, class Extents = DungeonExtents>
+using BasicDungeonView = std::experimental::mdspan<typename Accessor::element_type, Extents, Layout, Accessor>;
+
+using DungeonView = BasicDungeonView<std::experimental::layout_right>;
+// 8x8 tiles per block, a single cache line
+using BlockedDungeonView = BasicDungeonView<layout_blocked<3>>;
+using MortonDungeonView = BasicDungeonView<layout_morton>;
+
+// 32x32 tile chunks stored apart from each other, read-only. See MapStore.
+constexpr int CHUNK_BITS = 5;
+using ChunkedDungeonView = BasicDungeonView<layout_blocked<CHUNK_BITS>, chunked_accessor<const Tile, CHUNK_BITS>>;
+// Same chunks, but all-wall ones are shared and indices are 64 bit. See SparseDungeon.
+using SparseDungeonView = BasicDungeonView<layout_blocked<CHUNK_BITS>, chunked_accessor<const Tile, CHUNK_BITS>, LargeDungeonExtents>;
+
+using MapChunk = std::array<Tile, std::size_t{1} << (2 * CHUNK_BITS)>;
 
 struct Dungeon
 {
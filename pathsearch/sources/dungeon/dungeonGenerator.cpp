@@ -1,9 +1,17 @@
 #include "dungeonGenerator.hpp"
 #include "dungeon/dungeon.hpp"
 #include "dungeonUtils.hpp"
+#include "walkableIndex.hpp"
+#include "assert.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <random>
 #include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <thread>
+#include <vector>
 #include <glm/glm.hpp>
 
 
@@ -11,11 +19,15 @@ namespace dungeon
 {
 
 void gen_drunk_dungeon(DungeonView view)
+{
+  gen_drunk_dungeon(view, unsigned(std::chrono::system_clock::now().time_since_epoch().count() % INT_MAX));
+}
+
+void gen_drunk_dungeon(DungeonView view, unsigned seed)
 {
   std::memset(view.data_handle(), Tile::Wall, view.size());
 
   // generator
-  unsigned seed = unsigned(std::chrono::system_clock::now().time_since_epoch().count() % INT_MAX);
   std::default_random_engine generator(seed);
 
   // distributions
@@ -74,9 +86,12 @@ void gen_drunk_dungeon(DungeonView view)
 
   const std::size_t maxSpills = 5;
 
+  // Spills only ever take floor away, the index follows them
+  WalkableIndex walkable{view};
+
   for (std::size_t iter = 0; iter < numIter; ++iter)
   {
-    glm::ivec2 p = dungeon::find_walkable_tile(view);
+    glm::ivec2 p = walkable.sample(generator);
 
     std::size_t numSpills = 0;
     while (numSpills < maxSpills)
@@ -85,6 +100,7 @@ void gen_drunk_dungeon(DungeonView view)
       {
         numSpills++;
         view(p.y, p.x) = Tile::Water;
+        walkable.update(p, Tile::Water);
       }
       // choose random dir
       bool validDir = false;
@@ -103,4 +119,218 @@ void gen_drunk_dungeon(DungeonView view)
   }
 }
 
+
+// Independent streams for neighbouring chunk indices
+static std::uint64_t splitmix64(std::uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Runs fn(chunk) for every chunk index on a pool of threads, chunks are handed out one at a time
+template<class F>
+static void forEachChunk(std::size_t count, unsigned threads, F&& fn)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = static_cast<unsigned>(std::min<std::size_t>(threads, count));
+
+  std::atomic<std::size_t> next{0};
+  std::vector<std::jthread> workers;
+  workers.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i)
+    workers.emplace_back([&fn, &next, count]()
+      {
+        for (auto chunk = next++; chunk < count; chunk = next++)
+          fn(chunk);
+      });
+}
+
+// Four directions per two bits, a single draw lasts for 32 steps
+class DirectionStream
+{
+ public:
+  explicit DirectionStream(std::mt19937_64& engine) : engine_{engine} {}
+
+  glm::ivec2 next()
+  {
+    constexpr std::array DIRS{glm::ivec2{1, 0}, glm::ivec2{0, 1}, glm::ivec2{-1, 0}, glm::ivec2{0, -1}};
+    if (left_ == 0)
+    {
+      bits_ = engine_();
+      left_ = 32;
+    }
+    const auto dir = DIRS[bits_ & 3];
+    bits_ >>= 2;
+    --left_;
+    return dir;
+  }
+
+ private:
+  std::mt19937_64& engine_;
+  std::uint64_t bits_{0};
+  int left_{0};
+};
+
+void gen_chunked_dungeon(DungeonView view, const ChunkedDungeonParams& params)
+{
+  const glm::ivec2 size{view.extent(1), view.extent(0)};
+  NG_ASSERT(size.x >= 3 && size.y >= 3 && params.chunkSize >= 3);
+
+  const glm::ivec2 chunks = glm::max(size / params.chunkSize, glm::ivec2{1, 1});
+  const auto chunkCount = static_cast<std::size_t>(chunks.x) * chunks.y;
+  auto chunkBounds = [&](glm::ivec2 chunk)
+    {
+      const auto min = chunk * params.chunkSize;
+      // The last chunk of a row or column takes the remainder
+      const auto max = glm::ivec2{
+        chunk.x + 1 == chunks.x ? size.x : min.x + params.chunkSize,
+        chunk.y + 1 == chunks.y ? size.y : min.y + params.chunkSize};
+      return std::make_pair(min, max);
+    };
+  auto chunkCenter = [&](glm::ivec2 chunk)
+    {
+      const auto[min, max] = chunkBounds(chunk);
+      return (min + max) / 2;
+    };
+
+  forEachChunk(chunkCount, params.threads, [&](std::size_t index)
+    {
+      const glm::ivec2 chunk{static_cast<int>(index % chunks.x), static_cast<int>(index / chunks.x)};
+      const auto[min, max] = chunkBounds(chunk);
+
+      for (int y = min.y; y < max.y; ++y)
+        std::memset(&view(y, min.x), Tile::Wall, max.x - min.x);
+
+      std::mt19937_64 engine{splitmix64(params.seed ^ splitmix64(index))};
+      DirectionStream dirs{engine};
+
+      // A one tile wall border keeps neighbouring chunks apart until they are stitched
+      const auto lo = min + 1;
+      const auto hi = max - 2;
+      const auto center = chunkCenter(chunk);
+
+      const auto interior = static_cast<std::size_t>(hi.x - lo.x + 1) * (hi.y - lo.y + 1);
+      const auto perWalker = static_cast<std::size_t>(interior * params.floorShare / std::max(1, params.walkersPerChunk));
+      // Random walks revisit a lot, still they must not run forever on tiny chunks
+      const auto maxSteps = 64 * perWalker + 64;
+
+      std::vector<glm::ivec2> floor;
+      for (int walker = 0; walker < params.walkersPerChunk; ++walker)
+      {
+        auto p = center;
+        std::size_t dug = 0;
+        for (std::size_t step = 0; dug < perWalker && step < maxSteps; ++step)
+        {
+          if (view(p.y, p.x) == Tile::Wall)
+          {
+            view(p.y, p.x) = Tile::Floor;
+            floor.push_back(p);
+            ++dug;
+          }
+          p = glm::clamp(p + dirs.next(), lo, hi);
+        }
+      }
+      if (view(center.y, center.x) == Tile::Wall)
+      {
+        view(center.y, center.x) = Tile::Floor;
+        floor.push_back(center);
+      }
+
+      // Water spreads over walkable tiles only, so it never cuts the chunk apart
+      for (int spill = 0; spill < params.spillsPerChunk && !floor.empty(); ++spill)
+      {
+        auto p = floor[std::uniform_int_distribution<std::size_t>(0, floor.size() - 1)(engine)];
+        int spilled = 0;
+        for (int step = 0; spilled < params.spillSize && step < 64 * params.spillSize; ++step)
+        {
+          if (view(p.y, p.x) == Tile::Floor)
+          {
+            view(p.y, p.x) = Tile::Water;
+            ++spilled;
+          }
+          const auto next = glm::clamp(p + dirs.next(), lo, hi);
+          if (view(next.y, next.x) != Tile::Wall)
+            p = next;
+        }
+      }
+    });
+
+  // Corridors between the centers of neighbouring chunks, they only dig through walls
+  auto dig = [&](glm::ivec2 from, glm::ivec2 to)
+    {
+      for (int x = std::min(from.x, to.x); x <= std::max(from.x, to.x); ++x)
+        if (view(from.y, x) == Tile::Wall)
+          view(from.y, x) = Tile::Floor;
+      for (int y = std::min(from.y, to.y); y <= std::max(from.y, to.y); ++y)
+        if (view(y, to.x) == Tile::Wall)
+          view(y, to.x) = Tile::Floor;
+    };
+
+  for (int y = 0; y < chunks.y; ++y)
+    for (int x = 0; x < chunks.x; ++x)
+    {
+      const auto center = chunkCenter({x, y});
+      if (x + 1 < chunks.x)
+        dig(center, chunkCenter({x + 1, y}));
+      if (y + 1 < chunks.y)
+        dig(center, chunkCenter({x, y + 1}));
+    }
+}
+
+void gen_world_chunk(DungeonView view, glm::ivec2 chunk, std::uint64_t seed, int doorsPerSide)
+{
+  const glm::ivec2 size{view.extent(1), view.extent(0)};
+  NG_ASSERT(size.x >= 3 && size.y >= 3);
+
+  // Chunk coordinates may be negative
+  auto pack = [](glm::ivec2 v) { return std::uint64_t{static_cast<std::uint32_t>(v.x)} << 32 | static_cast<std::uint32_t>(v.y); };
+  gen_drunk_dungeon(view, static_cast<unsigned>(splitmix64(seed ^ splitmix64(pack(chunk)))));
+
+  // Every floor tile of a drunk dungeon is connected to every other, doors dig towards the most central one
+  const auto center = size / 2;
+  glm::ivec2 target = center;
+  int closest = std::numeric_limits<int>::max();
+  for (int y = 1; y < size.y - 1; ++y)
+    for (int x = 1; x < size.x - 1; ++x)
+      if (view(y, x) != Tile::Wall && std::abs(x - center.x) + std::abs(y - center.y) < closest)
+      {
+        closest = std::abs(x - center.x) + std::abs(y - center.y);
+        target = {x, y};
+      }
+
+  auto dig = [&](glm::ivec2 door, glm::ivec2 inward)
+    {
+      view(door.y, door.x) = Tile::Floor;
+      // Off the border first, the rest stays inside and stops at the first walkable tile
+      for (auto p = door + inward; view(p.y, p.x) == Tile::Wall;)
+      {
+        view(p.y, p.x) = Tile::Floor;
+        const auto delta = target - p;
+        if (std::abs(delta.x) > std::abs(delta.y))
+          p.x += delta.x > 0 ? 1 : -1;
+        else
+          p.y += delta.y > 0 ? 1 : -1;
+      }
+    };
+
+  // A border is named by the chunk left of or above it, both chunks on it draw the same doors
+  auto doorOffset = [&](glm::ivec2 owner, int axis, int door)
+    {
+      const auto length = axis == 0 ? size.y : size.x;
+      const auto hash = splitmix64(seed ^ splitmix64(pack(owner) ^ splitmix64(static_cast<std::uint64_t>(2 * door + axis))));
+      return 1 + static_cast<int>(hash % static_cast<std::uint64_t>(length - 2));
+    };
+
+  for (int door = 0; door < doorsPerSide; ++door)
+  {
+    dig({0, doorOffset(chunk - glm::ivec2{1, 0}, 0, door)}, {1, 0});
+    dig({size.x - 1, doorOffset(chunk, 0, door)}, {-1, 0});
+    dig({doorOffset(chunk - glm::ivec2{0, 1}, 1, door), 0}, {0, 1});
+    dig({doorOffset(chunk, 1, door), size.y - 1}, {0, -1});
+  }
+}
+
 }
@@ -2,11 +2,42 @@
 
 #include "dungeon.hpp"
 #include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
 
 
 namespace dungeon
 {
 
+// Seeded from the clock, the overload gives the same map for the same seed
 void gen_drunk_dungeon(DungeonView view);
+void gen_drunk_dungeon(DungeonView view, unsigned seed);
+
+// Everything but the seed is per chunk, so the amount of work scales with the map
+struct ChunkedDungeonParams
+{
+  std::uint64_t seed{0};
+  // Maps are split into squares of at least this side, the remainder goes to the last row and column
+  int chunkSize{64};
+  int walkersPerChunk{4};
+  // Share of a chunk the walkers dig out before they stop
+  float floorShare{0.35f};
+  int spillsPerChunk{1};
+  int spillSize{5};
+  // 0 means one per hardware thread
+  unsigned threads{0};
+};
+
+// Drunk walks like gen_drunk_dungeon, but every chunk is dug on its own with an RNG
+// seeded from (seed, chunk), so chunks run in parallel and the map only depends on the seed.
+// Walkers in a chunk start at its center and stay off its border,
+// afterwards every center is joined to its right and bottom neighbours by corridors.
+void gen_chunked_dungeon(DungeonView view, const ChunkedDungeonParams& params = {});
+
+// One chunk of an endless world, the same for the same (seed, chunk) however often it is made.
+// gen_drunk_dungeon seeded from both, then doorsPerSide corridors from every side into its floor.
+// Doors only depend on the seed and the border they are on, so a chunk and its neighbour put
+// them in the same places and meet there without either knowing about the other.
+void gen_world_chunk(DungeonView view, glm::ivec2 chunk, std::uint64_t seed, int doorsPerSide = 2);
 
 }
@@ -1,4 +1,6 @@
 #include "dungeonUtils.hpp"
+#include "assert.hpp"
+#include <cstddef>
 #include <vector>
 #include <random>
 
@@ -10,16 +12,16 @@ glm::ivec2 find_walkable_tile(DungeonView view)
 {
   static std::default_random_engine engine;
 
-  // prebuild all walkable and get one of them
-  std::vector<glm::ivec2> posList;
-
+  // Reservoir sampling: one pass and no list of every floor tile, each is equally likely
+  glm::ivec2 result{-1, -1};
+  std::size_t seen = 0;
   for (int y = 0; y < view.extent(0); ++y)
     for (int x = 0; x < view.extent(1); ++x)
-      if (view(y, x) == Tile::Floor)
-        posList.push_back(glm::ivec2{x, y});
+      if (view(y, x) == Tile::Floor && std::uniform_int_distribution<std::size_t>(0, seen++)(engine) == 0)
+        result = glm::ivec2{x, y};
 
-  std::uniform_int_distribution<> distr(0, posList.size() - 1);
-  return posList[distr(engine)];
+  NG_ASSERT(seen > 0);
+  return result;
 }
 
 bool is_tile_walkable(DungeonView view, glm::ivec2 pos)
@@ -34,9 +36,9 @@ Dungeon make_dungeon(int width, int height)
 {
   Dungeon result
     {
-      .data = std::vector<Tile>(width * height),
+      .data = std::vector<Tile>(static_cast<std::size_t>(width) * height),
     };
-  result.view = DungeonView(result.data.data(), width, height);
+  result.view = DungeonView(result.data.data(), height, width);
   return result;
 }
 
@@ -7,6 +7,7 @@
 namespace dungeon
 {
 
+// A scan of the whole map, use a WalkableIndex to draw many tiles
 glm::ivec2 find_walkable_tile(DungeonView view);
 bool is_tile_walkable(DungeonView view, glm::ivec2 pos);
 Dungeon make_dungeon(int width, int height);
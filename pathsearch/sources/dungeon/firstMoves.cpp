@@ -0,0 +1,229 @@
+#include "firstMoves.hpp"
+#include "dungeon/bestFirst.hpp"
+#include "dungeon/grid.hpp"
+#include "assert.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <thread>
+#include <vector>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+// Map-sized, but only the touched tiles are reset between sources
+class TileDists
+{
+ public:
+  explicit TileDists(DungeonView dungeon) : width_{dungeon.extent(1)}, dists_(dungeon.size(), INF) {}
+
+  float get(glm::ivec2 v) const { return dists_[index(v)]; }
+  void set(glm::ivec2 v, float dist)
+  {
+    if (dists_[index(v)] == INF)
+      touched_.push_back(v);
+    dists_[index(v)] = dist;
+  }
+
+  const std::vector<glm::ivec2>& touched() const { return touched_; }
+
+  void reset()
+  {
+    for (auto v : touched_)
+      dists_[index(v)] = INF;
+    touched_.clear();
+  }
+
+ private:
+  std::size_t index(glm::ivec2 v) const { return static_cast<std::size_t>(v.y) * width_ + v.x; }
+
+  int width_;
+  std::vector<float> dists_;
+  std::vector<glm::ivec2> touched_;
+};
+
+struct SettleOrder : SearchHooks<glm::ivec2, float>
+{
+  std::vector<glm::ivec2> settled;
+
+  void expanded(glm::ivec2 v) { settled.push_back(v); }
+};
+
+// Bit per move, including NO_MOVE
+constexpr std::uint8_t ANY_MOVE = (1 << (FirstMoveDatabase::NO_MOVE + 1)) - 1;
+
+// Scratch space of one thread
+class SourceRuns
+{
+ public:
+  explicit SourceRuns(DungeonView dungeon)
+    : dungeon_{dungeon}, dists_{dungeon}, moves_(dungeon.size(), 0)
+  {
+  }
+
+  // Dijkstra from the source, then the set of optimal first moves of every tile
+  // follows from its optimal predecessors, in the order they were settled
+  std::vector<std::uint32_t> build(glm::ivec2 source, const std::vector<glm::ivec2>& targets)
+  {
+    const GridGraph<DungeonView, FourConnected, FloatCost> graph{dungeon_, nullptr};
+    hooks_.settled.clear();
+    open_.clear();
+    dists_.set(source, 0);
+    open_.push(0.f, source);
+    ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+    bestFirst(graph, ZeroHeuristic<FloatCost>{}, open_, dists_, hooks_, unlimited, nullptr);
+
+    for (auto v : hooks_.settled)
+    {
+      if (v == source)
+        continue;
+      std::uint8_t moves = 0;
+      for (std::uint8_t dir = 0; dir < 4; ++dir)
+      {
+        // Stepping back along dir from v. Weights are small integers, so the sums are exact.
+        const auto previous = v - steps::OFFSETS[dir];
+        if (!isPassable(dungeon_, previous) || dists_.get(previous) + weight(dungeon_, previous, v) != dists_.get(v))
+          continue;
+        moves |= previous == source ? std::uint8_t(1 << dir) : moves_[index(previous)];
+      }
+      moves_[index(v)] = moves;
+    }
+
+    // Greedy runs: a run goes on while some move is optimal for all of its targets
+    std::vector<std::uint32_t> runs;
+    std::uint8_t current = 0;
+    for (std::uint32_t t = 0; t < targets.size(); ++t)
+    {
+      const auto target = targets[t];
+      const std::uint8_t allowed = target == source ? ANY_MOVE
+        : dists_.get(target) >= INF ? std::uint8_t(1 << FirstMoveDatabase::NO_MOVE)
+        : moves_[index(target)];
+      if ((current & allowed) == 0)
+      {
+        if (!runs.empty())
+          runs.back() |= std::countr_zero(current);
+        runs.push_back(t << FirstMoveDatabase::MOVE_BITS);
+        current = allowed;
+      }
+      else
+      {
+        current &= allowed;
+      }
+    }
+    if (!runs.empty())
+      runs.back() |= std::countr_zero(current);
+
+    for (auto v : dists_.touched())
+      moves_[index(v)] = 0;
+    dists_.reset();
+    return runs;
+  }
+
+ private:
+  std::size_t index(glm::ivec2 v) const { return static_cast<std::size_t>(v.y) * dungeon_.extent(1) + v.x; }
+
+  DungeonView dungeon_;
+  TileDists dists_;
+  BinaryHeap<float, glm::ivec2> open_;
+  SettleOrder hooks_;
+  // Bit per optimal first move
+  std::vector<std::uint8_t> moves_;
+};
+
+}
+
+std::optional<glm::ivec2> FirstMoveDatabase::nextStep(glm::ivec2 from, glm::ivec2 to) const
+{
+  const auto source = order(from);
+  const auto target = order(to);
+  if (source == NONE || target == NONE || source == target)
+    return std::nullopt;
+
+  const auto sourceRuns = runs.span().subspan(firstRun[source], firstRun[source + 1] - firstRun[source]);
+  // The last run starting at or before the target
+  const auto it = std::upper_bound(sourceRuns.begin(), sourceRuns.end(), (target << MOVE_BITS) | MOVE_MASK);
+  NG_ASSERT(it != sourceRuns.begin());
+
+  const auto move = *std::prev(it) & MOVE_MASK;
+  if (move == NO_MOVE)
+    return std::nullopt;
+  return from + steps::OFFSETS[move];
+}
+
+CompressedPath FirstMoveDatabase::path(glm::ivec2 from, glm::ivec2 to) const
+{
+  CompressedPath result;
+  if (order(from) == NONE || order(to) == NONE)
+    return result;
+
+  result.push_back(from);
+  for (auto current = from; current != to;)
+  {
+    const auto next = nextStep(current, to);
+    if (!next)
+      return {};
+    result.push_back(*next);
+    current = *next;
+  }
+  return result;
+}
+
+FirstMoveDatabase buildFirstMoves(DungeonView dungeon, unsigned threads, SearchStats* stats)
+{
+  PhaseTimer timer{stats, Phase::Total};
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  FirstMoveDatabase result{.width = dungeon.extent(1), .height = dungeon.extent(0)};
+
+  // Targets along the Z-order curve, close targets get close numbers
+  std::vector<glm::ivec2> targets;
+  for (int y = 0; y < result.height; ++y)
+    for (int x = 0; x < result.width; ++x)
+      if (dungeon(y, x) != Tile::Wall)
+        targets.push_back({x, y});
+  const layout_morton::mapping<DungeonExtents> morton{dungeon.extents()};
+  std::sort(targets.begin(), targets.end(), [&morton](glm::ivec2 a, glm::ivec2 b) { return morton(a.y, a.x) < morton(b.y, b.x); });
+  NG_ASSERT(targets.size() < (std::size_t{1} << (32 - FirstMoveDatabase::MOVE_BITS)));
+
+  std::vector<std::uint32_t> orderOf(dungeon.size(), FirstMoveDatabase::NONE);
+  for (std::uint32_t t = 0; t < targets.size(); ++t)
+    orderOf[static_cast<std::size_t>(targets[t].y) * result.width + targets[t].x] = t;
+
+  // Sources are handed out one at a time, their Dijkstras vary a lot in size
+  std::vector<std::vector<std::uint32_t>> runs(targets.size());
+  std::atomic<std::size_t> next{0};
+  {
+    std::vector<std::jthread> workers;
+    workers.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i)
+      workers.emplace_back([&]()
+        {
+          SourceRuns scratch{dungeon};
+          for (auto s = next++; s < targets.size(); s = next++)
+            runs[s] = scratch.build(targets[s], targets);
+        });
+  }
+
+  std::vector<std::uint64_t> firstRun{0};
+  firstRun.reserve(targets.size() + 1);
+  std::vector<std::uint32_t> flat;
+  for (auto& sourceRuns : runs)
+  {
+    flat.insert(flat.end(), sourceRuns.begin(), sourceRuns.end());
+    firstRun.push_back(flat.size());
+    sourceRuns = {};
+  }
+
+  result.orderOf = SharedArray{std::move(orderOf)};
+  result.firstRun = SharedArray{std::move(firstRun)};
+  result.runs = SharedArray{std::move(flat)};
+  return result;
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "compressedPath.hpp"
+#include "searchStats.hpp"
+#include "sharedArray.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// Compressed path database (Botea, Strasser et al.): for every walkable source tile,
+// an optimal first move towards every walkable target, so agents that only need their
+// next step pay one lookup per tick. Targets are numbered along a Z-order curve,
+// nearby targets mostly share their first move, and the moves of a source are
+// stored as runs over that order. Targets with several optimal moves take whichever
+// keeps the current run going. Meant for maps that never change, overlays are ignored.
+struct FirstMoveDatabase
+{
+  static constexpr std::uint32_t NONE = static_cast<std::uint32_t>(-1);
+  // Moves 0-3 index steps::OFFSETS
+  static constexpr std::uint32_t MOVE_BITS = 3;
+  static constexpr std::uint32_t MOVE_MASK = (1 << MOVE_BITS) - 1;
+  // The target is unreachable
+  static constexpr std::uint32_t NO_MOVE = 4;
+
+  int width{0};
+  int height{0};
+  // Row-major, the place of the tile in the target order, NONE for walls
+  SharedArray<std::uint32_t> orderOf;
+  // Runs of source s are runs[firstRun[s], firstRun[s + 1]), s is its place in the target order.
+  // Every run holds (first target << MOVE_BITS) | move and lasts until the next one.
+  SharedArray<std::uint64_t> firstRun;
+  SharedArray<std::uint32_t> runs;
+
+  std::uint32_t order(glm::ivec2 v) const
+  {
+    return v.x >= 0 && v.y >= 0 && v.x < width && v.y < height ? orderOf[static_cast<std::size_t>(v.y) * width + v.x] : NONE;
+  }
+
+  // Empty at the target itself and when there is no way
+  std::optional<glm::ivec2> nextStep(glm::ivec2 from, glm::ivec2 to) const;
+
+  // One lookup per tile, empty when there is no way
+  CompressedPath path(glm::ivec2 from, glm::ivec2 to) const;
+
+  std::size_t memoryBytes() const
+    { return orderOf.size() * sizeof(std::uint32_t) + firstRun.size() * sizeof(std::uint64_t) + runs.size() * sizeof(std::uint32_t); }
+};
+
+// A Dijkstra per source, sources are spread over the threads. threads == 0 means one per hardware thread.
+// Takes a few minutes for 512x512 maps, see saveFirstMoves to keep the result.
+FirstMoveDatabase buildFirstMoves(DungeonView dungeon, unsigned threads = 0, SearchStats* stats = nullptr);
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "overlay.hpp"
+#include <array>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// Step cost on top of the euclidean distance for entering or leaving water
+constexpr float WATER_PENALTY = 5;
+
+template<class Extents>
+bool inBounds(glm::ivec2 v, const Extents& extents)
+{
+  return v.x >= 0 && v.y >= 0 && v.x < extents.extent(1) && v.y < extents.extent(0);
+}
+
+// Everything below works with any BasicDungeonView layout, the overlay is optional
+
+template<class View>
+bool isPassable(View view, glm::ivec2 v, const ObstacleOverlay* overlay = nullptr)
+{
+  return inBounds(v, view.extents()) && view(v.y, v.x) != Tile::Wall && (overlay == nullptr || !overlay->blocked(v));
+}
+
+inline float ivecDist(glm::ivec2 a, glm::ivec2 b)
+{
+  return glm::length(glm::vec2{a - b});
+}
+
+// Overlay costs are charged for entering b, so the order matters once there is an overlay
+template<class View>
+float weight(View view, glm::ivec2 a, glm::ivec2 b, const ObstacleOverlay* overlay = nullptr)
+{
+  return ivecDist(a, b)
+    + (view(a.y, a.x) == Tile::Water || view(b.y, b.x) == Tile::Water ? WATER_PENALTY : 0)
+    + (overlay != nullptr ? overlay->extraCost(b) : 0);
+}
+
+template<class View>
+auto successorsFor(glm::ivec2 v, View dungeon, const ObstacleOverlay* overlay = nullptr)
+{
+  std::vector<glm::ivec2> result;
+  result.reserve(4);
+  for (auto offset : std::array{
+    glm::ivec2{0, 1}, glm::ivec2{0, -1}, glm::ivec2{1, 0}, glm::ivec2{-1, 0}})
+  {
+    auto successor = v + offset;
+    if (!isPassable(dungeon, successor, overlay))
+      continue;
+    result.push_back(successor);
+  }
+  return result;
+}
+
+}
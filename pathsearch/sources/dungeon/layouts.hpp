@@ -0,0 +1,180 @@
+#pragma once
+
+#include "assert.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <experimental/mdspan>
+#include <experimental/mdarray>
+
+
+namespace dungeon
+{
+
+// Layout policies for 2D grids indexed as (y, x). With layout_right a vertical
+// step is a whole row away in memory, these keep square neighbourhoods close.
+// Both pad the storage, so mdarrays using them are not exhaustive.
+
+// Row-major 2^BlockBits x 2^BlockBits blocks, each stored row-major
+template<int BlockBits>
+struct layout_blocked
+{
+  template<class Extents>
+  class mapping
+  {
+   public:
+    static_assert(Extents::rank() == 2);
+
+    using extents_type = Extents;
+    using index_type = typename Extents::index_type;
+    using size_type = typename Extents::size_type;
+    using rank_type = typename Extents::rank_type;
+    using layout_type = layout_blocked;
+
+    static constexpr index_type BLOCK = index_type{1} << BlockBits;
+    static constexpr index_type MASK = BLOCK - 1;
+
+    constexpr mapping() = default;
+    constexpr mapping(const Extents& extents)
+      : extents_{extents}
+      , blocksX_{(extents.extent(1) + MASK) >> BlockBits}
+      , blocksY_{(extents.extent(0) + MASK) >> BlockBits}
+    {
+    }
+
+    constexpr const extents_type& extents() const { return extents_; }
+
+    constexpr index_type operator()(index_type y, index_type x) const
+    {
+      return (((y >> BlockBits) * blocksX_ + (x >> BlockBits)) << (2 * BlockBits)) | ((y & MASK) << BlockBits) | (x & MASK);
+    }
+
+    constexpr index_type required_span_size() const { return (blocksX_ * blocksY_) << (2 * BlockBits); }
+
+    static constexpr bool is_always_unique() { return true; }
+    static constexpr bool is_always_exhaustive() { return false; }
+    static constexpr bool is_always_strided() { return false; }
+    static constexpr bool is_unique() { return true; }
+    constexpr bool is_exhaustive() const { return required_span_size() == extents_.extent(0) * extents_.extent(1); }
+    static constexpr bool is_strided() { return false; }
+
+    friend constexpr bool operator==(const mapping& a, const mapping& b) { return a.extents_ == b.extents_; }
+
+   private:
+    extents_type extents_{};
+    index_type blocksX_{0};
+    index_type blocksY_{0};
+  };
+};
+
+// Z-order curve over the grid padded to powers of two. On non-square grids
+// the low bits of both axes are interleaved and the longer axis keeps its high bits on top.
+struct layout_morton
+{
+  template<class Extents>
+  class mapping
+  {
+   public:
+    static_assert(Extents::rank() == 2);
+
+    using extents_type = Extents;
+    using index_type = typename Extents::index_type;
+    using size_type = typename Extents::size_type;
+    using rank_type = typename Extents::rank_type;
+    using layout_type = layout_morton;
+
+    constexpr mapping() = default;
+    constexpr mapping(const Extents& extents)
+      : extents_{extents}
+      , bitsX_{static_cast<int>(std::bit_width(static_cast<std::uint64_t>(std::max<index_type>(extents.extent(1), 1) - 1)))}
+      , bitsY_{static_cast<int>(std::bit_width(static_cast<std::uint64_t>(std::max<index_type>(extents.extent(0), 1) - 1)))}
+      , shared_{std::min(bitsX_, bitsY_)}
+    {
+    }
+
+    constexpr const extents_type& extents() const { return extents_; }
+
+    constexpr index_type operator()(index_type y, index_type x) const
+    {
+      const auto ux = static_cast<std::uint64_t>(x);
+      const auto uy = static_cast<std::uint64_t>(y);
+      const auto mask = (std::uint64_t{1} << shared_) - 1;
+      const auto high = bitsX_ > bitsY_ ? ux >> shared_ : uy >> shared_;
+      return static_cast<index_type>((high << (2 * shared_)) | spread(ux & mask) | (spread(uy & mask) << 1));
+    }
+
+    constexpr index_type required_span_size() const
+    {
+      return extents_.extent(0) == 0 || extents_.extent(1) == 0 ? 0 : index_type{1} << (bitsX_ + bitsY_);
+    }
+
+    static constexpr bool is_always_unique() { return true; }
+    static constexpr bool is_always_exhaustive() { return false; }
+    static constexpr bool is_always_strided() { return false; }
+    static constexpr bool is_unique() { return true; }
+    constexpr bool is_exhaustive() const { return required_span_size() == extents_.extent(0) * extents_.extent(1); }
+    static constexpr bool is_strided() { return false; }
+
+    friend constexpr bool operator==(const mapping& a, const mapping& b) { return a.extents_ == b.extents_; }
+
+   private:
+    // Moves bit i to bit 2i, good for 32 bit coordinates
+    static constexpr std::uint64_t spread(std::uint64_t v)
+    {
+      v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+      v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+      v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+      v = (v | (v << 2)) & 0x3333333333333333ull;
+      v = (v | (v << 1)) & 0x5555555555555555ull;
+      return v;
+    }
+
+    extents_type extents_{};
+    int bitsX_{0};
+    int bitsY_{0};
+    int shared_{0};
+  };
+};
+
+// Accessor for layout_blocked grids whose blocks are separate allocations.
+// The data handle is a table of block pointers, so blocks can be shared between grids.
+template<class T, int BlockBits>
+struct chunked_accessor
+{
+  using offset_policy = chunked_accessor;
+  using element_type = T;
+  using reference = T&;
+  using data_handle_type = T* const*;
+
+  static constexpr std::size_t MASK = (std::size_t{1} << (2 * BlockBits)) - 1;
+
+  constexpr reference access(data_handle_type blocks, std::size_t i) const { return blocks[i >> (2 * BlockBits)][i & MASK]; }
+
+  // Only whole blocks can be skipped
+  data_handle_type offset(data_handle_type blocks, std::size_t i) const
+  {
+    NG_ASSERT((i & MASK) == 0);
+    return blocks + (i >> (2 * BlockBits));
+  }
+};
+
+// Element-wise copy between equally sized grids of any layouts
+template<class Src, class Dst>
+void copyGrid(const Src& src, const Dst& dst)
+{
+  NG_ASSERT(src.extent(0) == dst.extent(0) && src.extent(1) == dst.extent(1));
+  for (typename Src::index_type y = 0; y < src.extent(0); ++y)
+    for (typename Src::index_type x = 0; x < src.extent(1); ++x)
+      dst(y, x) = src(y, x);
+}
+
+template<class Layout, class View>
+auto relayout(const View& src)
+{
+  std::experimental::mdarray<typename View::value_type, typename View::extents_type, Layout> result(src.extents());
+  copyGrid(src, result.to_mdspan());
+  return result;
+}
+
+}
@@ -0,0 +1,125 @@
+#include "mapStore.hpp"
+#include "assert.hpp"
+#include "grid.hpp"
+
+#include <algorithm>
+
+
+namespace dungeon
+{
+
+static constexpr int CHUNK_SIZE = 1 << CHUNK_BITS;
+
+ChunkedDungeonView MapSnapshot::view() const
+{
+  return ChunkedDungeonView{chunkTable_.data(), ChunkedDungeonView::mapping_type{DungeonExtents{height_, width_}}};
+}
+
+MapStore::MapStore(DungeonView initial)
+  : width_{initial.extent(1)}
+  , height_{initial.extent(0)}
+  , chunksX_{(width_ + CHUNK_SIZE - 1) / CHUNK_SIZE}
+{
+  const int chunksY = (height_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  draft_.reserve(static_cast<std::size_t>(chunksX_) * chunksY);
+  for (int cy = 0; cy < chunksY; ++cy)
+    for (int cx = 0; cx < chunksX_; ++cx)
+    {
+      // Padding past the map edge reads as wall
+      auto chunk = std::make_shared<MapChunk>();
+      chunk->fill(Tile::Wall);
+      for (int y = 0; y < CHUNK_SIZE && cy * CHUNK_SIZE + y < height_; ++y)
+        for (int x = 0; x < CHUNK_SIZE && cx * CHUNK_SIZE + x < width_; ++x)
+          (*chunk)[y * CHUNK_SIZE + x] = initial(cy * CHUNK_SIZE + y, cx * CHUNK_SIZE + x);
+      draft_.push_back(std::move(chunk));
+    }
+  draftOwned_.assign(draft_.size(), false);
+
+  // Epoch 0 is the initial map
+  publishDraft();
+}
+
+std::size_t MapStore::chunkIndex(glm::ivec2 pos) const
+{
+  return static_cast<std::size_t>(pos.y / CHUNK_SIZE) * chunksX_ + pos.x / CHUNK_SIZE;
+}
+
+Tile MapStore::get(glm::ivec2 pos) const
+{
+  NG_ASSERT(inBounds(pos, DungeonExtents{height_, width_}));
+  return (*draft_[chunkIndex(pos)])[(pos.y % CHUNK_SIZE) * CHUNK_SIZE + pos.x % CHUNK_SIZE];
+}
+
+void MapStore::set(glm::ivec2 pos, Tile tile)
+{
+  NG_ASSERT(inBounds(pos, DungeonExtents{height_, width_}));
+  const auto index = chunkIndex(pos);
+  const auto offset = (pos.y % CHUNK_SIZE) * CHUNK_SIZE + pos.x % CHUNK_SIZE;
+  if ((*draft_[index])[offset] == tile)
+    return;
+
+  // Published snapshots share this chunk, give the draft its own copy first
+  if (!draftOwned_[index])
+  {
+    draft_[index] = std::make_shared<MapChunk>(*draft_[index]);
+    draftOwned_[index] = true;
+  }
+  (*draft_[index])[offset] = tile;
+  draftChanges_.push_back(pos);
+}
+
+std::uint64_t MapStore::publish()
+{
+  if (draftChanges_.empty())
+    return epoch_;
+
+  ++epoch_;
+  publishDraft();
+  pruneRetired();
+  return epoch_;
+}
+
+void MapStore::publishDraft()
+{
+  auto snapshot = std::make_shared<MapSnapshot>();
+  snapshot->epoch_ = epoch_;
+  snapshot->width_ = width_;
+  snapshot->height_ = height_;
+  snapshot->chunks_.assign(draft_.begin(), draft_.end());
+  snapshot->chunkTable_.reserve(draft_.size());
+  for (const auto& chunk : snapshot->chunks_)
+    snapshot->chunkTable_.push_back(chunk->data());
+  snapshot->changes_ = std::move(draftChanges_);
+  draftChanges_.clear();
+
+  // From now on the snapshot shares every chunk of the draft
+  std::fill(draftOwned_.begin(), draftOwned_.end(), false);
+
+  retired_.push_back({epoch_, snapshot});
+  // Swapped, so that the previous version is released outside the lock
+  std::shared_ptr<const MapSnapshot> previous = std::move(snapshot);
+  {
+    std::lock_guard lock{publishedMutex_};
+    published_.swap(previous);
+  }
+}
+
+void MapStore::pruneRetired()
+{
+  std::erase_if(retired_, [](const Published& p) { return p.snapshot.expired(); });
+}
+
+std::uint64_t MapStore::oldestPinnedEpoch()
+{
+  pruneRetired();
+  // The latest version is always pinned by the store itself
+  return retired_.empty() ? epoch_ : retired_.front().epoch;
+}
+
+std::size_t MapStore::pinnedEpochs()
+{
+  pruneRetired();
+  return retired_.size();
+}
+
+}
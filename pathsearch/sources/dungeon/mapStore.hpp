@@ -0,0 +1,103 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// One published version of the map. Never changes after publishing, so any
+// number of threads can search view() without locking. Holding the shared_ptr
+// pins the epoch: its chunks stay alive however many versions come after it.
+class MapSnapshot
+{
+ public:
+  std::uint64_t epoch() const { return epoch_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  ChunkedDungeonView view() const;
+
+  // Tiles edited since the previous epoch, e.g. for DStarLite::tileChanged or updateComponents
+  std::span<const glm::ivec2> changes() const { return changes_; }
+
+ private:
+  friend class MapStore;
+
+  std::uint64_t epoch_{0};
+  int width_{0};
+  int height_{0};
+  std::vector<std::shared_ptr<const MapChunk>> chunks_;
+  // Same chunks as raw pointers, the data handle of view()
+  std::vector<const Tile*> chunkTable_;
+  std::vector<glm::ivec2> changes_;
+};
+
+// Versioned, thread-safe home of a map.
+// A single writer edits a draft and publishes it as the next snapshot, readers pin
+// the latest snapshot and never see a half-applied batch of edits.
+// Drafts copy a chunk on its first write after a publish, untouched chunks are shared
+// between all versions. Memory of an old epoch is reclaimed when its last reader lets go.
+class MapStore
+{
+ public:
+  explicit MapStore(DungeonView initial);
+
+  // Any thread. Keep the result alive for as long as its view is searched.
+  std::shared_ptr<const MapSnapshot> snapshot() const
+  {
+    std::lock_guard lock{publishedMutex_};
+    return published_;
+  }
+
+  // Writer thread only, reads and edits the unpublished draft
+  Tile get(glm::ivec2 pos) const;
+  void set(glm::ivec2 pos, Tile tile);
+
+  // Writer thread only. Returns the new epoch, or the current one if nothing was edited.
+  std::uint64_t publish();
+
+  // Writer thread only. Epochs older than this have been reclaimed,
+  // e.g. caches derived from the map can drop their versions below it.
+  std::uint64_t oldestPinnedEpoch();
+  std::size_t pinnedEpochs();
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+ private:
+  std::size_t chunkIndex(glm::ivec2 pos) const;
+  void publishDraft();
+  void pruneRetired();
+
+  int width_;
+  int height_;
+  int chunksX_;
+
+  // Only held to copy or swap the pointer. Not std::atomic<std::shared_ptr>, libc++ lacks it.
+  mutable std::mutex publishedMutex_;
+  std::shared_ptr<const MapSnapshot> published_;
+
+  std::vector<std::shared_ptr<MapChunk>> draft_;
+  // Chunks copied since the last publish, the only ones the draft may write in place
+  std::vector<bool> draftOwned_;
+  std::vector<glm::ivec2> draftChanges_;
+  std::uint64_t epoch_{0};
+
+  struct Published
+  {
+    std::uint64_t epoch;
+    std::weak_ptr<const MapSnapshot> snapshot;
+  };
+  // Versions someone might still read, oldest first
+  std::vector<Published> retired_;
+};
+
+}
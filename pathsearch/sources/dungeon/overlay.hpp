@@ -0,0 +1,52 @@
+#pragma once
+
+#include "assert.hpp"
+#include <limits>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+
+namespace dungeon
+{
+
+// Temporary blockers (agents, hazards) and extra step costs on top of the map.
+// Searches read it through SearchContext, the map and everything precomputed
+// from it stay untouched, so updating it every tick costs a hash map write per tile.
+class ObstacleOverlay
+{
+ public:
+  static constexpr float BLOCKED = std::numeric_limits<float>::infinity();
+
+  void block(glm::ivec2 v) { costs_.insert_or_assign(v, BLOCKED); }
+  // Charged for entering the tile, replaces the previous value.
+  // Never negative, the heuristics and the precomputed edge costs rely on that.
+  void setCost(glm::ivec2 v, float extraCost)
+  {
+    NG_VERIFY(extraCost >= 0);
+    costs_.insert_or_assign(v, extraCost);
+  }
+  void reset(glm::ivec2 v) { costs_.erase(v); }
+  void clear() { costs_.clear(); }
+
+  bool blocked(glm::ivec2 v) const { return extraCost(v) == BLOCKED; }
+
+  float extraCost(glm::ivec2 v) const
+  {
+    if (costs_.empty())
+      return 0;
+    auto it = costs_.find(v);
+    return it == costs_.end() ? 0 : it->second;
+  }
+
+  bool empty() const { return costs_.empty(); }
+  std::size_t size() const { return costs_.size(); }
+
+  auto begin() const { return costs_.begin(); }
+  auto end() const { return costs_.end(); }
+
+ private:
+  std::unordered_map<glm::ivec2, float> costs_;
+};
+
+}
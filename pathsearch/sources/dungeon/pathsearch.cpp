@@ -2,12 +2,16 @@
 #include "assert.hpp"
 #include "dungeon/dungeon.hpp"
 #include "dungeon/pathsearch.hpp"
+#include "dungeon/grid.hpp"
+#include "dungeon/bestFirst.hpp"
 #include "../glmFormatter.hpp"
 
 #include <algorithm>
 #include <unordered_set>
-#include <queue>
+#include <unordered_map>
 #include <map>
+#include <memory_resource>
+#include <optional>
 #include <spdlog/spdlog.h>
 #include <fmt/ranges.h>
 
@@ -15,121 +19,138 @@
 namespace dungeon
 {
 
-bool inBounds(glm::ivec2 v,
-  std::experimental::extents<int, std::experimental::dynamic_extent, std::experimental::dynamic_extent> extents)
+template<class View, class DistStore>
+static CompressedPath reconstructPath(View dungeon, const DistStore& dists, glm::ivec2 start, glm::ivec2 finish,
+  const SearchContext& context)
 {
-  return v.x >= 0 && v.y >= 0 && v.x < extents.extent(1) && v.y < extents.extent(0);
-}
-
-float ivecDist(glm::ivec2 a, glm::ivec2 b)
-{
-  return glm::length(glm::vec2{a - b});
-}
-
-float weight(DungeonView view, glm::ivec2 a, glm::ivec2 b)
-{
-  return ivecDist(a, b)
-    + (view(a.y, a.x) == Tile::Water || view(b.y, b.x) == Tile::Water ? 5 : 0);
-}
-
-auto successorsFor(glm::ivec2 v, DungeonView dungeon)
-{
-  std::vector<glm::ivec2> result;
-  result.reserve(4);
-  for (auto offset : std::array{
-    glm::ivec2{0, 1}, glm::ivec2{0, -1}, glm::ivec2{1, 0}, glm::ivec2{-1, 0}})
-  {
-    auto successor = v + offset;
-    if (!inBounds(successor, dungeon.extents())
-      || dungeon(successor.y, successor.x) == Tile::Wall)
-      continue;
-    result.push_back(successor);
-  }
-  return result;
-}
-
-static std::vector<glm::ivec2> reconstructPath(DungeonView dungeon, DistsView dists, glm::ivec2 start, glm::ivec2 finish)
-{
-  std::vector<glm::ivec2> result;
+  const auto* overlay = context.overlay;
+  CompressedPath result{context.resource()};
 
-  if (dists(finish.y, finish.x) != INF)
+  if (dists.get(finish) != INF)
   {
+    // Cheapest way back rather than an exact float match: araStar leaves the dists
+    // inconsistent, in which case no neighbour has to add up exactly
     glm::ivec2 current = finish;
     while (current != start)
     {
       glm::ivec2 best = current;
-      for (auto successor : successorsFor(current, dungeon))
+      float bestDist = INF;
+      for (auto successor : successorsFor(current, dungeon, overlay))
       {
-        if (dists(successor.y, successor.x) + weight(dungeon, current, successor) == dists(best.y, best.x))
+        const float dist = dists.get(successor) + weight(dungeon, successor, current, overlay);
+        if (dists.get(successor) < dists.get(current) && dist < bestDist)
+        {
           best = successor;
+          bestDist = dist;
+        }
       }
+      if (best == current)
+        return CompressedPath{context.resource()};
       result.push_back(current);
       current = best;
     }
     result.push_back(start);
   }
 
-  return result;
+  return result.reversed();
 }
 
-auto initAStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, float eps)
+template<class View, class DistStore>
+static SearchResult makeResult(View dungeon, const DistStore& dists, glm::ivec2 start, glm::ivec2 finish, const SearchContext& context)
 {
-  using Pair = std::pair<float, glm::ivec2>;
-
-  struct Comp
-  {
-    bool operator()(const Pair& a, const Pair& b)
-      { return a.first > b.first; }
-  };
-
-  std::priority_queue<Pair, std::vector<Pair>, Comp> queue(Comp{},
-    [&]()
-    {
-      std::vector<Pair> container;
-      container.reserve(dungeon.extent(0) * 4);
-      return container;
-    }());
-
-  Dists dists{dungeon.extents()};
-  std::fill_n(dists.data(),  dists.size(), INF);
+  SearchResult result{.path = reconstructPath(dungeon, dists, start, finish, context)};
+  if (context.output != SearchOutput::Path)
+    result.dist = dists.get(finish);
+  if (context.output == SearchOutput::Full)
+    result.dists = dists.toDists();
+  return result;
+}
 
+// The open list starts out sized for a frontier around the straight way to the finish,
+// not for the map, so Path and PathAndCost queries stay independent of the map size
+template<class Open, class DistStore, class View>
+static void startSearch(View dungeon, Open& open, DistStore& dists, glm::ivec2 start, glm::ivec2 finish, float startPriority,
+  SearchStats* stats)
+{
   if (inBounds(start, dungeon.extents()))
   {
-    queue.push({eps*ivecDist(start, finish), start});
-    dists(start.y, start.x) = 0;
+    const auto span = glm::abs(finish - start);
+    open.reserve((static_cast<std::size_t>(span.x) + static_cast<std::size_t>(span.y) + 1) * 4);
+    open.push(startPriority, start);
+    dists.set(start, 0);
+    count(stats, Counter::Pushes);
   }
-
-  return std::make_pair(std::move(queue), std::move(dists));
 }
 
-SearchResult aStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, float eps)
+static bool provablyUnreachable(const SearchContext& context, glm::ivec2 start, glm::ivec2 finish)
 {
-  auto[queue, dists] = initAStar(dungeon, start, finish, eps);
-
-  while (!queue.empty())
-  {
-    auto current = queue.top().second;
-    queue.pop();
+  return context.components != nullptr && start != finish && !connected(*context.components, start, finish);
+}
 
-    if (current == finish)
-      break;
+static SlicedSearch noPath()
+{
+  co_yield SearchSlice{.solution = true};
+}
 
-    auto dist = dists(current.y, current.x);
+// The blocking searches are their sliced versions with a budget that never runs out.
+// Move-constructed rather than assigned, so the path stays in the memory of the context.
+static SearchResult lastSolution(SlicedSearch search)
+{
+  std::optional<SearchResult> result;
+  for (auto&& slice : search)
+    if (slice.solution)
+      result.emplace(std::move(slice.result));
+  return result ? std::move(*result) : SearchResult{};
+}
 
-    for (auto successor : successorsFor(current, dungeon))
+template<class DistStore, class View>
+static SlicedSearch aStarImpl(View dungeon, glm::ivec2 start, glm::ivec2 finish, float eps, ExpansionBudget& budget,
+  SearchContext context)
+{
+  const GridGraph<View, FourConnected, FloatCost> graph{dungeon, context.overlay};
+  const EuclideanHeuristic<FloatCost> heuristic{finish, eps};
+  QuaternaryHeap<float, glm::ivec2> open{context.resource()};
+  DistStore dists{dungeon, context.resource()};
+  StopAtFinish<float> hooks{{}, finish};
+  startSearch(dungeon, open, dists, start, finish, heuristic(start), context.stats);
+
+  std::optional<SearchResult> result;
+  while (!result)
+  {
+    // Timers can't live across co_yield, the coroutine may never be resumed
     {
-      float successor_dist = dist + weight(dungeon, current, successor);
-      if (successor_dist < dists(successor.y, successor.x))
-      {
-        dists(successor.y, successor.x) = successor_dist;
-        queue.push({successor_dist + eps*ivecDist(successor, finish), successor});
-      }
+      PhaseTimer timer{context.stats, Phase::Total};
+      if (bestFirst(graph, heuristic, open, dists, hooks, budget, context.stats))
+        result = makeResult(dungeon, dists, start, finish, context);
     }
+
+    if (!result)
+      co_yield SearchSlice{};
   }
 
-  auto path = reconstructPath(dungeon, {dists.data(), dists.extents()}, start, finish);
+  // Named, gcc 12 destroys temporaries nested in a co_yield operand twice
+  SearchSlice solution{.solution = true, .result = std::move(*result)};
+  co_yield std::move(solution);
+}
 
-  return {std::move(path), std::move(dists)};
+template<class Layout, class Accessor, class Extents>
+SlicedSearch aStarSliced(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps,
+  ExpansionBudget& budget, SearchContext context)
+{
+  // DenseDists does not check bounds, an off-map finish would be read outside of it
+  if (!inBounds(finish, dungeon.extents()) || provablyUnreachable(context, start, finish))
+    return noPath();
+
+  return context.output == SearchOutput::Full
+    ? aStarImpl<DenseDists<Layout>>(dungeon, start, finish, eps, budget, context)
+    : aStarImpl<SparseDists<>>(dungeon, start, finish, eps, budget, context);
+}
+
+template<class Layout, class Accessor, class Extents>
+SearchResult aStar(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps, const SearchContext& context)
+{
+  ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+  return lastSolution(aStarSliced(dungeon, start, finish, eps, unlimited, context));
 }
 
 // SearchResult smaStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, float eps)
@@ -154,81 +175,161 @@ SearchResult aStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, flo
 
 
 
-std::experimental::generator<SearchResult> araStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, float eps)
+// ARA* expands every tile at most once per eps. Tiles improved after that are
+// set aside as inconsistent and only queued again for the next, smaller eps.
+template<class DistStore>
+struct AraStarHooks : SearchHooks<glm::ivec2, float>
 {
-  auto[open, dists] = initAStar(dungeon, start, finish, eps);
+  AraStarHooks(const DistStore& dists, glm::ivec2 finish, SearchStats* stats, std::pmr::memory_resource* memory)
+    : dists{dists}, finish{finish}, stats{stats}, closed{memory}, inconsistent{memory}
+  {
+  }
 
-  const auto fScore = [&eps, finish, &dists = dists](glm::ivec2 v) { return dists(v.y, v.x) + eps*ivecDist(v, finish); };
+  const DistStore& dists;
+  glm::ivec2 finish;
+  SearchStats* stats;
+  std::pmr::unordered_set<glm::ivec2> closed;
+  std::pmr::unordered_set<glm::ivec2> inconsistent;
 
-  for (;;)
+  // Nothing left on the open list can beat the path to the finish at this eps
+  bool done(float priority, glm::ivec2) const { return dists.get(finish) <= priority; }
+  void expanded(glm::ivec2 v) { closed.emplace(v); }
+  bool reopen(glm::ivec2 v)
   {
-    std::unordered_set<glm::ivec2> closed;
-    std::unordered_set<glm::ivec2> inconsistent;
-
-    while (!open.empty() && fScore(finish) > open.top().first)
-    {
-      const auto current = open.top().second;
-      open.pop();
+    if (!closed.contains(v))
+      return true;
+    inconsistent.emplace(v);
+    count(stats, Counter::Reopened);
+    return false;
+  }
+};
 
-      closed.emplace(current);
+template<class DistStore, class View>
+static SlicedSearch araStarImpl(View dungeon, glm::ivec2 start, glm::ivec2 finish, float eps, ExpansionBudget& budget,
+  SearchContext context)
+{
+  const GridGraph<View, FourConnected, FloatCost> graph{dungeon, context.overlay};
+  QuaternaryHeap<float, glm::ivec2> open{context.resource()};
+  DistStore dists{dungeon, context.resource()};
+  AraStarHooks<DistStore> hooks{dists, finish, context.stats, context.resource()};
+  startSearch(dungeon, open, dists, start, finish, eps*ivecDist(start, finish), context.stats);
 
-      for (auto successor : successorsFor(current, dungeon))
-      {
-        const float succDist = dists(current.y, current.x) + weight(dungeon, current, successor);
-        if (dists(successor.y, successor.x) > succDist)
-        {
-          dists(successor.y, successor.x) = succDist;
-          if (!closed.contains(successor))
-            open.emplace(fScore(successor), successor);
-          else
-            inconsistent.emplace(successor);
-        }
-      }
-    }
+  for (;;)
+  {
+    hooks.closed.clear();
+    hooks.inconsistent.clear();
+    const EuclideanHeuristic<FloatCost> heuristic{finish, eps};
 
+    for (;;)
     {
-      float minScore = INF;
+      bool finished = false;
+      // Timers can't live across co_yield, the coroutine may never be resumed
       {
-        // Could be im plemented in O(1) with hybrid data structures, but I'm too lazy
-        auto updateMin = [&minScore, &dists = dists, finish](auto& set)
-          {
-            for (const auto& v : set)
-              minScore = std::min(minScore, dists(v.y, v.x) + ivecDist(v, finish));
-          };
-        updateMin(closed);
-        updateMin(inconsistent);
+        PhaseTimer timer{context.stats, Phase::Total};
+        finished = bestFirst(graph, heuristic, open, dists, hooks, budget, context.stats);
       }
-      float epsPrime = std::min(eps, dists(finish.y, finish.x)/minScore);
 
-      if (epsPrime <= 1)
+      if (finished)
         break;
+      co_yield SearchSlice{};
     }
 
-    co_yield SearchResult{reconstructPath(dungeon, {dists.data(), dists.extents()}, start, finish), dists};
+    // The suboptimality bound needs the minimum over OPEN and INCONS, both are queued again afterwards anyway
+    while (!open.empty())
+      hooks.inconsistent.insert(open.pop().node);
+    const std::pmr::vector<glm::ivec2> pending(hooks.inconsistent.begin(), hooks.inconsistent.end(), context.resource());
 
-    eps -= 0.25;
-    auto oldOpen = std::move(open);
-    while (!oldOpen.empty())
-    {
-      auto v = oldOpen.top().second;
-      open.emplace(fScore(v), v);
-      oldOpen.pop();
-    }
-    for (auto v : inconsistent)
-      open.emplace(fScore(v), v);
+    float minScore = INF;
+    for (auto v : pending)
+      minScore = std::min(minScore, dists.get(v) + ivecDist(v, finish));
+    const float epsPrime = std::min(eps, dists.get(finish)/minScore);
+
+    SearchSlice solution{.solution = true, .result = makeResult(dungeon, dists, start, finish, context)};
+    co_yield std::move(solution);
+
+    // Provably optimal, or there is no path at all
+    if (dists.get(finish) >= INF || epsPrime <= 1 || eps <= 1)
+      co_return;
+
+    eps = std::max(1.f, eps - 0.25f);
+    for (auto v : pending)
+      open.push(dists.get(v) + eps*ivecDist(v, finish), v);
+    count(context.stats, Counter::Pushes, pending.size());
   }
 }
 
+template<class Layout, class Accessor, class Extents>
+SlicedSearch araStarSliced(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps,
+  ExpansionBudget& budget, SearchContext context)
+{
+  // DenseDists does not check bounds, an off-map finish would be read outside of it
+  if (!inBounds(finish, dungeon.extents()) || provablyUnreachable(context, start, finish))
+    return noPath();
+
+  return context.output == SearchOutput::Full
+    ? araStarImpl<DenseDists<Layout>>(dungeon, start, finish, eps, budget, context)
+    : araStarImpl<SparseDists<>>(dungeon, start, finish, eps, budget, context);
+}
 
-HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize)
+template<class Layout, class Accessor, class Extents>
+std::experimental::generator<SearchResult> araStar(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps, SearchContext context)
+{
+  ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+  for (auto&& slice : araStarSliced(dungeon, start, finish, eps, unlimited, context))
+    if (slice.solution && !slice.result.path.empty())
+      co_yield std::move(slice.result);
+}
+
+template SearchResult aStar(DungeonView, glm::ivec2, glm::ivec2, float, const SearchContext&);
+template SearchResult aStar(BlockedDungeonView, glm::ivec2, glm::ivec2, float, const SearchContext&);
+template SearchResult aStar(MortonDungeonView, glm::ivec2, glm::ivec2, float, const SearchContext&);
+template SearchResult aStar(ChunkedDungeonView, glm::ivec2, glm::ivec2, float, const SearchContext&);
+template SearchResult aStar(SparseDungeonView, glm::ivec2, glm::ivec2, float, const SearchContext&);
+
+template SlicedSearch aStarSliced(DungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch aStarSliced(BlockedDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch aStarSliced(MortonDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch aStarSliced(ChunkedDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch aStarSliced(SparseDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+
+template std::experimental::generator<SearchResult> araStar(DungeonView, glm::ivec2, glm::ivec2, float, SearchContext);
+template std::experimental::generator<SearchResult> araStar(BlockedDungeonView, glm::ivec2, glm::ivec2, float, SearchContext);
+template std::experimental::generator<SearchResult> araStar(MortonDungeonView, glm::ivec2, glm::ivec2, float, SearchContext);
+template std::experimental::generator<SearchResult> araStar(ChunkedDungeonView, glm::ivec2, glm::ivec2, float, SearchContext);
+template std::experimental::generator<SearchResult> araStar(SparseDungeonView, glm::ivec2, glm::ivec2, float, SearchContext);
+
+template SlicedSearch araStarSliced(DungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch araStarSliced(BlockedDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch araStarSliced(MortonDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch araStarSliced(ChunkedDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+template SlicedSearch araStarSliced(SparseDungeonView, glm::ivec2, glm::ivec2, float, ExpansionBudget&, SearchContext);
+
+
+HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize, SearchStats* stats)
 {
   NG_ASSERT(dungeon.extent(0) % cellSize == 0 && dungeon.extent(1) % cellSize == 0);
 
-  HierarchicalSearchData result{.cellSize = cellSize};
+  PhaseTimer totalTimer{stats, Phase::Total};
+  std::optional<PhaseTimer> phaseTimer{std::in_place, stats, Phase::BuildComponents};
+
+  HierarchicalSearchData result{
+    .cellSize = cellSize,
+    .cellCount = glm::ivec2{dungeon.extent(1), dungeon.extent(0)} / cellSize,
+    .components = buildComponents(dungeon)};
+
+  phaseTimer.emplace(stats, Phase::BuildPortals);
+
+  // Gathered in growable containers first, flattened once everything is known.
+  // The many small lists, maps and paths of that stage come from a pool that is dropped as a whole.
+  std::pmr::unsynchronized_pool_resource pool;
+  std::vector<Portal> portals;
+  std::pmr::vector<std::pmr::vector<std::uint32_t>> cellToPortalList(
+    static_cast<std::size_t>(result.cellCount.x) * result.cellCount.y, &pool);
+  auto cellPortalList = [&](int x, int y) -> auto& { return cellToPortalList[static_cast<std::size_t>(y) * result.cellCount.x + x]; };
 
-  for (int y = 0; y < dungeon.extent(1) / cellSize; ++y)
+  for (int y = 0; y < result.cellCount.y; ++y)
   {
-    for (int x = 0; x < dungeon.extent(0) / cellSize; ++x)
+    for (int x = 0; x < result.cellCount.x; ++x)
     {
       glm::ivec2 cellStart = cellSize * glm::ivec2{x, y};
       // Find portals on top
@@ -245,10 +346,11 @@ HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize)
 
           if (xEnd > xStart)
           {
-            result.portals.push_back(Portal{glm::ivec2{xStart, yStart}, glm::ivec2{xEnd, yEnd}, {}});
-            result.cellToPortalList.emplace(glm::ivec2{x, y}, result.portals.size() - 1);
+            const auto portal = static_cast<std::uint32_t>(portals.size());
+            portals.push_back(Portal{glm::ivec2{xStart, yStart}, glm::ivec2{xEnd, yEnd}});
+            cellPortalList(x, y).push_back(portal);
             if (y > 0)
-              result.cellToPortalList.emplace(glm::ivec2{x, y - 1}, result.portals.size() - 1);
+              cellPortalList(x, y - 1).push_back(portal);
             xStart = xEnd;
           }
         }
@@ -268,10 +370,11 @@ HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize)
 
           if (yEnd > yStart)
           {
-            result.portals.push_back(Portal{glm::ivec2{xStart, yStart}, glm::ivec2{xEnd, yEnd}, {}});
-            result.cellToPortalList.emplace(glm::ivec2{x, y}, result.portals.size() - 1);
+            const auto portal = static_cast<std::uint32_t>(portals.size());
+            portals.push_back(Portal{glm::ivec2{xStart, yStart}, glm::ivec2{xEnd, yEnd}});
+            cellPortalList(x, y).push_back(portal);
             if (x > 0)
-              result.cellToPortalList.emplace(glm::ivec2{x - 1, y}, result.portals.size() - 1);
+              cellPortalList(x - 1, y).push_back(portal);
             yStart = yEnd;
           }
         }
@@ -279,9 +382,21 @@ HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize)
     }
   }
 
-  for (int y = 0; y < dungeon.extent(0) / cellSize; ++y)
+  phaseTimer.emplace(stats, Phase::BuildIntraCell);
+
+  struct Adjacent
+  {
+    explicit Adjacent(std::pmr::memory_resource* memory) : path{memory} {}
+
+    CompressedPath path;
+    float dist{INF};
+  };
+  // Ordered, so that the same map always produces the same file
+  std::pmr::vector<std::pmr::map<std::uint32_t, Adjacent>> adjacent(portals.size(), &pool);
+
+  for (int y = 0; y < result.cellCount.y; ++y)
   {
-    for (int x = 0; x < dungeon.extent(1) / cellSize; ++x)
+    for (int x = 0; x < result.cellCount.x; ++x)
     {
       glm::ivec2 cellStart = cellSize * glm::ivec2{x, y};
 
@@ -331,16 +446,16 @@ HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize)
                   }
                 }
 
-      const auto[b, e] = result.cellToPortalList.equal_range(glm::ivec2{x, y});
-      for (auto i = b; i != e; ++i)
+      const auto& cellPortals = cellPortalList(x, y);
+      for (auto i : cellPortals)
       {
-        for (auto j = b; j != e; ++j)
+        for (auto j : cellPortals)
         {
           if (i == j)
             continue;
 
-          const auto& p1 = result.portals[i->second];
-          const auto& p2 = result.portals[j->second];
+          const auto& p1 = portals[i];
+          const auto& p2 = portals[j];
 
           const auto p1TopLeft     = glm::min(glm::max(p1.topLeft     - cellStart, glm::ivec2{0}), glm::ivec2{cellSize});
           const auto p1BottomRight = glm::min(glm::max(p1.bottomRight - cellStart, glm::ivec2{0}), glm::ivec2{cellSize});
@@ -372,9 +487,16 @@ HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize)
 
           // record as adjacent
 
-          auto& adj = result.portals[i->second].adjacent[j->second];
+          const float dist = (shortest + longest) / 2.f; // dirty hack
 
-          adj.dist = (shortest + longest) / 2.f; // dirty hack
+          // Portals on the same cell border are shared by both cells, keep the better connection
+          auto[it, inserted] = adjacent[i].try_emplace(j, &pool);
+          auto& adj = it->second;
+          if (!inserted && adj.dist <= dist)
+            continue;
+
+          adj.dist = dist;
+          adj.path.clear();
 
           while (start != end)
           {
@@ -387,93 +509,276 @@ HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize)
     }
   }
 
+  std::vector<PortalEdge> edges;
+  std::vector<std::uint8_t> pathRuns;
+  for (std::size_t i = 0; i < portals.size(); ++i)
+  {
+    portals[i].firstEdge = static_cast<std::uint32_t>(edges.size());
+    portals[i].edgeCount = static_cast<std::uint32_t>(adjacent[i].size());
+    for (const auto&[to, adj] : adjacent[i])
+    {
+      edges.push_back(PortalEdge{
+        .to = to,
+        .dist = adj.dist,
+        .pathFirst = adj.path.front(),
+        .pathLast = adj.path.back(),
+        .pathSize = static_cast<std::uint32_t>(adj.path.size()),
+        .runsOffset = static_cast<std::uint32_t>(pathRuns.size()),
+        .runsSize = static_cast<std::uint32_t>(adj.path.runs().size())});
+      pathRuns.insert(pathRuns.end(), adj.path.runs().begin(), adj.path.runs().end());
+    }
+  }
+
+  std::vector<std::uint32_t> cellPortalOffsets{0};
+  std::vector<std::uint32_t> cellPortals;
+  for (const auto& list : cellToPortalList)
+  {
+    cellPortals.insert(cellPortals.end(), list.begin(), list.end());
+    cellPortalOffsets.push_back(static_cast<std::uint32_t>(cellPortals.size()));
+  }
+
+  result.portals = SharedArray{std::move(portals)};
+  result.edges = SharedArray{std::move(edges)};
+  result.pathRuns = SharedArray{std::move(pathRuns)};
+  result.cellPortalOffsets = SharedArray{std::move(cellPortalOffsets)};
+  result.cellPortals = SharedArray{std::move(cellPortals)};
+
   return result;
 }
 
-static std::vector<std::size_t> portalSearch(const HierarchicalSearchData& data, std::size_t start, std::size_t finish)
+// Edges whose stored path crosses overlay tiles are re-planned inside their cell,
+// lazily and at most once per query. Without an overlay everything is passed through.
+class EdgePatcher
 {
-  using Pair = std::pair<float, std::size_t>;
+ public:
+  EdgePatcher(DungeonView dungeon, const HierarchicalSearchData& data, const ObstacleOverlay* overlay,
+    std::pmr::memory_resource* memory)
+    : dungeon_{dungeon}, data_{data}, overlay_{overlay}, dirtyCells_{memory}, patches_{memory}
+  {
+    if (overlay_ == nullptr)
+      return;
+    for (const auto&[v, cost] : *overlay_)
+      if (inBounds(v, dungeon_.extents()))
+        dirtyCells_.insert(v / data_.cellSize);
+  }
+
+  float dist(std::uint32_t e)
+  {
+    const auto* p = patch(e);
+    return p ? p->dist : data_.edges[e].dist;
+  }
 
-  struct Comp
+  CompressedPathView path(std::uint32_t e)
   {
-    bool operator()(const Pair& a, const Pair& b)
-      { return a.first > b.first; }
+    const auto* p = patch(e);
+    return p ? p->path.view() : data_.pathOf(data_.edges[e]);
+  }
+
+ private:
+  struct Patch
+  {
+    CompressedPath path;
+    float dist;
   };
 
+  const Patch* patch(std::uint32_t e)
+  {
+    if (dirtyCells_.empty())
+      return nullptr;
+
+    const auto& edge = data_.edges[e];
+    if (!dirtyCells_.contains(edge.pathFirst / data_.cellSize))
+      return nullptr;
+
+    auto[it, inserted] = patches_.try_emplace(e);
+    if (inserted)
+    {
+      const auto original = data_.pathOf(edge);
+      if (std::any_of(original.begin(), original.end(), [this](glm::ivec2 v) { return overlay_->extraCost(v) != 0; }))
+        it->second = replan(edge, original);
+    }
+    return it->second ? &*it->second : nullptr;
+  }
 
-  auto portalDist = [&data](std::size_t a, std::size_t b) { return glm::length(data.portals[a].midpoint() - data.portals[b].midpoint()); };
+  // Dijkstra over the cell the path was precomputed in
+  Patch replan(const PortalEdge& edge, CompressedPathView original) const
+  {
+    const auto cellStart = edge.pathFirst / data_.cellSize * data_.cellSize;
+    const auto cellSize = data_.cellSize;
+
+    if (overlay_->blocked(edge.pathFirst))
+      return {{}, INF};
 
-  std::priority_queue<Pair> queue;
-  std::vector<float> dists(data.portals.size(), INF);
-  queue.push({portalDist(start, finish), start});
-  dists[start] = 0;
+    // Dists and way back of the tiles of the cell
+    struct Cell
+    {
+      glm::ivec2 start;
+      int size;
+      std::vector<float> dists;
+      std::vector<glm::ivec2> previous;
+
+      std::size_t index(glm::ivec2 v) const { return static_cast<std::size_t>((v.y - start.y) * size + v.x - start.x); }
+      float get(glm::ivec2 v) const { return dists[index(v)]; }
+      void set(glm::ivec2 v, float dist) { dists[index(v)] = dist; }
+    };
+    struct Hooks : StopAtFinish<float>
+    {
+      Cell& cell;
+
+      void relaxed(glm::ivec2 from, glm::ivec2 to) { cell.previous[cell.index(to)] = from; }
+    };
+
+    const auto tiles = static_cast<std::size_t>(cellSize * cellSize);
+    Cell cell{cellStart, cellSize, std::vector<float>(tiles, INF), std::vector<glm::ivec2>(tiles)};
+    const GridGraph<DungeonView, FourConnected, FloatCost> graph{dungeon_, overlay_, cellStart, cellStart + cellSize};
+    BinaryHeap<float, glm::ivec2> open;
+    Hooks hooks{{{}, edge.pathLast}, cell};
+
+    open.push(0.f, edge.pathFirst);
+    cell.set(edge.pathFirst, 0);
+    ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+    bestFirst(graph, ZeroHeuristic<FloatCost>{}, open, cell, hooks, unlimited, nullptr);
+
+    const float cost = cell.get(edge.pathLast);
+    if (cost >= INF)
+      return {{}, INF};
+
+    CompressedPath path;
+    for (auto v = edge.pathLast; v != edge.pathFirst; v = cell.previous[cell.index(v)])
+      path.push_back(v);
+    path.push_back(edge.pathFirst);
+
+    // Edge costs are not plain path costs, only shift them by the detour
+    float originalCost = 0;
+    auto it = original.begin();
+    for (auto v = *it++; it != original.end(); v = *it++)
+      originalCost += weight(dungeon_, v, *it);
+
+    return {path.reversed(), edge.dist + cost - originalCost};
+  }
+
+  DungeonView dungeon_;
+  const HierarchicalSearchData& data_;
+  const ObstacleOverlay* overlay_;
+  std::pmr::unordered_set<glm::ivec2> dirtyCells_;
+  std::pmr::unordered_map<std::uint32_t, std::optional<Patch>> patches_;
+};
+
+// A* over the portal graph, resumable so that hierarchicalSearchSliced can yield in between
+class PortalSearch
+{
+ public:
+  PortalSearch(const HierarchicalSearchData& data, std::size_t start, std::size_t finish, SearchStats* stats, EdgePatcher& patcher,
+    std::pmr::memory_resource* memory)
+    : start_{start}
+    , stats_{stats}
+    , graph_{data, patcher}
+    , heuristic_{data, finish}
+    , open_{memory}
+    , dists_{data.portals.size(), memory}
+    , hooks_{{}, finish, std::pmr::vector<Previous>(data.portals.size(), Previous{start, 0}, memory)}
+  {
+    open_.push(heuristic_(start), start);
+    count(stats_, Counter::Pushes);
+    dists_.set(start, 0);
+  }
 
-  while (!queue.empty())
+  // False when the budget ran out first
+  bool run(ExpansionBudget& budget)
   {
-    auto current = queue.top().second;
-    queue.pop();
+    return bestFirst(graph_, heuristic_, open_, dists_, hooks_, budget, stats_);
+  }
 
-    if (current == finish)
-      break;
+  // Whether the exit was reached, only valid once run() returned true
+  bool found() const { return dists_.get(hooks_.finish) != INF; }
 
-    auto dist = dists[current];
+  // The edges to follow, only valid once run() returned true
+  std::pmr::vector<std::uint32_t> edges() const
+  {
+    std::pmr::vector<std::uint32_t> result{hooks_.previous.get_allocator()};
 
-    for (const auto&[successor, adj] : data.portals[current].adjacent)
+    if (dists_.get(hooks_.finish) != INF)
     {
-      float successor_dist = dist + adj.dist;
-      if (successor_dist < dists[successor])
-      {
-        dists[successor] = successor_dist;
-        queue.push({successor_dist + portalDist(successor, finish), successor});
-      }
+      for (auto current = hooks_.finish; current != start_; current = hooks_.previous[current].portal)
+        result.push_back(hooks_.previous[current].edge);
     }
+
+    std::reverse(result.begin(), result.end());
+
+    return result;
   }
 
-  std::vector<std::size_t> result;
+ private:
+  // Descending the dists is not enough: overlapping portals are connected with zero cost
+  struct Previous
+  {
+    std::size_t portal;
+    std::uint32_t edge;
+  };
 
-  if (dists[finish] != INF)
+  // Edges go through the patcher, so that the overlay is accounted for
+  struct Graph
   {
-    auto current = finish;
+    const HierarchicalSearchData& data;
+    EdgePatcher& patcher;
 
-    result.push_back(current);
-    while (current != start)
+    template<class F>
+    void forEachSuccessor(std::size_t v, F&& f) const
     {
-      auto best = current;
-      for (const auto&[successor, _] : data.portals[current].adjacent)
-        if (dists[successor] < dists[best])
-          best = successor;
+      const auto& portal = data.portals[v];
+      for (std::uint32_t e = portal.firstEdge; e < portal.firstEdge + portal.edgeCount; ++e)
+        f(std::size_t{data.edges[e].to}, patcher.dist(e), e);
+    }
+  };
 
-      if (best == current)
-        break;
+  struct Heuristic
+  {
+    const HierarchicalSearchData& data;
+    std::size_t finish;
 
-      current = best;
-      result.push_back(current);
-    }
-  }
+    float operator()(std::size_t v) const
+      { return glm::length(data.portals[v].midpoint() - data.portals[finish].midpoint()); }
+  };
 
-  std::reverse(result.begin(), result.end());
+  struct Hooks : SearchHooks<std::size_t, float>
+  {
+    std::size_t finish;
+    std::pmr::vector<Previous> previous;
 
-  return result;
-}
+    bool done(float, std::size_t top) const { return top == finish; }
+    void relaxed(std::size_t from, std::size_t to, std::uint32_t edge) { previous[to] = {from, edge}; }
+  };
 
-// Walks "straight" to the target. Behaviour undefined if the target is not reachable that way
-static void appendStraightPath(DungeonView dungeon, SearchResult& result, glm::ivec2 target)
+  std::size_t start_;
+  SearchStats* stats_;
+
+  Graph graph_;
+  Heuristic heuristic_;
+  QuaternaryHeap<float, std::size_t> open_;
+  IndexedDists<> dists_;
+  Hooks hooks_;
+};
+
+// Walks "straight" to the target, gives up when that gets stuck
+static bool appendStraightPath(DungeonView dungeon, SearchResult& result, glm::ivec2 target, const ObstacleOverlay* overlay)
 {
   while (result.path.back() != target)
   {
     auto best = result.path.back();
-    for (auto successor : successorsFor(result.path.back(), dungeon))
+    for (auto successor : successorsFor(result.path.back(), dungeon, overlay))
       if (ivecDist(best, target) > ivecDist(successor, target))
         best = successor;
 
     if (best == result.path.back())
-      break;
+      return false;
 
     result.path.push_back(best);
   }
+  return true;
 }
 
-SearchResult hierarchicalSearch(DungeonView dungeon, const HierarchicalSearchData& data, glm::ivec2 start, glm::ivec2 finish)
+SlicedSearch hierarchicalSearchSliced(DungeonView dungeon, const HierarchicalSearchData& data, glm::ivec2 start, glm::ivec2 finish,
+  ExpansionBudget& budget, SearchContext context)
 {
   // This is hacky. Only clicking on portal tiles is supported.
   // It is not clear how to do the general case:
@@ -492,29 +797,81 @@ SearchResult hierarchicalSearch(DungeonView dungeon, const HierarchicalSearchDat
       exit = i;
   }
 
-  SearchResult result;
-  if (entrance == NOT_FOUND || exit == NOT_FOUND)
-    return result;
+  if (entrance == NOT_FOUND || exit == NOT_FOUND
+    // Also spares the portal search from exhausting the whole portal graph
+    || provablyUnreachable({.components = context.components ? context.components : &data.components}, start, finish)
+    || (context.overlay != nullptr && context.overlay->blocked(finish)))
+  {
+    co_yield SearchSlice{.solution = true};
+    co_return;
+  }
 
-  result.path.push_back(start);
+  EdgePatcher patcher{dungeon, data, context.overlay, context.resource()};
+  PortalSearch portalSearch{data, entrance, exit, context.stats, patcher, context.resource()};
 
-  auto portalPath = portalSearch(data, entrance, exit);
+  // Timers can't live across co_yield, the coroutine may never be resumed
+  for (;;)
+  {
+    bool done = false;
+    {
+      PhaseTimer totalTimer{context.stats, Phase::Total};
+      PhaseTimer phaseTimer{context.stats, Phase::AbstractSearch};
+      done = portalSearch.run(budget);
+    }
+    if (done)
+      break;
+    co_yield SearchSlice{};
+  }
 
-  for (std::size_t i = 1; i < portalPath.size(); ++i)
+  // The overlay cut the portal graph, walking towards the finish anyway would only be a guess
+  if (!portalSearch.found())
   {
-    const auto portalFrom = portalPath[i - 1];
-    const auto portalTo = portalPath[i];
+    co_yield SearchSlice{.solution = true};
+    co_return;
+  }
 
-    const auto& path = data.portals[portalFrom].adjacent.at(portalTo).path;
+  SearchSlice solution{.solution = true, .result = {.path = CompressedPath{context.resource()}}};
+  auto& result = solution.result;
+  {
+    PhaseTimer totalTimer{context.stats, Phase::Total};
+    PhaseTimer phaseTimer{context.stats, Phase::Refinement};
 
-    appendStraightPath(dungeon, result, path.front());
+    result.path.push_back(start);
+
+    // A blocker inside a portal can cut the way between two sub-paths
+    bool reachable = true;
+    for (auto e : portalSearch.edges())
+    {
+      const auto path = patcher.path(e);
 
-    result.path.insert(result.path.cend(), path.begin(), path.end());
+      reachable = appendStraightPath(dungeon, result, path.front(), context.overlay);
+      if (!reachable)
+        break;
+
+      result.path.append(path);
+    }
+
+    reachable = reachable && appendStraightPath(dungeon, result, finish, context.overlay);
+
+    // A path that stops short of the finish is no path
+    if (!reachable)
+      result = SearchResult{.path = CompressedPath{context.resource()}};
+    else if (context.output != SearchOutput::Path)
+    {
+      auto it = result.path.begin();
+      for (auto previous = *it++; it != result.path.end(); previous = *it++)
+        result.dist += weight(dungeon, previous, *it, context.overlay);
+    }
   }
 
-  appendStraightPath(dungeon, result, finish);
+  co_yield std::move(solution);
+}
 
-  return result;
+SearchResult hierarchicalSearch(DungeonView dungeon, const HierarchicalSearchData& data, glm::ivec2 start, glm::ivec2 finish,
+  const SearchContext& context)
+{
+  ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+  return lastSolution(hierarchicalSearchSliced(dungeon, data, start, finish, unlimited, context));
 }
 
 }
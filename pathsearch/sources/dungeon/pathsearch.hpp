@@ -1,6 +1,14 @@
 #pragma once
 
 #include "dungeon.hpp"
+#include "components.hpp"
+#include "compressedPath.hpp"
+#include "overlay.hpp"
+#include "searchStats.hpp"
+#include "sharedArray.hpp"
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
 #include <experimental/mdarray>
@@ -13,52 +21,153 @@ namespace dungeon
 
 constexpr float INF = 1e6;
 
-using Dists = std::experimental::mdarray<float, std::experimental::extents<int, std::dynamic_extent, std::dynamic_extent>>;
-using DistsView = std::experimental::mdspan<float, std::experimental::extents<int, std::dynamic_extent, std::dynamic_extent>>;
+template<class Layout>
+using BasicDists = std::experimental::mdarray<float, DungeonExtents, Layout>;
+
+using Dists = BasicDists<std::experimental::layout_right>;
+using DistsView = std::experimental::mdspan<float, DungeonExtents>;
 
 struct SearchResult
 {
-  std::vector<glm::ivec2> path;
+  // Goes from start to finish
+  CompressedPath path;
+  // Only filled in with SearchOutput::Full
   Dists dists;
   float dist{};
 };
 
-SearchResult aStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, float eps);
+enum class SearchOutput
+{
+  Path,
+  PathAndCost,
+  // Also keeps the map-sized distance field around, meant for debug views
+  Full,
+};
+
+// Optional precomputed data and knobs shared by all search entry points
+struct SearchContext
+{
+  // When set, queries between disconnected regions return no path immediately
+  const Components* components{nullptr};
+  // Anything but Full never allocates map-sized buffers
+  SearchOutput output{SearchOutput::PathAndCost};
+  // Accumulated into, not reset
+  SearchStats* stats{nullptr};
+  // Extra blocked or costly tiles, must outlive the search (and araStar's generator)
+  const ObstacleOverlay* overlay{nullptr};
+  // Open lists, visited sets and the returned path are allocated from it, e.g. a
+  // std::pmr::monotonic_buffer_resource released once per batch. Must outlive the results,
+  // copy the ones that have to stay. nullptr means the default resource.
+  std::pmr::memory_resource* memory{nullptr};
+
+  std::pmr::memory_resource* resource() const { return memory != nullptr ? memory : std::pmr::get_default_resource(); }
+};
+
+// Expansions a time-sliced search may still do before it has to yield,
+// refilled by whoever resumes it. Shared by reference, so it must outlive the search.
+struct ExpansionBudget
+{
+  static constexpr std::size_t UNLIMITED = std::numeric_limits<std::size_t>::max();
+
+  std::size_t remaining{0};
+};
+
+// What a time-sliced search yields on every resumption
+struct SearchSlice
+{
+  // Unset when the search only ran out of budget. Set once per solution:
+  // once for most searches, for every improvement with araStar. An empty path means there is none.
+  bool solution{false};
+  SearchResult result;
+};
+
+// Ends after its last solution
+using SlicedSearch = std::experimental::generator<SearchSlice>;
+
+// The grid searches are instantiated for DungeonView, BlockedDungeonView, MortonDungeonView,
+// ChunkedDungeonView (MapStore snapshots) and SparseDungeonView (SparseDungeon).
+// Distance buffers follow the layout of the map, SearchResult::dists is always row-major.
+template<class Layout, class Accessor, class Extents>
+SearchResult aStar(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps, const SearchContext& context = {});
 
 SearchResult smaStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, float eps);
 
-std::experimental::generator<SearchResult> araStar(DungeonView dungeon, glm::ivec2 start, glm::ivec2 finish, float eps);
+// Yields every found path, each better than the last, finishing with an optimal one
+template<class Layout, class Accessor, class Extents>
+std::experimental::generator<SearchResult> araStar(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps, SearchContext context = {});
+
+// Time-sliced versions, they yield whenever the budget runs out.
+// Whatever the context points to has to outlive the coroutine.
+template<class Layout, class Accessor, class Extents>
+SlicedSearch aStarSliced(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps,
+  ExpansionBudget& budget, SearchContext context = {});
+
+template<class Layout, class Accessor, class Extents>
+SlicedSearch araStarSliced(BasicDungeonView<Layout, Accessor, Extents> dungeon, glm::ivec2 start, glm::ivec2 finish, float eps,
+  ExpansionBudget& budget, SearchContext context = {});
 
 
 struct Portal
 {
   glm::ivec2 topLeft;
   glm::ivec2 bottomRight;
+  // Range in HierarchicalSearchData::edges
+  std::uint32_t firstEdge{0};
+  std::uint32_t edgeCount{0};
 
   glm::vec2 midpoint() const { return (glm::vec2{topLeft} + glm::vec2{bottomRight}) / 2.f; }
   bool contains(glm::ivec2 v) const { return glm::min(v, topLeft) == topLeft && glm::max(v + 1, bottomRight) == bottomRight; }
+};
 
-  struct Adjacent
-  {
-    // Starts from SOME point inside the current portal
-    std::vector<glm::ivec2> path;
-    float dist;
-  };
-
-  std::unordered_map<std::size_t, Adjacent> adjacent;
+struct PortalEdge
+{
+  std::uint32_t to;
+  float dist;
+  // The path starts from SOME point inside the current portal, its runs live in HierarchicalSearchData::pathRuns
+  glm::ivec2 pathFirst;
+  glm::ivec2 pathLast;
+  std::uint32_t pathSize;
+  std::uint32_t runsOffset;
+  std::uint32_t runsSize;
 };
 
+// Everything is kept in flat arrays of trivially copyable structs,
+// so a hierarchy can be saved as is and used straight from a mapped file.
 struct HierarchicalSearchData
 {
   int cellSize{0};
-  std::vector<Portal> portals;
-  std::unordered_multimap<glm::ivec2, std::size_t> cellToPortalList;
+  glm::ivec2 cellCount{};
+  SharedArray<Portal> portals;
+  SharedArray<PortalEdge> edges;
+  SharedArray<std::uint8_t> pathRuns;
+  // Portals of the row-major cell c are cellPortals[cellPortalOffsets[c], cellPortalOffsets[c + 1])
+  SharedArray<std::uint32_t> cellPortalOffsets;
+  SharedArray<std::uint32_t> cellPortals;
+  Components components;
+
+  std::span<const PortalEdge> edgesOf(const Portal& portal) const
+    { return edges.span().subspan(portal.firstEdge, portal.edgeCount); }
+
+  std::span<const std::uint32_t> portalsOfCell(glm::ivec2 cell) const
+  {
+    const auto c = static_cast<std::size_t>(cell.y) * cellCount.x + cell.x;
+    return cellPortals.span().subspan(cellPortalOffsets[c], cellPortalOffsets[c + 1] - cellPortalOffsets[c]);
+  }
+
+  CompressedPathView pathOf(const PortalEdge& edge) const
+    { return {edge.pathFirst, edge.pathLast, edge.pathSize, pathRuns.span().subspan(edge.runsOffset, edge.runsSize)}; }
 };
 
-HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize);
+HierarchicalSearchData buildHierarchy(DungeonView dungeon, int cellSize, SearchStats* stats = nullptr);
+
+// Never returns dists, even with SearchOutput::Full. The path is empty unless it reaches the finish,
+// also when the overlay blocks every way the portal graph knows.
+SearchResult hierarchicalSearch(DungeonView dungeon, const HierarchicalSearchData& data, glm::ivec2 start, glm::ivec2 finish,
+  const SearchContext& context = {});
 
-// Only returns a path -- no dists
-SearchResult hierarchicalSearch(DungeonView dungeon, const HierarchicalSearchData& data, glm::ivec2 start, glm::ivec2 finish);
+// Budgeted in portal expansions, the refinement runs in one go. data has to outlive the coroutine.
+SlicedSearch hierarchicalSearchSliced(DungeonView dungeon, const HierarchicalSearchData& data, glm::ivec2 start, glm::ivec2 finish,
+  ExpansionBudget& budget, SearchContext context = {});
 
 
 }
@@ -0,0 +1,239 @@
+#include "queryTrace.hpp"
+#include "dungeonUtils.hpp"
+
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <span>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+constexpr std::array<char, 8> TRACE_MAGIC{'D', 'N', 'G', 'T', 'R', 'A', 'C', 'E'};
+// Reads back differently on a machine with the other byte order
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct TraceHeader
+{
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t byteOrder;
+  std::int32_t width;
+  std::int32_t height;
+};
+
+// The tag byte holds the kind in the low bit and the algorithm above it
+constexpr int KIND_BITS = 1;
+
+std::uint32_t zigzag(std::int32_t v) { return (static_cast<std::uint32_t>(v) << 1) ^ static_cast<std::uint32_t>(v >> 31); }
+std::int32_t unzigzag(std::uint32_t v) { return static_cast<std::int32_t>(v >> 1) ^ -static_cast<std::int32_t>(v & 1); }
+
+// 7 bits per byte, the high bit says another one follows
+void putVarint(std::vector<std::uint8_t>& out, std::uint64_t v)
+{
+  for (; v >= 0x80; v >>= 7)
+    out.push_back(static_cast<std::uint8_t>(v | 0x80));
+  out.push_back(static_cast<std::uint8_t>(v));
+}
+
+void putDelta(std::vector<std::uint8_t>& out, glm::ivec2 v, glm::ivec2 previous)
+{
+  putVarint(out, zigzag(v.x - previous.x));
+  putVarint(out, zigzag(v.y - previous.y));
+}
+
+// Reads from the front of the bytes, empty once they run out
+class Reader
+{
+ public:
+  explicit Reader(std::span<const std::uint8_t> bytes) : bytes_{bytes} {}
+
+  bool done() const { return bytes_.empty(); }
+
+  std::optional<std::uint64_t> varint()
+  {
+    std::uint64_t result = 0;
+    for (int shift = 0; shift < 64 && !bytes_.empty(); shift += 7)
+    {
+      const auto byte = bytes_.front();
+      bytes_ = bytes_.subspan(1);
+      result |= std::uint64_t{byte & 0x7fu} << shift;
+      if ((byte & 0x80) == 0)
+        return result;
+    }
+    return std::nullopt;
+  }
+
+  std::optional<glm::ivec2> delta(glm::ivec2 previous)
+  {
+    const auto x = varint();
+    const auto y = varint();
+    if (!x || !y)
+      return std::nullopt;
+    return previous + glm::ivec2{unzigzag(static_cast<std::uint32_t>(*x)), unzigzag(static_cast<std::uint32_t>(*y))};
+  }
+
+  template<class T>
+  std::optional<T> raw()
+  {
+    if (bytes_.size() < sizeof(T))
+      return std::nullopt;
+    T result;
+    std::memcpy(&result, bytes_.data(), sizeof(T));
+    bytes_ = bytes_.subspan(sizeof(T));
+    return result;
+  }
+
+ private:
+  std::span<const std::uint8_t> bytes_;
+};
+
+}
+
+QueryRecorder::QueryRecorder(const std::filesystem::path& path, DungeonView dungeon)
+  : file_{path, std::ios::binary | std::ios::trunc}
+  , begin_{Clock::now()}
+{
+  const TraceHeader header{
+    .magic = TRACE_MAGIC,
+    .version = QUERY_TRACE_VERSION,
+    .byteOrder = BYTE_ORDER_MARK,
+    .width = dungeon.extent(1),
+    .height = dungeon.extent(0),
+  };
+  file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file_.write(reinterpret_cast<const char*>(dungeon.data_handle()), static_cast<std::streamsize>(dungeon.size()));
+  if (!file_)
+    spdlog::error("Failed to start the query trace {}", path.string());
+}
+
+void QueryRecorder::query(TraceAlgorithm algorithm, glm::ivec2 start, glm::ivec2 finish)
+{
+  write(TraceEvent{.kind = TraceEvent::Kind::Query, .algorithm = algorithm, .start = start, .finish = finish});
+}
+
+void QueryRecorder::costChanged(glm::ivec2 tile, float cost)
+{
+  write(TraceEvent{.kind = TraceEvent::Kind::SetCost, .start = tile, .cost = cost});
+}
+
+void QueryRecorder::write(const TraceEvent& event)
+{
+  if (!file_)
+    return;
+
+  const auto time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin_);
+
+  std::vector<std::uint8_t> bytes;
+  bytes.push_back(static_cast<std::uint8_t>(static_cast<int>(event.kind) | static_cast<int>(event.algorithm) << KIND_BITS));
+  putVarint(bytes, static_cast<std::uint64_t>((time - lastTime_).count()));
+  lastTime_ = time;
+
+  if (event.kind == TraceEvent::Kind::Query)
+  {
+    putDelta(bytes, event.start, lastStart_);
+    putDelta(bytes, event.finish, lastFinish_);
+    lastStart_ = event.start;
+    lastFinish_ = event.finish;
+  }
+  else
+  {
+    // Blockers tend to go up next to the target
+    putDelta(bytes, event.start, lastFinish_);
+    const auto offset = bytes.size();
+    bytes.resize(offset + sizeof(float));
+    std::memcpy(bytes.data() + offset, &event.cost, sizeof(float));
+  }
+
+  file_.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+std::optional<QueryTrace> loadQueryTrace(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return std::nullopt;
+  const std::vector<std::uint8_t> bytes{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+
+  auto fail = [&path](std::string_view reason) -> std::optional<QueryTrace>
+    {
+      spdlog::warn("Ignoring {}: {}", path.string(), reason);
+      return std::nullopt;
+    };
+
+  TraceHeader header;
+  if (bytes.size() < sizeof(header))
+    return fail("truncated header");
+  std::memcpy(&header, bytes.data(), sizeof(header));
+
+  if (header.magic != TRACE_MAGIC)
+    return fail("not a query trace");
+  if (header.byteOrder != BYTE_ORDER_MARK)
+    return fail("written on a machine with a different byte order");
+  if (header.version != QUERY_TRACE_VERSION)
+    return fail(fmt::format("version {}, expected {}", header.version, QUERY_TRACE_VERSION));
+  if (header.width <= 0 || header.height <= 0)
+    return fail("inconsistent dimensions");
+
+  const auto tileCount = static_cast<std::size_t>(header.width) * static_cast<std::size_t>(header.height);
+  if (bytes.size() - sizeof(header) < tileCount)
+    return fail("truncated map");
+
+  QueryTrace result{.dungeon = make_dungeon(header.width, header.height)};
+  std::memcpy(result.dungeon.data.data(), bytes.data() + sizeof(header), tileCount);
+
+  Reader reader{std::span{bytes}.subspan(sizeof(header) + tileCount)};
+  std::chrono::microseconds time{};
+  glm::ivec2 lastStart{};
+  glm::ivec2 lastFinish{};
+  while (!reader.done())
+  {
+    const auto tag = reader.raw<std::uint8_t>();
+    const auto delta = reader.varint();
+    if (!tag || !delta)
+      break;
+
+    TraceEvent event{
+      .kind = static_cast<TraceEvent::Kind>(*tag & ((1 << KIND_BITS) - 1)),
+      .algorithm = static_cast<TraceAlgorithm>(*tag >> KIND_BITS),
+      .time = time + std::chrono::microseconds{static_cast<std::int64_t>(*delta)},
+    };
+    if (event.algorithm > TraceAlgorithm::Incremental)
+      return fail("unknown algorithm");
+
+    if (event.kind == TraceEvent::Kind::Query)
+    {
+      const auto start = reader.delta(lastStart);
+      const auto finish = reader.delta(lastFinish);
+      if (!start || !finish)
+        break;
+      event.start = lastStart = *start;
+      event.finish = lastFinish = *finish;
+    }
+    else
+    {
+      const auto tile = reader.delta(lastFinish);
+      const auto cost = reader.raw<float>();
+      if (!tile || !cost)
+        break;
+      // Also catches NaN, ObstacleOverlay::setCost would refuse it
+      if (!(*cost >= 0))
+        return fail("negative cost");
+      event.start = *tile;
+      event.cost = *cost;
+    }
+
+    time = event.time;
+    result.events.push_back(event);
+  }
+
+  return result;
+}
+
+}
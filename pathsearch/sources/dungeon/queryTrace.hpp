@@ -0,0 +1,82 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+constexpr std::uint32_t QUERY_TRACE_VERSION = 1;
+
+enum class TraceAlgorithm : std::uint8_t
+{
+  AStar,
+  AraStar,
+  Hierarchical,
+  Incremental,
+};
+
+struct TraceEvent
+{
+  enum class Kind : std::uint8_t
+  {
+    Query,
+    // The overlay cost of start became cost, 0 resets it and ObstacleOverlay::BLOCKED blocks it
+    SetCost,
+  };
+
+  Kind kind{Kind::Query};
+  TraceAlgorithm algorithm{TraceAlgorithm::AStar};
+  // Since the recording started
+  std::chrono::microseconds time{};
+  glm::ivec2 start{};
+  glm::ivec2 finish{};
+  float cost{0};
+};
+
+struct QueryTrace
+{
+  // The map as it was when the recording started
+  Dungeon dungeon;
+  std::vector<TraceEvent> events;
+};
+
+// Appends the queries of a running app to a file, starting with a copy of the map.
+// Events are a tag byte, the time since the previous one and coordinates relative
+// to the previous query, all as varints: repeated targets and short hops cost a
+// byte or two per coordinate. Not thread-safe.
+class QueryRecorder
+{
+ public:
+  QueryRecorder(const std::filesystem::path& path, DungeonView dungeon);
+
+  void query(TraceAlgorithm algorithm, glm::ivec2 start, glm::ivec2 finish);
+  void costChanged(glm::ivec2 tile, float cost);
+
+  // False once a write failed, nothing is written after that
+  bool good() const { return static_cast<bool>(file_); }
+
+ private:
+  void write(const TraceEvent& event);
+
+  using Clock = std::chrono::steady_clock;
+
+  std::ofstream file_;
+  Clock::time_point begin_;
+  std::chrono::microseconds lastTime_{};
+  glm::ivec2 lastStart_{};
+  glm::ivec2 lastFinish_{};
+};
+
+// Empty if the file is missing, was written by another version or the map is cut short.
+// A cut short last event, e.g. from an app that crashed while recording, is dropped.
+std::optional<QueryTrace> loadQueryTrace(const std::filesystem::path& path);
+
+}
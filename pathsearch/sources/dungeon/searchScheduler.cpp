@@ -0,0 +1,133 @@
+#include "searchScheduler.hpp"
+#include "assert.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+
+namespace dungeon
+{
+
+SearchScheduler::SearchScheduler(std::size_t budgetPerTick, std::size_t quantum)
+  : budgetPerTick_{budgetPerTick}
+  , quantum_{quantum}
+{
+  NG_ASSERT(quantum_ > 0);
+}
+
+SearchScheduler::Handle SearchScheduler::submit(Start start, OnSolution onSolution, int priority, Clock::time_point deadline)
+{
+  auto budget = std::make_unique<ExpansionBudget>();
+  auto owned = std::make_unique<Start>(std::move(start));
+  auto search = (*owned)(*budget);
+  submitted_.push_back(Task{
+    .handle = nextHandle_++,
+    .priority = priority,
+    .deadline = deadline,
+    .start = std::move(owned),
+    .onSolution = std::move(onSolution),
+    .budget = std::move(budget),
+    .search = std::move(search),
+  });
+  return submitted_.back().handle;
+}
+
+void SearchScheduler::cancel(Handle handle)
+{
+  // Only flagged, cancel may be called from a callback in the middle of tick()
+  for (auto* tasks : {&tasks_, &submitted_})
+    for (auto& task : *tasks)
+      if (task.handle == handle)
+        task.done = true;
+}
+
+void SearchScheduler::finish(Task& task)
+{
+  task.done = true;
+  task.onSolution(task.latest ? std::move(*task.latest) : SearchResult{}, true);
+}
+
+void SearchScheduler::step(Task& task)
+{
+  for (;;)
+  {
+    if (!task.position)
+      task.position.emplace(task.search.begin());
+    else
+      ++*task.position;
+
+    if (*task.position == task.search.end())
+    {
+      finish(task);
+      return;
+    }
+
+    auto&& slice = **task.position;
+    if (!slice.solution)
+    {
+      // Out of budget, meanwhile the caller gets to see the best solution so far,
+      // once rather than after every quantum
+      if (task.latest && !task.delivered)
+      {
+        task.delivered = true;
+        task.onSolution(SearchResult{.path = task.latest->path, .dist = task.latest->dist}, false);
+      }
+      return;
+    }
+
+    // Resumed right away, often there is nothing left to do and the solution is the last one
+    task.latest = std::move(slice.result);
+    task.delivered = false;
+  }
+}
+
+std::size_t SearchScheduler::tick(Clock::duration timeLimit)
+{
+  const auto started = Clock::now();
+  const auto expired = [&]() { return timeLimit != Clock::duration::max() && Clock::now() - started >= timeLimit; };
+
+  std::move(submitted_.begin(), submitted_.end(), std::back_inserter(tasks_));
+  submitted_.clear();
+
+  // Overdue queries with a solution are settled before anything runs
+  for (auto& task : tasks_)
+    if (!task.done && task.latest && task.deadline <= started)
+      finish(task);
+  std::erase_if(tasks_, [](const Task& task) { return task.done; });
+
+  std::stable_sort(tasks_.begin(), tasks_.end(), [started](const Task& a, const Task& b)
+    {
+      const bool aLate = a.deadline <= started;
+      const bool bLate = b.deadline <= started;
+      if (aLate != bLate)
+        return aLate;
+      if (a.priority != b.priority)
+        return a.priority > b.priority;
+      return a.deadline < b.deadline;
+    });
+
+  // Every step that does not finish its task spends its whole quantum, so this ends
+  std::size_t spent = 0;
+  for (bool running = true; running && spent < budgetPerTick_ && !expired();)
+  {
+    running = false;
+    for (auto& task : tasks_)
+    {
+      if (task.done)
+        continue;
+      if (spent >= budgetPerTick_ || expired())
+        break;
+
+      const auto quantum = std::min(quantum_, budgetPerTick_ - spent);
+      task.budget->remaining = quantum;
+      step(task);
+      spent += quantum - task.budget->remaining;
+      running = running || !task.done;
+    }
+  }
+
+  std::erase_if(tasks_, [](const Task& task) { return task.done; });
+  return spent;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "pathsearch.hpp"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <function2/function2.hpp>
+
+
+namespace dungeon
+{
+
+// Shares a per-tick expansion budget between time-sliced searches, so the search
+// cost of a frame stays bounded however many queries are pending.
+// Budget is handed out in quanta, round-robin in order of urgency: overdue queries first,
+// then higher priority, then earlier deadline. An overdue query that already has
+// a solution (araStar) is finished with it instead of running on.
+// Not thread-safe, submit, cancel and tick from the same thread.
+class SearchScheduler
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Handle = std::uint64_t;
+  // Creates the search, it has to draw from the given budget.
+  // Lives as long as the search, so it can own whatever the search points to.
+  using Start = fu2::unique_function<SlicedSearch(ExpansionBudget&)>;
+  // Called with every solution, `last` is set exactly once when the query is done.
+  // Interim solutions are copies of the path and its cost, without the distance field,
+  // the last one is handed over whole.
+  using OnSolution = fu2::unique_function<void(SearchResult result, bool last)>;
+
+  explicit SearchScheduler(std::size_t budgetPerTick, std::size_t quantum = 256);
+
+  Handle submit(Start start, OnSolution onSolution, int priority = 0, Clock::time_point deadline = Clock::time_point::max());
+  // No more callbacks after this, unknown or finished handles are ignored
+  void cancel(Handle handle);
+
+  // Resumes pending searches until the budget is spent or timeLimit has passed,
+  // the time is only checked between quanta. Returns the expansions spent.
+  std::size_t tick(Clock::duration timeLimit = Clock::duration::max());
+
+  std::size_t pending() const { return tasks_.size() + submitted_.size(); }
+
+  std::size_t budgetPerTick() const { return budgetPerTick_; }
+  void setBudgetPerTick(std::size_t budget) { budgetPerTick_ = budget; }
+
+ private:
+  using Position = decltype(std::declval<SlicedSearch&>().begin());
+
+  struct Task
+  {
+    Handle handle;
+    int priority;
+    Clock::time_point deadline;
+    // Heap allocated as well, small callables are stored inline and would move with the task
+    std::unique_ptr<Start> start;
+    OnSolution onSolution;
+    // Heap allocated, the coroutine keeps a reference while tasks move around
+    std::unique_ptr<ExpansionBudget> budget;
+    SlicedSearch search;
+    std::optional<Position> position;
+    std::optional<SearchResult> latest;
+    // Whether onSolution has already seen latest, results can be map-sized
+    bool delivered{false};
+    bool done{false};
+  };
+
+  // Runs the task until its budget is spent or it is done
+  void step(Task& task);
+  void finish(Task& task);
+
+  std::size_t budgetPerTick_;
+  std::size_t quantum_;
+  Handle nextHandle_{0};
+  std::vector<Task> tasks_;
+  // Callbacks may submit while tick() walks tasks_, they join at the next tick
+  std::vector<Task> submitted_;
+};
+
+}
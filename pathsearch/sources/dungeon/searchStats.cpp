@@ -0,0 +1,48 @@
+#include "searchStats.hpp"
+
+#include <fmt/format.h>
+
+
+namespace dungeon
+{
+
+SearchStats& SearchStats::operator+=(const SearchStats& other)
+{
+  for (std::size_t i = 0; i < counters.size(); ++i)
+    counters[i] += other.counters[i];
+  for (std::size_t i = 0; i < seconds.size(); ++i)
+    seconds[i] += other.seconds[i];
+  return *this;
+}
+
+std::string toJson(const SearchStats& stats)
+{
+  std::string result = "{";
+  for (std::size_t i = 0; i < COUNTER_NAMES.size(); ++i)
+    result += fmt::format("\"{}\": {}, ", COUNTER_NAMES[i], stats.counters[i]);
+  for (std::size_t i = 0; i < PHASE_NAMES.size(); ++i)
+    result += fmt::format("\"{}_seconds\": {}{}", PHASE_NAMES[i], stats.seconds[i], i + 1 < PHASE_NAMES.size() ? ", " : "");
+  return result + "}";
+}
+
+std::string csvHeader()
+{
+  std::string result;
+  for (auto name : COUNTER_NAMES)
+    result += fmt::format("{},", name);
+  for (std::size_t i = 0; i < PHASE_NAMES.size(); ++i)
+    result += fmt::format("{}_seconds{}", PHASE_NAMES[i], i + 1 < PHASE_NAMES.size() ? "," : "");
+  return result;
+}
+
+std::string toCsvRow(const SearchStats& stats)
+{
+  std::string result;
+  for (auto value : stats.counters)
+    result += fmt::format("{},", value);
+  for (std::size_t i = 0; i < stats.seconds.size(); ++i)
+    result += fmt::format("{}{}", stats.seconds[i], i + 1 < stats.seconds.size() ? "," : "");
+  return result;
+}
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+namespace dungeon
+{
+
+#ifdef PATHSEARCH_STATS
+constexpr bool STATS_ENABLED = true;
+#else
+constexpr bool STATS_ENABLED = false;
+#endif
+
+enum class Counter : std::size_t
+{
+  Expanded,
+  Pushes,
+  Pops,
+  // Popped entries that were superseded by a cheaper push of the same node
+  StalePops,
+  // Already expanded nodes that got a cheaper distance and had to be expanded again
+  Reopened,
+  COUNT,
+};
+
+enum class Phase : std::size_t
+{
+  Total,
+  AbstractSearch,
+  Refinement,
+  BuildComponents,
+  BuildPortals,
+  BuildIntraCell,
+  COUNT,
+};
+
+constexpr std::array<std::string_view, std::size_t(Counter::COUNT)> COUNTER_NAMES{
+  "expanded", "pushes", "pops", "stale_pops", "reopened"};
+constexpr std::array<std::string_view, std::size_t(Phase::COUNT)> PHASE_NAMES{
+  "total", "abstract_search", "refinement", "build_components", "build_portals", "build_intra_cell"};
+
+// Filled in by the searches when passed in. Everything below compiles
+// to nothing unless PATHSEARCH_STATS is defined, callers need no ifdefs.
+struct SearchStats
+{
+  std::array<std::uint64_t, std::size_t(Counter::COUNT)> counters{};
+  std::array<double, std::size_t(Phase::COUNT)> seconds{};
+
+  std::uint64_t operator[](Counter c) const { return counters[std::size_t(c)]; }
+  double operator[](Phase p) const { return seconds[std::size_t(p)]; }
+
+  SearchStats& operator+=(const SearchStats& other);
+};
+
+inline void count(SearchStats* stats, Counter counter, std::uint64_t amount = 1)
+{
+  if constexpr (STATS_ENABLED)
+    if (stats != nullptr)
+      stats->counters[std::size_t(counter)] += amount;
+}
+
+// Adds the lifetime of the object to the given phase
+class PhaseTimer
+{
+ public:
+  PhaseTimer(SearchStats* stats, Phase phase)
+  {
+    if constexpr (STATS_ENABLED)
+    {
+      stats_ = stats;
+      phase_ = phase;
+      if (stats_ != nullptr)
+        start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+  ~PhaseTimer()
+  {
+    if constexpr (STATS_ENABLED)
+      if (stats_ != nullptr)
+        stats_->seconds[std::size_t(phase_)] +=
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  }
+
+ private:
+  SearchStats* stats_{nullptr};
+  Phase phase_{};
+  std::chrono::steady_clock::time_point start_{};
+};
+
+std::string toJson(const SearchStats& stats);
+std::string csvHeader();
+std::string toCsvRow(const SearchStats& stats);
+
+}
@@ -0,0 +1,83 @@
+#include "searchWorker.hpp"
+
+#include <memory>
+
+
+namespace dungeon
+{
+
+SearchWorker::SearchWorker(std::size_t expansionsPerTick)
+  : scheduler_{expansionsPerTick}
+  , thread_{[this](std::stop_token stop) { run(stop); }}
+{
+}
+
+std::uint64_t SearchWorker::submit(Start start)
+{
+  std::uint64_t generation = 0;
+  {
+    std::lock_guard lock{mutex_};
+    generation = generation_.load(std::memory_order_relaxed) + 1;
+    generation_.store(generation, std::memory_order_release);
+    // A request the worker has not picked up yet is simply replaced
+    request_.emplace(generation, std::move(start));
+  }
+  wake_.notify_one();
+  return generation;
+}
+
+std::optional<SearchWorker::Update> SearchWorker::take()
+{
+  std::lock_guard lock{mutex_};
+  if (!fresh_ || front_.generation != generation_.load(std::memory_order_relaxed))
+    return std::nullopt;
+  fresh_ = false;
+  return std::move(front_);
+}
+
+void SearchWorker::publish(std::uint64_t generation, SearchResult result, const SearchStats& stats, bool final)
+{
+  back_.generation = generation;
+  back_.result = std::move(result);
+  back_.stats = stats;
+  back_.final = final;
+  {
+    std::lock_guard lock{mutex_};
+    std::swap(back_, front_);
+    fresh_ = true;
+  }
+  if (final)
+    finished_.store(generation, std::memory_order_release);
+}
+
+void SearchWorker::run(std::stop_token stop)
+{
+  std::optional<SearchScheduler::Handle> current;
+
+  while (!stop.stop_requested())
+  {
+    std::optional<std::pair<std::uint64_t, Start>> request;
+    {
+      std::unique_lock lock{mutex_};
+      if (!wake_.wait(lock, stop, [this]() { return request_.has_value() || scheduler_.pending() > 0; }))
+        break;
+      request = std::exchange(request_, std::nullopt);
+    }
+
+    if (request)
+    {
+      if (current)
+        scheduler_.cancel(*current);
+
+      auto stats = std::make_shared<SearchStats>();
+      current = scheduler_.submit(
+        [start = std::move(request->second), stats](ExpansionBudget& budget) mutable { return start(budget, stats.get()); },
+        [this, generation = request->first, stats](SearchResult result, bool last)
+          { publish(generation, std::move(result), *stats, last); });
+    }
+
+    scheduler_.tick();
+  }
+}
+
+}
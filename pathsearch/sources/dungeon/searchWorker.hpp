@@ -0,0 +1,76 @@
+#pragma once
+
+#include "pathsearch.hpp"
+#include "searchScheduler.hpp"
+#include "searchStats.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <function2/function2.hpp>
+
+
+namespace dungeon
+{
+
+// Runs searches on a background thread so that their cost never shows up in a frame.
+// Only the latest request matters: submitting cancels the running search within
+// one tick of expansions and drops updates it has not delivered yet.
+// Solutions are published through a double buffer, the worker fills the back
+// buffer and swaps it under the lock, take() hands out the front one.
+class SearchWorker
+{
+ public:
+  // Called on the worker thread. Lives as long as the search, so it can own what the search reads.
+  using Start = fu2::unique_function<SlicedSearch(ExpansionBudget& budget, SearchStats* stats)>;
+
+  struct Update
+  {
+    std::uint64_t generation{0};
+    SearchResult result;
+    // Accumulated by the search up to this update
+    SearchStats stats;
+    // Unset for anytime solutions that may still improve
+    bool final{false};
+  };
+
+  // Newer requests are picked up between ticks
+  explicit SearchWorker(std::size_t expansionsPerTick = 4096);
+
+  // Any thread, returns the generation its updates will carry
+  std::uint64_t submit(Start start);
+
+  // The newest update of the latest request since the previous call
+  std::optional<Update> take();
+
+  // The latest request has not delivered its final solution yet
+  bool busy() const { return finished_.load(std::memory_order_acquire) != generation_.load(std::memory_order_acquire); }
+
+ private:
+  void run(std::stop_token stop);
+  void publish(std::uint64_t generation, SearchResult result, const SearchStats& stats, bool final);
+
+  std::mutex mutex_;
+  std::condition_variable_any wake_;
+  std::optional<std::pair<std::uint64_t, Start>> request_;
+  std::atomic<std::uint64_t> generation_{0};
+  std::atomic<std::uint64_t> finished_{0};
+
+  // Worker thread only
+  Update back_;
+  // Guarded by mutex_
+  Update front_;
+  bool fresh_{false};
+
+  // Worker thread only
+  SearchScheduler scheduler_;
+
+  // Last, the thread must start after and stop before everything else
+  std::jthread thread_;
+};
+
+}
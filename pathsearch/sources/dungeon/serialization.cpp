@@ -0,0 +1,523 @@
+#include "serialization.hpp"
+#include "assert.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+constexpr std::array<char, 8> MAGIC{'D', 'N', 'G', 'H', 'I', 'E', 'R', '\0'};
+constexpr std::array<char, 8> FIRST_MOVE_MAGIC{'D', 'N', 'G', 'F', 'M', 'O', 'V', '\0'};
+// Reads back differently on a machine with the other byte order
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr std::size_t SECTION_ALIGNMENT = 64;
+
+struct FileHeader
+{
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t byteOrder;
+  // Of everything after the header
+  std::uint64_t checksum;
+  std::int32_t width;
+  std::int32_t height;
+  std::int32_t cellSize;
+  std::int32_t cellCountX;
+  std::int32_t cellCountY;
+  std::uint32_t sectionCount;
+};
+
+struct FirstMoveHeader
+{
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t byteOrder;
+  std::uint64_t checksum;
+  std::int32_t width;
+  std::int32_t height;
+  std::uint32_t sectionCount;
+  // Spells out the tail padding, so that no uninitialized bytes reach the file
+  std::uint32_t reserved;
+};
+
+struct SectionEntry
+{
+  HierarchySection id;
+  // Catches struct layout changes that forgot to bump the version
+  std::uint32_t elementSize;
+  std::uint64_t offset;
+  std::uint64_t count;
+};
+
+static_assert(std::is_trivially_copyable_v<Portal> && std::is_trivially_copyable_v<PortalEdge>);
+// Written as raw bytes, any padding would leak whatever was on the stack
+static_assert(std::has_unique_object_representations_v<FileHeader>
+  && std::has_unique_object_representations_v<FirstMoveHeader>
+  && std::has_unique_object_representations_v<SectionEntry>);
+
+bool inside(glm::ivec2 v, glm::ivec2 size)
+{
+  return v.x >= 0 && v.y >= 0 && v.x < size.x && v.y < size.y;
+}
+
+// Walks the runs instead of trusting pathSize. Runs are straight, so every run that
+// ends inside the map stayed inside it. Both ends lie in one cell, as replanning expects.
+bool validEdgePath(const PortalEdge& edge, std::span<const std::uint8_t> runs, glm::ivec2 size, int cellSize)
+{
+  if (edge.pathSize == 0 || !inside(edge.pathFirst, size) || edge.pathFirst / cellSize != edge.pathLast / cellSize)
+    return false;
+
+  auto v = edge.pathFirst;
+  std::uint64_t tiles = 1;
+  for (auto run : runs.subspan(edge.runsOffset, edge.runsSize))
+  {
+    v += steps::offset(run) * steps::length(run);
+    tiles += static_cast<std::uint64_t>(steps::length(run));
+    if (!inside(v, size))
+      return false;
+  }
+  return tiles == edge.pathSize && v == edge.pathLast;
+}
+
+std::size_t alignUp(std::size_t offset)
+{
+  return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+// FNV-1a over 8 byte words, cheap enough to not show up next to paging the file in
+std::uint64_t checksum(std::span<const std::byte> bytes)
+{
+  constexpr std::uint64_t PRIME = 0x100000001b3ull;
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+
+  std::size_t i = 0;
+  for (; i + 8 <= bytes.size(); i += 8)
+  {
+    std::uint64_t word;
+    std::memcpy(&word, bytes.data() + i, 8);
+    hash = (hash ^ word) * PRIME;
+  }
+
+  if (i < bytes.size())
+  {
+    std::uint64_t word = 0;
+    std::memcpy(&word, bytes.data() + i, bytes.size() - i);
+    hash = (hash ^ word) * PRIME;
+  }
+
+  return hash;
+}
+
+// Private copy-on-write mapping of a whole file
+class MappedFile
+{
+ public:
+  MappedFile(std::byte* data, std::size_t size) : data_{data}, size_{size} {}
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile()
+  {
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(data_, size_);
+#endif
+  }
+
+  static std::shared_ptr<MappedFile> open(const std::filesystem::path& path)
+  {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return nullptr;
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+      CloseHandle(file);
+      return nullptr;
+    }
+
+    // The view keeps the mapping alive on its own
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr)
+      return nullptr;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == nullptr)
+      return nullptr;
+
+    return std::make_shared<MappedFile>(static_cast<std::byte*>(data), static_cast<std::size_t>(size.QuadPart));
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return nullptr;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+      ::close(fd);
+      return nullptr;
+    }
+
+    const auto size = static_cast<std::size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      return nullptr;
+
+    // The checksum touches everything right away anyway
+    madvise(data, size, MADV_WILLNEED);
+
+    return std::make_shared<MappedFile>(static_cast<std::byte*>(data), size);
+#endif
+  }
+
+  std::span<std::byte> bytes() const { return {data_, size_}; }
+
+ private:
+  std::byte* data_;
+  std::size_t size_;
+};
+
+template<class T>
+std::optional<std::span<T>> findSection(std::span<std::byte> bytes, std::span<const SectionEntry> table, HierarchySection id)
+{
+  for (const auto& entry : table)
+  {
+    if (entry.id != id)
+      continue;
+
+    if (entry.elementSize != sizeof(T) || entry.offset % alignof(T) != 0 || entry.offset > bytes.size()
+      || entry.count > (bytes.size() - entry.offset) / sizeof(T))
+      return std::nullopt;
+
+    return std::span<T>{reinterpret_cast<T*>(bytes.data() + entry.offset), static_cast<std::size_t>(entry.count)};
+  }
+  return std::nullopt;
+}
+
+struct Section
+{
+  HierarchySection id;
+  std::uint32_t elementSize;
+  std::span<const std::byte> bytes;
+};
+
+template<class T>
+Section section(HierarchySection id, std::span<const T> values)
+{
+  return {id, sizeof(T), std::as_bytes(values)};
+}
+
+// Lays the section table and the sections out after the header, fills in the checksum
+// and section count of the header and writes everything through a temporary file
+template<class Header, std::size_t N>
+bool writeSections(const std::filesystem::path& path, Header header, const std::array<Section, N>& sections)
+{
+  // Assembled in memory first, the checksum has to be known before the header is written
+  std::vector<SectionEntry> table;
+  std::size_t size = alignUp(sizeof(Header) + sizeof(SectionEntry) * sections.size());
+  for (const auto& s : sections)
+  {
+    table.push_back(SectionEntry{s.id, s.elementSize, size, s.bytes.size() / s.elementSize});
+    size = alignUp(size + s.bytes.size());
+  }
+
+  std::vector<std::byte> bytes(size);
+  std::memcpy(bytes.data() + sizeof(Header), table.data(), sizeof(SectionEntry) * table.size());
+  for (std::size_t i = 0; i < sections.size(); ++i)
+    if (!sections[i].bytes.empty())
+      std::memcpy(bytes.data() + table[i].offset, sections[i].bytes.data(), sections[i].bytes.size());
+
+  header.checksum = checksum(std::span{bytes}.subspan(sizeof(Header)));
+  header.sectionCount = static_cast<std::uint32_t>(table.size());
+  std::memcpy(bytes.data(), &header, sizeof(header));
+
+  // Readers never see a half written file
+  auto temporary = path;
+  temporary += ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!file)
+    {
+      spdlog::error("Failed to write {}", temporary.string());
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+  if (error)
+  {
+    spdlog::error("Failed to move {} to {}: {}", temporary.string(), path.string(), error.message());
+    return false;
+  }
+
+  return true;
+}
+
+}
+
+bool saveHierarchy(const std::filesystem::path& path, DungeonView dungeon, const HierarchicalSearchData& data)
+{
+  NG_ASSERT(data.components.width == dungeon.extent(1) && data.components.height == dungeon.extent(0));
+
+  const std::array sections{
+    section(HierarchySection::Tiles, std::span<const Tile>{dungeon.data_handle(), dungeon.size()}),
+    section(HierarchySection::Portals, data.portals.span()),
+    section(HierarchySection::Edges, data.edges.span()),
+    section(HierarchySection::PathRuns, data.pathRuns.span()),
+    section(HierarchySection::CellPortalOffsets, data.cellPortalOffsets.span()),
+    section(HierarchySection::CellPortals, data.cellPortals.span()),
+    section(HierarchySection::ComponentLabels, data.components.labels.span()),
+    section(HierarchySection::ComponentParents, std::span<const std::uint32_t>{data.components.labelParent}),
+  };
+
+  const FileHeader header{
+    .magic = MAGIC,
+    .version = HIERARCHY_FILE_VERSION,
+    .byteOrder = BYTE_ORDER_MARK,
+    .width = dungeon.extent(1),
+    .height = dungeon.extent(0),
+    .cellSize = data.cellSize,
+    .cellCountX = data.cellCount.x,
+    .cellCountY = data.cellCount.y,
+  };
+  return writeSections(path, header, sections);
+}
+
+std::optional<LoadedHierarchy> loadHierarchy(const std::filesystem::path& path)
+{
+  auto file = MappedFile::open(path);
+  if (!file)
+    return std::nullopt;
+
+  auto fail = [&path](std::string_view reason) -> std::optional<LoadedHierarchy>
+    {
+      spdlog::warn("Ignoring {}: {}", path.string(), reason);
+      return std::nullopt;
+    };
+
+  const auto bytes = file->bytes();
+
+  FileHeader header;
+  if (bytes.size() < sizeof(header))
+    return fail("truncated header");
+  std::memcpy(&header, bytes.data(), sizeof(header));
+
+  if (header.magic != MAGIC)
+    return fail("not a hierarchy file");
+  if (header.byteOrder != BYTE_ORDER_MARK)
+    return fail("written on a machine with a different byte order");
+  if (header.version != HIERARCHY_FILE_VERSION)
+    return fail(fmt::format("version {}, expected {}", header.version, HIERARCHY_FILE_VERSION));
+  if (header.sectionCount > (bytes.size() - sizeof(header)) / sizeof(SectionEntry))
+    return fail("truncated section table");
+  if (checksum(bytes.subspan(sizeof(header))) != header.checksum)
+    return fail("checksum mismatch");
+
+  if (header.width <= 0 || header.height <= 0 || header.cellSize <= 0
+    || std::int64_t{header.cellCountX} * header.cellSize != header.width
+    || std::int64_t{header.cellCountY} * header.cellSize != header.height)
+    return fail("inconsistent dimensions");
+
+  std::vector<SectionEntry> table(header.sectionCount);
+  std::memcpy(table.data(), bytes.data() + sizeof(header), sizeof(SectionEntry) * table.size());
+
+  const auto tiles = findSection<Tile>(bytes, table, HierarchySection::Tiles);
+  const auto portals = findSection<const Portal>(bytes, table, HierarchySection::Portals);
+  const auto edges = findSection<const PortalEdge>(bytes, table, HierarchySection::Edges);
+  const auto pathRuns = findSection<const std::uint8_t>(bytes, table, HierarchySection::PathRuns);
+  const auto cellPortalOffsets = findSection<const std::uint32_t>(bytes, table, HierarchySection::CellPortalOffsets);
+  const auto cellPortals = findSection<const std::uint32_t>(bytes, table, HierarchySection::CellPortals);
+  const auto labels = findSection<const std::uint32_t>(bytes, table, HierarchySection::ComponentLabels);
+  const auto labelParent = findSection<const std::uint32_t>(bytes, table, HierarchySection::ComponentParents);
+
+  if (!tiles || !portals || !edges || !pathRuns || !cellPortalOffsets || !cellPortals || !labels || !labelParent)
+    return fail("missing or malformed section");
+
+  // The checksum only catches accidents. Indices, coordinates and stored paths are checked,
+  // so that a bad file can not make searches read out of bounds.
+  const auto tileCount = static_cast<std::size_t>(header.width) * static_cast<std::size_t>(header.height);
+  const auto cellCount = static_cast<std::size_t>(header.cellCountX) * static_cast<std::size_t>(header.cellCountY);
+  if (tiles->size() != tileCount || labels->size() != tileCount)
+    return fail("map sized sections do not match the map");
+
+  if (cellPortalOffsets->size() != cellCount + 1 || cellPortalOffsets->front() != 0 || cellPortalOffsets->back() != cellPortals->size()
+    || !std::is_sorted(cellPortalOffsets->begin(), cellPortalOffsets->end()))
+    return fail("bad cell index");
+
+  for (auto p : *cellPortals)
+    if (p >= portals->size())
+      return fail("bad cell index");
+
+  const glm::ivec2 size{header.width, header.height};
+  for (const auto& p : *portals)
+  {
+    if (std::uint64_t{p.firstEdge} + p.edgeCount > edges->size())
+      return fail("bad portal edge range");
+    if (!inside(p.topLeft, size) || glm::any(glm::greaterThanEqual(p.topLeft, p.bottomRight)) || !inside(p.bottomRight - 1, size))
+      return fail("bad portal bounds");
+  }
+
+  for (const auto& e : *edges)
+  {
+    if (e.to >= portals->size() || std::uint64_t{e.runsOffset} + e.runsSize > pathRuns->size())
+      return fail("bad portal edge");
+    if (!validEdgePath(e, *pathRuns, size, header.cellSize))
+      return fail("bad portal edge path");
+  }
+
+  for (auto l : *labels)
+    if (l != Components::NONE && l >= labelParent->size())
+      return fail("bad component label");
+
+  for (auto l : *labelParent)
+    if (l >= labelParent->size())
+      return fail("bad component label");
+
+  std::shared_ptr<const void> storage = file;
+
+  return LoadedHierarchy{
+    .dungeon = DungeonView(tiles->data(), header.height, header.width),
+    .hierarchy = HierarchicalSearchData{
+      .cellSize = header.cellSize,
+      .cellCount = glm::ivec2{header.cellCountX, header.cellCountY},
+      .portals = SharedArray<Portal>{*portals, storage},
+      .edges = SharedArray<PortalEdge>{*edges, storage},
+      .pathRuns = SharedArray<std::uint8_t>{*pathRuns, storage},
+      .cellPortalOffsets = SharedArray<std::uint32_t>{*cellPortalOffsets, storage},
+      .cellPortals = SharedArray<std::uint32_t>{*cellPortals, storage},
+      .components = Components{
+        .width = header.width,
+        .height = header.height,
+        .labels = SharedArray<std::uint32_t>{*labels, storage},
+        // Tiny and mutated in place on edits
+        .labelParent = {labelParent->begin(), labelParent->end()},
+      },
+    },
+    .storage = storage,
+  };
+}
+
+bool saveFirstMoves(const std::filesystem::path& path, const FirstMoveDatabase& database)
+{
+  const std::array sections{
+    section(HierarchySection::FirstMoveOrder, database.orderOf.span()),
+    section(HierarchySection::FirstMoveRunOffsets, database.firstRun.span()),
+    section(HierarchySection::FirstMoveRuns, database.runs.span()),
+  };
+
+  const FirstMoveHeader header{
+    .magic = FIRST_MOVE_MAGIC,
+    .version = FIRST_MOVE_FILE_VERSION,
+    .byteOrder = BYTE_ORDER_MARK,
+    .width = database.width,
+    .height = database.height,
+    .reserved = 0,
+  };
+  return writeSections(path, header, sections);
+}
+
+std::optional<FirstMoveDatabase> loadFirstMoves(const std::filesystem::path& path)
+{
+  auto file = MappedFile::open(path);
+  if (!file)
+    return std::nullopt;
+
+  auto fail = [&path](std::string_view reason) -> std::optional<FirstMoveDatabase>
+    {
+      spdlog::warn("Ignoring {}: {}", path.string(), reason);
+      return std::nullopt;
+    };
+
+  const auto bytes = file->bytes();
+
+  FirstMoveHeader header;
+  if (bytes.size() < sizeof(header))
+    return fail("truncated header");
+  std::memcpy(&header, bytes.data(), sizeof(header));
+
+  if (header.magic != FIRST_MOVE_MAGIC)
+    return fail("not a first-move file");
+  if (header.byteOrder != BYTE_ORDER_MARK)
+    return fail("written on a machine with a different byte order");
+  if (header.version != FIRST_MOVE_FILE_VERSION)
+    return fail(fmt::format("version {}, expected {}", header.version, FIRST_MOVE_FILE_VERSION));
+  if (header.sectionCount > (bytes.size() - sizeof(header)) / sizeof(SectionEntry))
+    return fail("truncated section table");
+  if (checksum(bytes.subspan(sizeof(header))) != header.checksum)
+    return fail("checksum mismatch");
+  if (header.width <= 0 || header.height <= 0)
+    return fail("inconsistent dimensions");
+
+  std::vector<SectionEntry> table(header.sectionCount);
+  std::memcpy(table.data(), bytes.data() + sizeof(header), sizeof(SectionEntry) * table.size());
+
+  const auto orderOf = findSection<const std::uint32_t>(bytes, table, HierarchySection::FirstMoveOrder);
+  const auto firstRun = findSection<const std::uint64_t>(bytes, table, HierarchySection::FirstMoveRunOffsets);
+  const auto runs = findSection<const std::uint32_t>(bytes, table, HierarchySection::FirstMoveRuns);
+  if (!orderOf || !firstRun || !runs)
+    return fail("missing or malformed section");
+
+  // Lookups binary search the runs of a source, which must start at the first target
+  const auto tileCount = static_cast<std::size_t>(header.width) * static_cast<std::size_t>(header.height);
+  if (orderOf->size() != tileCount || firstRun->empty() || firstRun->front() != 0 || firstRun->back() != runs->size()
+    || !std::is_sorted(firstRun->begin(), firstRun->end()))
+    return fail("bad run offsets");
+
+  const auto sources = firstRun->size() - 1;
+  for (auto t : *orderOf)
+    if (t != FirstMoveDatabase::NONE && t >= sources)
+      return fail("bad target order");
+
+  for (std::size_t s = 0; s < sources; ++s)
+    if ((*firstRun)[s] == (*firstRun)[s + 1] || (*runs)[(*firstRun)[s]] >> FirstMoveDatabase::MOVE_BITS != 0)
+      return fail("bad runs");
+
+  for (auto run : *runs)
+    if ((run & FirstMoveDatabase::MOVE_MASK) > FirstMoveDatabase::NO_MOVE)
+      return fail("bad move");
+
+  std::shared_ptr<const void> storage = file;
+
+  return FirstMoveDatabase{
+    .width = header.width,
+    .height = header.height,
+    .orderOf = SharedArray<std::uint32_t>{*orderOf, storage},
+    .firstRun = SharedArray<std::uint64_t>{*firstRun, storage},
+    .runs = SharedArray<std::uint32_t>{*runs, storage},
+  };
+}
+
+}
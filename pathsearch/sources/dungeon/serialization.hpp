@@ -0,0 +1,56 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "firstMoves.hpp"
+#include "pathsearch.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+
+
+namespace dungeon
+{
+
+// Bump whenever the layout of anything that gets written changes
+constexpr std::uint32_t HIERARCHY_FILE_VERSION = 1;
+constexpr std::uint32_t FIRST_MOVE_FILE_VERSION = 1;
+
+// Layout: header, section table, then every section aligned to 64 bytes.
+// Sections are raw arrays of the in-memory structs, so loading is just mapping the file.
+// Unknown section ids are skipped, which leaves room for extra tables (e.g. heuristics).
+enum class HierarchySection : std::uint32_t
+{
+  Tiles,
+  Portals,
+  Edges,
+  PathRuns,
+  CellPortalOffsets,
+  CellPortals,
+  ComponentLabels,
+  ComponentParents,
+  // First-move database files
+  FirstMoveOrder,
+  FirstMoveRunOffsets,
+  FirstMoveRuns,
+};
+
+struct LoadedHierarchy
+{
+  // Points into the mapping. Writes are private to the process and never reach the file.
+  DungeonView dungeon;
+  HierarchicalSearchData hierarchy;
+  // The hierarchy keeps its own references, this one is for the tiles
+  std::shared_ptr<const void> storage;
+};
+
+bool saveHierarchy(const std::filesystem::path& path, DungeonView dungeon, const HierarchicalSearchData& data);
+
+// Empty if the file is missing, was written by another version or fails validation
+std::optional<LoadedHierarchy> loadHierarchy(const std::filesystem::path& path);
+
+// Same layout with a header of its own, the loaded arrays point into the mapping
+bool saveFirstMoves(const std::filesystem::path& path, const FirstMoveDatabase& database);
+std::optional<FirstMoveDatabase> loadFirstMoves(const std::filesystem::path& path);
+
+}
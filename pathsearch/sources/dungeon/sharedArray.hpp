@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+
+namespace dungeon
+{
+
+// Immutable array that either owns its elements or borrows them from
+// something kept alive by `owner` (e.g. a mapped file).
+// Copies are cheap and share the elements, writers get a private copy first.
+template<class T>
+class SharedArray
+{
+ public:
+  using value_type = T;
+  using iterator = typename std::span<const T>::iterator;
+
+  SharedArray() = default;
+
+  explicit SharedArray(std::vector<T> values)
+    : owned_{std::make_shared<std::vector<T>>(std::move(values))}
+    , view_{*owned_}
+  {
+  }
+
+  SharedArray(std::span<const T> view, std::shared_ptr<const void> owner)
+    : owner_{std::move(owner)}
+    , view_{view}
+  {
+  }
+
+  std::span<const T> span() const { return view_; }
+  operator std::span<const T>() const { return view_; }
+
+  const T& operator[](std::size_t i) const { return view_[i]; }
+  const T* data() const { return view_.data(); }
+  std::size_t size() const { return view_.size(); }
+  bool empty() const { return view_.empty(); }
+  iterator begin() const { return view_.begin(); }
+  iterator end() const { return view_.end(); }
+
+  // Invalidates spans obtained earlier
+  template<class F>
+  void modify(F&& f)
+  {
+    if (!owned_ || owned_.use_count() > 1)
+    {
+      owned_ = std::make_shared<std::vector<T>>(view_.begin(), view_.end());
+      view_ = *owned_;
+      owner_.reset();
+    }
+    f(*owned_);
+    view_ = *owned_;
+  }
+
+ private:
+  std::shared_ptr<std::vector<T>> owned_;
+  std::shared_ptr<const void> owner_;
+  std::span<const T> view_;
+};
+
+}
@@ -0,0 +1,107 @@
+#include "smoothing.hpp"
+#include "grid.hpp"
+#include "pathsearch.hpp"
+
+
+namespace dungeon
+{
+
+float lineOfSightCost(DungeonView dungeon, glm::ivec2 from, glm::ivec2 to, const ObstacleOverlay* overlay)
+{
+  const glm::ivec2 delta = to - from;
+  const glm::ivec2 step{delta.x > 0 ? 1 : -1, delta.y > 0 ? 1 : -1};
+  const int nx = std::abs(delta.x);
+  const int ny = std::abs(delta.y);
+
+  // Same rule as weight(): a step is penalized if either of its tiles is water
+  int wetSteps = 0;
+  bool previousWet = false;
+  float extraCost = 0;
+  auto visit = [&](glm::ivec2 v)
+    {
+      if (!isPassable(dungeon, v, overlay))
+        return false;
+      const bool wet = dungeon(v.y, v.x) == Tile::Water;
+      wetSteps += wet || previousWet ? 1 : 0;
+      previousWet = wet;
+      if (overlay != nullptr)
+        extraCost += overlay->extraCost(v);
+      return true;
+    };
+
+  // Supercover traversal: every tile the segment between the centers passes through
+  glm::ivec2 current = from;
+  if (!visit(current))
+    return INF;
+  wetSteps = 0;
+  extraCost = 0;
+
+  for (int ix = 0, iy = 0; ix < nx || iy < ny;)
+  {
+    const int decision = (1 + 2*ix) * ny - (1 + 2*iy) * nx;
+    if (decision == 0)
+    {
+      // Exactly through a corner: agents can't squeeze diagonally between two walls,
+      // and the water on both sides is charged, which errs on the expensive side
+      if (!visit(current + glm::ivec2{step.x, 0}) || !visit(current + glm::ivec2{0, step.y}))
+        return INF;
+      current += step;
+      ++ix;
+      ++iy;
+    }
+    else if (decision < 0)
+    {
+      current.x += step.x;
+      ++ix;
+    }
+    else
+    {
+      current.y += step.y;
+      ++iy;
+    }
+
+    if (!visit(current))
+      return INF;
+  }
+
+  return ivecDist(from, to) + WATER_PENALTY * wetSteps + extraCost;
+}
+
+std::vector<glm::ivec2> smoothPath(DungeonView dungeon, CompressedPathView path, const ObstacleOverlay* overlay)
+{
+  std::vector<glm::ivec2> result;
+  if (path.empty())
+    return result;
+
+  // Streams over the path, only the anchor and the two latest tiles are needed
+  result.push_back(path.front());
+
+  glm::ivec2 anchor = path.front();
+  float anchorCost = 0;
+  glm::ivec2 previous = path.front();
+  float previousCost = 0;
+
+  auto it = path.begin();
+  for (++it; it != path.end(); ++it)
+  {
+    const glm::ivec2 current = *it;
+    const float currentCost = previousCost + weight(dungeon, previous, current, overlay);
+
+    if (previous != anchor && lineOfSightCost(dungeon, anchor, current, overlay) > currentCost - anchorCost)
+    {
+      result.push_back(previous);
+      anchor = previous;
+      anchorCost = previousCost;
+    }
+
+    previous = current;
+    previousCost = currentCost;
+  }
+
+  if (path.size() > 1)
+    result.push_back(path.back());
+
+  return result;
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "compressedPath.hpp"
+#include "overlay.hpp"
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// Checks whether walking in a straight line between tile centers
+// never touches a wall and returns its cost, INF otherwise.
+// Water is charged per touched tile the same way weight() charges grid steps,
+// overlay costs once per touched tile after the first.
+float lineOfSightCost(DungeonView dungeon, glm::ivec2 from, glm::ivec2 to, const ObstacleOverlay* overlay = nullptr);
+
+// String-pulls a 4-connected tile path into a polyline.
+// A run of waypoints is replaced by a straight segment only when the segment is
+// visible and not more expensive than the tiles it replaces, so water detours are kept.
+std::vector<glm::ivec2> smoothPath(DungeonView dungeon, CompressedPathView path, const ObstacleOverlay* overlay = nullptr);
+
+}
@@ -0,0 +1,112 @@
+#include "sparseMap.hpp"
+#include "assert.hpp"
+#include "grid.hpp"
+
+#include <algorithm>
+#include <random>
+
+
+namespace dungeon
+{
+
+static constexpr int CHUNK_SIZE = 1 << CHUNK_BITS;
+
+static const MapChunk& wallChunk()
+{
+  static const MapChunk chunk = []()
+    {
+      MapChunk result;
+      result.fill(Tile::Wall);
+      return result;
+    }();
+  return chunk;
+}
+
+SparseDungeon::SparseDungeon(int width, int height)
+  : width_{width}
+  , height_{height}
+  , chunksX_{(std::int64_t{width} + CHUNK_SIZE - 1) / CHUNK_SIZE}
+{
+  const std::int64_t chunksY = (std::int64_t{height} + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  const auto count = static_cast<std::size_t>(chunksX_ * chunksY);
+  chunks_.resize(count);
+  chunkTable_.assign(count, wallChunk().data());
+}
+
+std::size_t SparseDungeon::chunkIndex(glm::ivec2 pos) const
+{
+  return static_cast<std::size_t>(pos.y / CHUNK_SIZE * chunksX_ + pos.x / CHUNK_SIZE);
+}
+
+Tile SparseDungeon::get(glm::ivec2 pos) const
+{
+  NG_ASSERT(inBounds(pos, LargeDungeonExtents{height_, width_}));
+  return chunkTable_[chunkIndex(pos)][(pos.y % CHUNK_SIZE) * CHUNK_SIZE + pos.x % CHUNK_SIZE];
+}
+
+void SparseDungeon::set(glm::ivec2 pos, Tile tile)
+{
+  NG_ASSERT(inBounds(pos, LargeDungeonExtents{height_, width_}));
+  const auto index = chunkIndex(pos);
+  const auto offset = (pos.y % CHUNK_SIZE) * CHUNK_SIZE + pos.x % CHUNK_SIZE;
+  if (chunkTable_[index][offset] == tile)
+    return;
+
+  // Padding past the map edge stays wall, as with MapStore
+  if (!chunks_[index])
+  {
+    chunks_[index] = std::make_unique<MapChunk>(wallChunk());
+    chunkTable_[index] = chunks_[index]->data();
+    ++allocated_;
+  }
+  (*chunks_[index])[offset] = tile;
+}
+
+SparseDungeonView SparseDungeon::view() const
+{
+  return SparseDungeonView{chunkTable_.data(), SparseDungeonView::mapping_type{LargeDungeonExtents{height_, width_}}};
+}
+
+std::size_t SparseDungeon::compact()
+{
+  std::size_t freed = 0;
+  for (std::size_t i = 0; i < chunks_.size(); ++i)
+    if (chunks_[i] && *chunks_[i] == wallChunk())
+    {
+      chunks_[i].reset();
+      chunkTable_[i] = wallChunk().data();
+      ++freed;
+    }
+  allocated_ -= freed;
+  return freed;
+}
+
+glm::ivec2 find_walkable_tile(const SparseDungeon& dungeon)
+{
+  static std::default_random_engine engine;
+
+  // Reservoir sampling, every floor tile is equally likely without collecting them
+  const auto view = dungeon.view();
+  const auto chunksX = (dungeon.width() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  const auto chunksY = (dungeon.height() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  const auto* wall = wallChunk().data();
+
+  glm::ivec2 result{-1, -1};
+  std::size_t seen = 0;
+  for (int cy = 0; cy < chunksY; ++cy)
+    for (int cx = 0; cx < chunksX; ++cx)
+    {
+      if (view.data_handle()[static_cast<std::size_t>(cy) * chunksX + cx] == wall)
+        continue;
+
+      for (int y = cy * CHUNK_SIZE; y < std::min((cy + 1) * CHUNK_SIZE, dungeon.height()); ++y)
+        for (int x = cx * CHUNK_SIZE; x < std::min((cx + 1) * CHUNK_SIZE, dungeon.width()); ++x)
+          if (view(y, x) == Tile::Floor && std::uniform_int_distribution<std::size_t>(0, seen++)(engine) == 0)
+            result = {x, y};
+    }
+
+  NG_ASSERT(seen > 0);
+  return result;
+}
+
+}
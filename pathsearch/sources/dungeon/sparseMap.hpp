@@ -0,0 +1,56 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// A map too large to keep every tile, e.g. past 16k x 16k. Stored in the same
+// 2^CHUNK_BITS square chunks as MapStore, but chunks that are all wall are not
+// allocated: they point to one shared wall chunk until something else is written
+// there. Memory follows the walkable area, plus a pointer table of 16 bytes per chunk.
+// Indices are 64 bit, coordinates are ints.
+// Not thread-safe, view() may only be searched while nobody writes.
+class SparseDungeon
+{
+ public:
+  // Starts out as all wall, nothing is allocated but the chunk table
+  SparseDungeon(int width, int height);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  Tile get(glm::ivec2 pos) const;
+  void set(glm::ivec2 pos, Tile tile);
+
+  // Stays valid and follows set() for as long as the dungeon lives
+  SparseDungeonView view() const;
+
+  std::size_t allocatedChunks() const { return allocated_; }
+  // Frees chunks that are all wall again, returns how many
+  std::size_t compact();
+
+ private:
+  std::size_t chunkIndex(glm::ivec2 pos) const;
+
+  int width_;
+  int height_;
+  std::int64_t chunksX_;
+
+  std::vector<std::unique_ptr<MapChunk>> chunks_;
+  // Same chunks as raw pointers, the shared wall chunk where none is allocated.
+  // The data handle of view().
+  std::vector<const Tile*> chunkTable_;
+  std::size_t allocated_{0};
+};
+
+// Only looks into allocated chunks, the rest is known to be wall
+glm::ivec2 find_walkable_tile(const SparseDungeon& dungeon);
+
+}
@@ -0,0 +1,72 @@
+#include "walkableIndex.hpp"
+#include "grid.hpp"
+
+
+namespace dungeon
+{
+
+WalkableIndex::WalkableIndex(DungeonView dungeon, int regionSize)
+  : width_{dungeon.extent(1)}
+  , height_{dungeon.extent(0)}
+  , regionSize_{regionSize}
+  , regionCount_{(glm::ivec2{width_, height_} + regionSize - 1) / regionSize}
+  , regions_(static_cast<std::size_t>(regionCount_.x) * regionCount_.y)
+  , slots_(static_cast<std::size_t>(width_) * height_)
+{
+  NG_ASSERT(regionSize_ > 0);
+
+  for (int y = 0; y < height_; ++y)
+    for (int x = 0; x < width_; ++x)
+      if (dungeon(y, x) == Tile::Floor)
+        insert({x, y});
+}
+
+bool WalkableIndex::contains(glm::ivec2 v) const
+{
+  return inBounds(v, DungeonExtents{height_, width_}) && slots_[tileIndex(v)].all != NONE;
+}
+
+void WalkableIndex::update(glm::ivec2 v, Tile tile)
+{
+  NG_ASSERT(inBounds(v, DungeonExtents{height_, width_}));
+  const bool walkable = tile == Tile::Floor;
+  if (walkable == (slots_[tileIndex(v)].all != NONE))
+    return;
+
+  if (walkable)
+    insert(v);
+  else
+    erase(v);
+}
+
+void WalkableIndex::insert(glm::ivec2 v)
+{
+  auto& slots = slots_[tileIndex(v)];
+  auto& region = regions_[regionIndex(regionOf(v))];
+
+  slots.all = static_cast<std::uint32_t>(tiles_.size());
+  tiles_.push_back(v);
+  slots.region = static_cast<std::uint32_t>(region.size());
+  region.push_back(v);
+}
+
+void WalkableIndex::erase(glm::ivec2 v)
+{
+  auto& slots = slots_[tileIndex(v)];
+  auto& region = regions_[regionIndex(regionOf(v))];
+
+  // The last entries take the freed slots
+  const auto last = tiles_.back();
+  tiles_[slots.all] = last;
+  slots_[tileIndex(last)].all = slots.all;
+  tiles_.pop_back();
+
+  const auto regionLast = region.back();
+  region[slots.region] = regionLast;
+  slots_[tileIndex(regionLast)].region = slots.region;
+  region.pop_back();
+
+  slots = {};
+}
+
+}
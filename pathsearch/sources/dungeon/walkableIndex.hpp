@@ -0,0 +1,91 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "assert.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+// Floor tiles of a map kept in flat lists, so that a uniformly random one is O(1)
+// to draw instead of a scan of the map. Walkable means Tile::Floor, as with find_walkable_tile.
+// Tiles are also bucketed into regionSize square regions, each sampled on its own.
+// Every tile remembers its slots in both lists, removal swaps the last entry in,
+// so updates are O(1) too. Costs two indices per map tile.
+class WalkableIndex
+{
+ public:
+  WalkableIndex() = default;
+  explicit WalkableIndex(DungeonView dungeon, int regionSize = 16);
+
+  std::size_t size() const { return tiles_.size(); }
+  bool empty() const { return tiles_.empty(); }
+  bool contains(glm::ivec2 v) const;
+
+  // Must be called after the tile at v changed, does nothing if it stayed (non-)walkable
+  void update(glm::ivec2 v, Tile tile);
+
+  glm::ivec2 regionOf(glm::ivec2 v) const { return v / regionSize_; }
+  glm::ivec2 regionCount() const { return regionCount_; }
+  std::size_t sizeOf(glm::ivec2 region) const { return regions_[regionIndex(region)].size(); }
+
+  template<class Rng>
+  glm::ivec2 sample(Rng& rng) const
+  {
+    NG_ASSERT(!tiles_.empty());
+    return tiles_[std::uniform_int_distribution<std::size_t>(0, tiles_.size() - 1)(rng)];
+  }
+
+  // Nothing if the region has no floor
+  template<class Rng>
+  std::optional<glm::ivec2> sampleIn(glm::ivec2 region, Rng& rng) const
+  {
+    const auto& tiles = regions_[regionIndex(region)];
+    if (tiles.empty())
+      return std::nullopt;
+    return tiles[std::uniform_int_distribution<std::size_t>(0, tiles.size() - 1)(rng)];
+  }
+
+  // Independent draws, the same tile may come up more than once
+  template<class Rng>
+  void sample(std::span<glm::ivec2> out, Rng& rng) const
+  {
+    NG_ASSERT(!tiles_.empty());
+    std::uniform_int_distribution<std::size_t> distr(0, tiles_.size() - 1);
+    for (auto& v : out)
+      v = tiles_[distr(rng)];
+  }
+
+ private:
+  static constexpr std::uint32_t NONE = static_cast<std::uint32_t>(-1);
+
+  struct Slots
+  {
+    std::uint32_t all{NONE};
+    std::uint32_t region{NONE};
+  };
+
+  std::size_t tileIndex(glm::ivec2 v) const { return static_cast<std::size_t>(v.y) * width_ + v.x; }
+  std::size_t regionIndex(glm::ivec2 region) const { return static_cast<std::size_t>(region.y) * regionCount_.x + region.x; }
+
+  void insert(glm::ivec2 v);
+  void erase(glm::ivec2 v);
+
+  int width_{0};
+  int height_{0};
+  int regionSize_{1};
+  glm::ivec2 regionCount_{};
+
+  std::vector<glm::ivec2> tiles_;
+  std::vector<std::vector<glm::ivec2>> regions_;
+  std::vector<Slots> slots_;
+};
+
+}
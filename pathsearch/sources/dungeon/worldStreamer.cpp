@@ -0,0 +1,611 @@
+#include "worldStreamer.hpp"
+#include "dungeon/bestFirst.hpp"
+#include "dungeon/grid.hpp"
+#include "dungeonGenerator.hpp"
+#include "dungeonUtils.hpp"
+#include "assert.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+#include <utility>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+int floorDiv(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+int chebyshev(glm::ivec2 a, glm::ivec2 b)
+{
+  return std::max(std::abs(a.x - b.x), std::abs(a.y - b.y));
+}
+
+// Lets weight() read the world like a DungeonView, loading chunks as needed
+struct WorldTiles
+{
+  WorldStreamer& world;
+
+  Tile operator()(int y, int x) const { return world.get({x, y}); }
+};
+
+// The end points of a search are (chunk, START) and (chunk, FINISH), portals are (chunk, index in its hierarchy)
+struct WorldNode
+{
+  static constexpr std::uint32_t START = static_cast<std::uint32_t>(-1);
+  static constexpr std::uint32_t FINISH = static_cast<std::uint32_t>(-2);
+
+  glm::ivec2 chunk;
+  std::uint32_t portal;
+
+  bool operator==(const WorldNode&) const = default;
+};
+
+struct WorldNodeHash
+{
+  std::size_t operator()(const WorldNode& node) const { return std::hash<glm::ivec2>{}(node.chunk) * 31 + node.portal; }
+};
+
+// How a node was reached
+struct Step
+{
+  enum class Kind : std::uint8_t
+  {
+    // From the start to a portal of its cell, ends on tile
+    Enter,
+    // A precomputed edge of the chunk hierarchy
+    Edge,
+    // Onto the same portal in the hierarchy of the neighbour
+    Cross,
+    // From a portal of the finish cell, starts on tile
+    Leave,
+    // Start and finish share a cell
+    Direct,
+  };
+
+  Kind kind;
+  glm::ivec2 tile{};
+  std::uint32_t edge{0};
+};
+
+// Dijkstra over one cell of a chunk, in chunk coordinates. Without an overlay a step costs
+// the same both ways, so a field around the finish also tells the way to it.
+struct CellField
+{
+  glm::ivec2 source;
+  glm::ivec2 min;
+  int size;
+  std::vector<float> dists;
+  std::vector<glm::ivec2> previous;
+
+  std::size_t index(glm::ivec2 v) const { return static_cast<std::size_t>((v.y - min.y) * size + v.x - min.x); }
+  float get(glm::ivec2 v) const { return dists[index(v)]; }
+  void set(glm::ivec2 v, float dist) { dists[index(v)] = dist; }
+};
+
+CellField cellField(DungeonView chunk, glm::ivec2 source, int cellSize, SearchStats* stats)
+{
+  struct Hooks : SearchHooks<glm::ivec2, float>
+  {
+    CellField& field;
+
+    void relaxed(glm::ivec2 from, glm::ivec2 to) { field.previous[field.index(to)] = from; }
+  };
+
+  const auto min = source / cellSize * cellSize;
+  const auto tiles = static_cast<std::size_t>(cellSize * cellSize);
+  CellField field{source, min, cellSize, std::vector<float>(tiles, INF), std::vector<glm::ivec2>(tiles, source)};
+  const GridGraph<DungeonView, FourConnected, FloatCost> graph{chunk, nullptr, min, min + cellSize};
+  BinaryHeap<float, glm::ivec2> open;
+  Hooks hooks{{}, field};
+
+  field.set(source, 0);
+  open.push(0.f, source);
+  count(stats, Counter::Pushes);
+  ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+  bestFirst(graph, ZeroHeuristic<FloatCost>{}, open, field, hooks, unlimited, stats);
+  return field;
+}
+
+// Steps along x, then along y. Only meant for moving inside a portal, where every tile is walkable.
+void walkTo(CompressedPath& path, glm::ivec2 target)
+{
+  while (path.back() != target)
+  {
+    auto next = path.back();
+    if (next.x != target.x)
+      next.x += next.x < target.x ? 1 : -1;
+    else
+      next.y += next.y < target.y ? 1 : -1;
+    path.push_back(next);
+  }
+}
+
+}
+
+// A* over the portals of every chunk hierarchy it runs into, plus the two end points.
+// Chunks and hierarchies are loaded as their portals come up.
+class WorldSearch
+{
+ public:
+  using Node = WorldNode;
+
+  WorldSearch(WorldStreamer& world, glm::ivec2 start, glm::ivec2 finish, SearchStats* stats)
+    : world_{world}
+    , start_{start}
+    , finish_{finish}
+    , startChunk_{world.chunkOf(start)}
+    , finishChunk_{world.chunkOf(finish)}
+    , min_{glm::min(startChunk_, finishChunk_) - world.params().searchMargin}
+    , max_{glm::max(startChunk_, finishChunk_) + world.params().searchMargin}
+    , stats_{stats}
+  {
+  }
+
+  SearchResult run()
+  {
+    PhaseTimer timer{stats_, Phase::Total};
+
+    SearchResult result;
+    if (world_.get(start_) == Tile::Wall || world_.get(finish_) == Tile::Wall)
+      return result;
+
+    const auto cellSize = world_.params().cellSize;
+    startField_.emplace(cellField(chunkView(startChunk_), local(start_), cellSize, stats_));
+    finishField_.emplace(cellField(chunkView(finishChunk_), local(finish_), cellSize, stats_));
+
+    // Ways out of the finish cell, by portal of the finish chunk
+    const auto& finishHierarchy = world_.hierarchyOf(finishChunk_);
+    for (auto p : finishHierarchy.data.portalsOfCell((finish_ - finishHierarchy.origin) / cellSize))
+      if (const auto[tile, dist] = closestTile(*finishField_, finishChunk_, p); dist < INF)
+        exits_.emplace(p, std::make_pair(tile, dist));
+
+    const Node start{startChunk_, Node::START};
+    const Node finish{finishChunk_, Node::FINISH};
+    QuaternaryHeap<float, Node> open;
+    dists_.set(start, 0);
+    open.push((*this)(start), start);
+    count(stats_, Counter::Pushes);
+    Hooks hooks{{}, previous_};
+    ExpansionBudget unlimited{ExpansionBudget::UNLIMITED};
+    bestFirst(*this, *this, open, dists_, hooks, unlimited, stats_);
+
+    if (dists_.get(finish) >= INF)
+      return result;
+
+    std::vector<std::pair<Node, Step>> steps;
+    for (auto node = finish; node != start; node = previous_.at(node).first)
+      steps.emplace_back(node, previous_.at(node).second);
+    std::reverse(steps.begin(), steps.end());
+
+    result.path.push_back(start_);
+    for (const auto&[node, step] : steps)
+      switch (step.kind)
+      {
+        case Step::Kind::Enter:
+          walkAlong(result.path, *startField_, startChunk_, local(step.tile), true);
+          break;
+        case Step::Kind::Edge:
+        {
+          const auto& hierarchy = world_.hierarchyOf(node.chunk);
+          for (auto v : hierarchy.data.pathOf(hierarchy.data.edges[step.edge]))
+            walkTo(result.path, v + hierarchy.origin);
+          break;
+        }
+        case Step::Kind::Cross:
+          break;
+        case Step::Kind::Leave:
+          walkTo(result.path, step.tile);
+          walkAlong(result.path, *finishField_, finishChunk_, local(step.tile), false);
+          break;
+        case Step::Kind::Direct:
+          walkAlong(result.path, *startField_, startChunk_, local(finish_), true);
+          break;
+      }
+
+    auto it = result.path.begin();
+    for (auto previous = *it++; it != result.path.end(); previous = *it++)
+      result.dist += weight(WorldTiles{world_}, previous, *it);
+    return result;
+  }
+
+  // The heuristic
+  float operator()(const Node& node) const
+  {
+    if (node.portal == Node::FINISH)
+      return 0;
+    if (node.portal == Node::START)
+      return ivecDist(start_, finish_);
+    const auto& hierarchy = world_.hierarchyOf(node.chunk);
+    return glm::length(hierarchy.data.portals[node.portal].midpoint() + glm::vec2{hierarchy.origin} - glm::vec2{finish_});
+  }
+
+  template<class F>
+  void forEachSuccessor(const Node& node, F&& f) const
+  {
+    if (node.portal == Node::FINISH)
+      return;
+
+    const auto cellSize = world_.params().cellSize;
+    auto& hierarchy = world_.hierarchyOf(node.chunk);
+
+    if (node.portal == Node::START)
+    {
+      for (auto p : hierarchy.data.portalsOfCell((start_ - hierarchy.origin) / cellSize))
+        if (const auto[tile, dist] = closestTile(*startField_, startChunk_, p); dist < INF)
+          f(Node{startChunk_, p}, dist, Step{.kind = Step::Kind::Enter, .tile = tile});
+      if (startChunk_ == finishChunk_ && (start_ - hierarchy.origin) / cellSize == (finish_ - hierarchy.origin) / cellSize)
+        if (const auto dist = startField_->get(local(finish_)); dist < INF)
+          f(Node{finishChunk_, Node::FINISH}, dist, Step{.kind = Step::Kind::Direct});
+      return;
+    }
+
+    const auto& portal = hierarchy.data.portals[node.portal];
+    for (std::uint32_t e = portal.firstEdge; e < portal.firstEdge + portal.edgeCount; ++e)
+    {
+      // Ring cells only know part of their portals, their edges are left to the neighbour that owns them
+      const auto& edge = hierarchy.data.edges[e];
+      if (inChunk(edge.pathFirst + hierarchy.origin, node.chunk))
+        f(Node{node.chunk, edge.to}, edge.dist, Step{.kind = Step::Kind::Edge, .edge = e});
+    }
+
+    if (const auto neighbour = acrossBorder(hierarchy, portal, node.chunk); neighbour && inBounds(*neighbour))
+    {
+      const auto& other = world_.hierarchyOf(*neighbour);
+      auto it = other.borderPortals.find(portal.topLeft + hierarchy.origin);
+      // Both chunks found the portal in the same tiles, release builds skip the crossing otherwise
+      NG_ASSERT(it != other.borderPortals.end());
+      if (it != other.borderPortals.end())
+        f(Node{*neighbour, it->second}, 0.f, Step{.kind = Step::Kind::Cross});
+    }
+
+    if (node.chunk == finishChunk_)
+      if (auto it = exits_.find(node.portal); it != exits_.end())
+        f(Node{finishChunk_, Node::FINISH}, it->second.second, Step{.kind = Step::Kind::Leave, .tile = it->second.first});
+  }
+
+ private:
+  class Dists
+  {
+   public:
+    float get(const Node& node) const
+    {
+      auto it = dists_.find(node);
+      return it == dists_.end() ? INF : it->second;
+    }
+    void set(const Node& node, float dist) { dists_.insert_or_assign(node, dist); }
+
+   private:
+    std::unordered_map<Node, float, WorldNodeHash> dists_;
+  };
+
+  using Previous = std::unordered_map<Node, std::pair<Node, Step>, WorldNodeHash>;
+
+  struct Hooks : SearchHooks<Node, float>
+  {
+    Previous& previous;
+
+    bool done(float, const Node& top) const { return top.portal == Node::FINISH; }
+    void relaxed(const Node& from, const Node& to, const Step& step) { previous.insert_or_assign(to, std::make_pair(from, step)); }
+  };
+
+  glm::ivec2 chunkOrigin(glm::ivec2 chunk) const { return chunk * world_.params().chunkSize; }
+  glm::ivec2 local(glm::ivec2 v) const { return v - chunkOrigin(world_.chunkOf(v)); }
+  DungeonView chunkView(glm::ivec2 chunk) const { return world_.loaded(chunk).tiles.view; }
+
+  bool inChunk(glm::ivec2 v, glm::ivec2 chunk) const { return world_.chunkOf(v) == chunk; }
+  bool inBounds(glm::ivec2 chunk) const { return glm::all(glm::greaterThanEqual(chunk, min_)) && glm::all(glm::lessThanEqual(chunk, max_)); }
+
+  // The chunk on the other side, if the portal crosses the border of this one
+  std::optional<glm::ivec2> acrossBorder(const WorldStreamer::Hierarchy& hierarchy, const Portal& portal, glm::ivec2 chunk) const
+  {
+    if (!hierarchy.borderPortals.contains(portal.topLeft + hierarchy.origin))
+      return std::nullopt;
+    const auto first = world_.chunkOf(portal.topLeft + hierarchy.origin);
+    return first != chunk ? first : world_.chunkOf(portal.bottomRight - 1 + hierarchy.origin);
+  }
+
+  // The tile of the portal inside the field's cell that is closest to its source, in world coordinates
+  std::pair<glm::ivec2, float> closestTile(const CellField& field, glm::ivec2 chunk, std::uint32_t p) const
+  {
+    const auto& hierarchy = world_.hierarchyOf(chunk);
+    const auto& portal = hierarchy.data.portals[p];
+    const auto offset = hierarchy.origin - chunkOrigin(chunk);
+    const auto min = glm::max(portal.topLeft + offset, field.min);
+    const auto max = glm::min(portal.bottomRight + offset, field.min + field.size);
+
+    std::pair<glm::ivec2, float> result{min + chunkOrigin(chunk), INF};
+    for (int y = min.y; y < max.y; ++y)
+      for (int x = min.x; x < max.x; ++x)
+        if (field.get({x, y}) < result.second)
+          result = {glm::ivec2{x, y} + chunkOrigin(chunk), field.get({x, y})};
+    return result;
+  }
+
+  // From the field's source to v, or the other way round
+  void walkAlong(CompressedPath& path, const CellField& field, glm::ivec2 chunk, glm::ivec2 v, bool fromSource) const
+  {
+    std::vector<glm::ivec2> tiles;
+    for (auto t = v; t != field.source; t = field.previous[field.index(t)])
+      tiles.push_back(t + chunkOrigin(chunk));
+    tiles.push_back(field.source + chunkOrigin(chunk));
+    if (fromSource)
+      std::reverse(tiles.begin(), tiles.end());
+    for (auto t : tiles)
+      walkTo(path, t);
+  }
+
+  WorldStreamer& world_;
+  glm::ivec2 start_;
+  glm::ivec2 finish_;
+  glm::ivec2 startChunk_;
+  glm::ivec2 finishChunk_;
+  // Chunks the search may enter
+  glm::ivec2 min_;
+  glm::ivec2 max_;
+  SearchStats* stats_;
+
+  std::optional<CellField> startField_;
+  std::optional<CellField> finishField_;
+  // Portal of the finish chunk -> tile of it in the finish cell and the cost from there
+  std::unordered_map<std::uint32_t, std::pair<glm::ivec2, float>> exits_;
+  Dists dists_;
+  Previous previous_;
+};
+
+WorldStreamer::WorldStreamer(const WorldParams& params)
+  : params_{params}
+{
+  NG_ASSERT(params_.cellSize > 0 && params_.chunkSize >= 3 && params_.chunkSize % params_.cellSize == 0);
+
+  const auto threads = params_.threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : params_.threads;
+  workers_.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i)
+    workers_.emplace_back([this](std::stop_token stop) { work(stop); });
+}
+
+glm::ivec2 WorldStreamer::chunkOf(glm::ivec2 pos) const
+{
+  return {floorDiv(pos.x, params_.chunkSize), floorDiv(pos.y, params_.chunkSize)};
+}
+
+int WorldStreamer::focusDistance(glm::ivec2 coord) const
+{
+  int result = std::numeric_limits<int>::max();
+  for (auto focus : focus_)
+    result = std::min(result, chebyshev(coord, focus));
+  return result;
+}
+
+void WorldStreamer::setFocus(std::span<const glm::ivec2> positions)
+{
+  focus_.clear();
+  for (auto pos : positions)
+    focus_.push_back(chunkOf(pos));
+
+  // Ring by ring, the closest chunks are needed first
+  std::vector<std::shared_ptr<Chunk>> missing;
+  for (int ring = 0; ring <= params_.prefetchRadius; ++ring)
+    for (auto focus : focus_)
+      for (int y = -ring; y <= ring; ++y)
+        for (int x = -ring; x <= ring; ++x)
+        {
+          if (std::max(std::abs(x), std::abs(y)) != ring)
+            continue;
+          const auto coord = focus + glm::ivec2{x, y};
+          auto& slot = chunks_[coord];
+          if (slot)
+            continue;
+          slot = std::make_shared<Chunk>(Chunk{.coord = coord});
+          missing.push_back(slot);
+        }
+
+  {
+    std::lock_guard lock{mutex_};
+    // Agents walked away before anybody got to these
+    std::erase_if(queue_, [this](const std::shared_ptr<Chunk>& chunk)
+      {
+        if (chunk->claimed)
+          return true;
+        if (focusDistance(chunk->coord) <= params_.prefetchRadius)
+          return false;
+        const auto coord = chunk->coord;
+        chunks_.erase(coord);
+        return true;
+      });
+    queue_.insert(queue_.end(), missing.begin(), missing.end());
+  }
+  changed_.notify_all();
+
+  evict();
+}
+
+Tile WorldStreamer::get(glm::ivec2 pos)
+{
+  const auto coord = chunkOf(pos);
+  const auto local = pos - coord * params_.chunkSize;
+  return loaded(coord).tiles.view(local.y, local.x);
+}
+
+SearchResult WorldStreamer::findPath(glm::ivec2 start, glm::ivec2 finish, SearchStats* stats)
+{
+  // Everything the search touched stays loaded until it is done
+  auto result = WorldSearch{*this, start, finish, stats}.run();
+  evict();
+  return result;
+}
+
+WorldCounters WorldStreamer::counters() const
+{
+  auto result = counters_;
+  std::lock_guard lock{mutex_};
+  result.generated += generatedByWorkers_;
+  for (const auto&[coord, chunk] : chunks_)
+    if (chunk->ready)
+    {
+      ++result.loadedChunks;
+      result.hierarchies += chunk->hierarchy ? 1 : 0;
+      result.memoryBytes += memoryOf(*chunk);
+    }
+  return result;
+}
+
+WorldStreamer::Chunk& WorldStreamer::loaded(glm::ivec2 coord)
+{
+  auto& slot = chunks_[coord];
+  if (!slot)
+    slot = std::make_shared<Chunk>(Chunk{.coord = coord});
+  auto& chunk = *slot;
+  chunk.lastUse = ++uses_;
+  if (chunk.seenReady)
+    return chunk;
+
+  std::unique_lock lock{mutex_};
+  if (!chunk.claimed)
+  {
+    // Nobody got to it yet, waiting in the queue would only add to the latency
+    chunk.claimed = true;
+    lock.unlock();
+    generate(chunk);
+    lock.lock();
+    chunk.ready = true;
+    ++counters_.generated;
+    ++counters_.generatedInline;
+  }
+  changed_.wait(lock, [&chunk]() { return chunk.ready; });
+  chunk.seenReady = true;
+  return chunk;
+}
+
+WorldStreamer::Hierarchy& WorldStreamer::hierarchyOf(glm::ivec2 coord)
+{
+  auto& chunk = loaded(coord);
+  if (chunk.hierarchy)
+    return *chunk.hierarchy;
+
+  const auto chunkSize = params_.chunkSize;
+  const auto cellSize = params_.cellSize;
+  const auto side = chunkSize + 2 * cellSize;
+  const auto origin = coord * chunkSize - cellSize;
+
+  // The chunk and a ring of one cell taken from its neighbours
+  auto padded = make_dungeon(side, side);
+  for (int dy = -1; dy <= 1; ++dy)
+    for (int dx = -1; dx <= 1; ++dx)
+    {
+      const auto neighbour = coord + glm::ivec2{dx, dy};
+      const auto source = loaded(neighbour).tiles.view;
+      const auto sourceOrigin = neighbour * chunkSize;
+      const auto min = glm::max(origin, sourceOrigin);
+      const auto max = glm::min(origin + side, sourceOrigin + chunkSize);
+      for (int y = min.y; y < max.y; ++y)
+        for (int x = min.x; x < max.x; ++x)
+          padded.view(y - origin.y, x - origin.x) = source(y - sourceOrigin.y, x - sourceOrigin.x);
+    }
+
+  Hierarchy hierarchy{.data = buildHierarchy(padded.view, cellSize), .origin = origin};
+  // The world search never asks, and they would be most of the memory
+  hierarchy.data.components = {};
+
+  const glm::ivec2 lo{cellSize};
+  const glm::ivec2 hi{cellSize + chunkSize};
+  for (std::uint32_t i = 0; i < hierarchy.data.portals.size(); ++i)
+  {
+    const auto& portal = hierarchy.data.portals[i];
+    const bool inside = glm::all(glm::lessThan(glm::max(portal.topLeft, lo), glm::min(portal.bottomRight, hi)));
+    const bool outside = glm::any(glm::lessThan(portal.topLeft, lo)) || glm::any(glm::greaterThan(portal.bottomRight, hi));
+    if (inside && outside)
+      hierarchy.borderPortals.emplace(portal.topLeft + origin, i);
+  }
+
+  hierarchy.memoryBytes = hierarchy.data.portals.size() * sizeof(Portal)
+    + hierarchy.data.edges.size() * sizeof(PortalEdge)
+    + hierarchy.data.pathRuns.size()
+    + (hierarchy.data.cellPortalOffsets.size() + hierarchy.data.cellPortals.size()) * sizeof(std::uint32_t)
+    // A node and a bucket per entry
+    + hierarchy.borderPortals.size() * (sizeof(std::pair<const glm::ivec2, std::uint32_t>) + 2 * sizeof(void*));
+
+  ++counters_.hierarchiesBuilt;
+  chunk.hierarchy.emplace(std::move(hierarchy));
+  return *chunk.hierarchy;
+}
+
+void WorldStreamer::generate(Chunk& chunk)
+{
+  chunk.tiles = make_dungeon(params_.chunkSize, params_.chunkSize);
+  gen_world_chunk(chunk.tiles.view, chunk.coord, params_.seed, params_.doorsPerSide);
+}
+
+void WorldStreamer::work(std::stop_token stop)
+{
+  for (;;)
+  {
+    std::shared_ptr<Chunk> chunk;
+    {
+      std::unique_lock lock{mutex_};
+      if (!changed_.wait(lock, stop, [this]() { return !queue_.empty(); }))
+        return;
+      chunk = std::move(queue_.front());
+      queue_.pop_front();
+      if (chunk->claimed)
+        continue;
+      chunk->claimed = true;
+    }
+
+    generate(*chunk);
+
+    {
+      std::lock_guard lock{mutex_};
+      chunk->ready = true;
+      ++generatedByWorkers_;
+    }
+    changed_.notify_all();
+  }
+}
+
+std::size_t WorldStreamer::memoryOf(const Chunk& chunk)
+{
+  return sizeof(Chunk) + chunk.tiles.data.capacity() + (chunk.hierarchy ? chunk.hierarchy->memoryBytes : 0);
+}
+
+void WorldStreamer::evict()
+{
+  std::size_t total = 0;
+  std::vector<std::pair<int, Chunk*>> candidates;
+  {
+    std::lock_guard lock{mutex_};
+    for (const auto&[coord, chunk] : chunks_)
+    {
+      if (!chunk->ready)
+        continue;
+      total += memoryOf(*chunk);
+      // Around the agents they would only be generated again right away
+      if (const auto distance = focusDistance(coord); distance > params_.prefetchRadius)
+        candidates.emplace_back(distance, chunk.get());
+    }
+  }
+  if (total <= params_.memoryCap)
+    return;
+
+  // Farthest first, the least recently used of equally far ones
+  std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b)
+    { return a.first != b.first ? a.first > b.first : a.second->lastUse < b.second->lastUse; });
+
+  for (const auto&[distance, chunk] : candidates)
+  {
+    if (total <= params_.memoryCap)
+      break;
+    total -= memoryOf(*chunk);
+    const auto coord = chunk->coord;
+    chunks_.erase(coord);
+    ++counters_.evicted;
+  }
+}
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "dungeon.hpp"
+#include "pathsearch.hpp"
+#include "searchStats.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+
+namespace dungeon
+{
+
+struct WorldParams
+{
+  std::uint64_t seed{0};
+  // Side of a chunk in tiles, a multiple of cellSize
+  int chunkSize{64};
+  int cellSize{8};
+  int doorsPerSide{2};
+  // Ready chunks past this are evicted, the ones farthest from every focus first
+  std::size_t memoryCap{std::size_t{64} << 20};
+  // Chunks this close to a focus are generated ahead of time and never evicted
+  int prefetchRadius{2};
+  // Searches stay inside the chunks around start and finish grown by this many chunks
+  int searchMargin{2};
+  // Background generators, 0 means one per hardware thread
+  unsigned threads{0};
+};
+
+struct WorldCounters
+{
+  std::size_t loadedChunks{0};
+  std::size_t hierarchies{0};
+  std::size_t memoryBytes{0};
+  // Since construction, evicted chunks count again when they come back
+  std::uint64_t generated{0};
+  std::uint64_t generatedInline{0};
+  std::uint64_t hierarchiesBuilt{0};
+  std::uint64_t evicted{0};
+};
+
+// An endless map made of chunks that are generated with gen_world_chunk on background
+// threads as agents approach them and dropped again once they are far away and memory runs short.
+// A chunk's hierarchy is built the first time a search touches it, from the chunk plus a ring
+// of one cell taken from its neighbours, so its border portals are found exactly as in
+// buildHierarchy. Portals on a border appear in the hierarchies of both chunks and are
+// matched by their world position when a search crosses it: nothing points from one chunk
+// into another, so chunks come and go in any order and a regenerated chunk matches its
+// neighbours again. Everything but the generation runs on the calling thread, one at a time.
+class WorldStreamer
+{
+ public:
+  explicit WorldStreamer(const WorldParams& params = {});
+
+  // Where the agents are. Queues the missing chunks around them, nearest first, and
+  // evicts far away ones if over the cap.
+  void setFocus(std::span<const glm::ivec2> positions);
+
+  // Waits for the chunk of pos, generating it right here if no thread picked it up yet
+  Tile get(glm::ivec2 pos);
+
+  // HPA* over the chunk hierarchies, from and to any walkable tiles. Loads and builds what
+  // it touches, evicts afterwards. No overlay support, an empty path if there is none.
+  SearchResult findPath(glm::ivec2 start, glm::ivec2 finish, SearchStats* stats = nullptr);
+
+  glm::ivec2 chunkOf(glm::ivec2 pos) const;
+  const WorldParams& params() const { return params_; }
+  WorldCounters counters() const;
+
+ private:
+  struct Hierarchy
+  {
+    HierarchicalSearchData data;
+    // World position of tile (0, 0) of data, one cell up and left of the chunk
+    glm::ivec2 origin;
+    // Portals across the chunk border by world top left, to find their twins from the neighbours
+    std::unordered_map<glm::ivec2, std::uint32_t> borderPortals;
+    std::size_t memoryBytes{0};
+  };
+
+  struct Chunk
+  {
+    glm::ivec2 coord;
+    // Written by whoever claimed the chunk, read once it is ready
+    Dungeon tiles;
+    // Guarded by mutex_
+    bool claimed{false};
+    bool ready{false};
+    // Calling thread only, set once it saw ready
+    bool seenReady{false};
+    std::optional<Hierarchy> hierarchy;
+    std::uint64_t lastUse{0};
+  };
+
+  friend class WorldSearch;
+
+  Chunk& loaded(glm::ivec2 coord);
+  Hierarchy& hierarchyOf(glm::ivec2 coord);
+  void generate(Chunk& chunk);
+  void work(std::stop_token stop);
+  void evict();
+  // In chunks, to the closest focus
+  int focusDistance(glm::ivec2 coord) const;
+  static std::size_t memoryOf(const Chunk& chunk);
+
+  WorldParams params_;
+
+  // Calling thread only, workers get their chunks through queue_
+  std::unordered_map<glm::ivec2, std::shared_ptr<Chunk>> chunks_;
+  std::vector<glm::ivec2> focus_;
+  std::uint64_t uses_{0};
+  WorldCounters counters_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable_any changed_;
+  std::deque<std::shared_ptr<Chunk>> queue_;
+  std::uint64_t generatedByWorkers_{0};
+
+  // Last, so that they are stopped and joined first
+  std::vector<std::jthread> workers_;
+};
+
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <function2/function2.hpp>
+#include <allegro5/allegro5.h>
+#include <allegro5/allegro_primitives.h>
+
+#include "assert.hpp"
+#include "tileCache.hpp"
+#include "util.hpp"
+#include "dungeon/dungeon.hpp"
+
+
+// Flat colored screen-space quads, collected over a frame and drawn with a single call
+class QuadBatch
+{
+ public:
+  void add(glm::vec2 min, glm::vec2 max, ALLEGRO_COLOR color)
+  {
+    auto vertex = [color](float x, float y) { return ALLEGRO_VERTEX{.x = x, .y = y, .z = 0, .u = 0, .v = 0, .color = color}; };
+    vertices_.push_back(vertex(min.x, min.y));
+    vertices_.push_back(vertex(max.x, min.y));
+    vertices_.push_back(vertex(max.x, max.y));
+    vertices_.push_back(vertex(min.x, min.y));
+    vertices_.push_back(vertex(max.x, max.y));
+    vertices_.push_back(vertex(min.x, max.y));
+  }
+
+  void draw()
+  {
+    if (!vertices_.empty())
+      al_draw_prim(vertices_.data(), nullptr, nullptr, 0, static_cast<int>(vertices_.size()), ALLEGRO_PRIM_TRIANGLE_LIST);
+    vertices_.clear();
+  }
+
+ private:
+  std::vector<ALLEGRO_VERTEX> vertices_;
+};
+
+// The map baked into offscreen bitmaps, TileCache decides which chunks are baked, kept and
+// drawn at the current zoom, this bakes and draws them with Allegro.
+class TileLayer
+{
+ public:
+  // Default constructible, unlike UniquePtr, so that chunks can be moved around the cache
+  struct BitmapDeleter
+  {
+    void operator()(ALLEGRO_BITMAP* bitmap) const { al_destroy_bitmap(bitmap); }
+  };
+
+  using Cache = TileCache<ALLEGRO_BITMAP, BitmapDeleter>;
+  static constexpr int TILE_PIXELS = Cache::TILE_PIXELS;
+  static constexpr int CHUNK = Cache::CHUNK;
+  static constexpr int BITMAP_PIXELS = Cache::BITMAP_PIXELS;
+
+  // Packs the sprites into a single atlas, any size is scaled to TILE_PIXELS
+  void setSprites(std::span<const std::pair<dungeon::Tile, ALLEGRO_BITMAP*>> sprites)
+  {
+    atlas_ = {al_create_bitmap(static_cast<int>(sprites.size()) * TILE_PIXELS, TILE_PIXELS), &al_destroy_bitmap};
+    NG_ASSERT(atlas_.get() != nullptr);
+    tiles_.clear();
+
+    auto* target = al_get_target_bitmap();
+    al_set_target_bitmap(atlas_.get());
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    for (const auto&[tile, bmp] : sprites)
+    {
+      al_draw_scaled_bitmap(bmp,
+        0, 0, al_get_bitmap_width(bmp), al_get_bitmap_height(bmp),
+        static_cast<float>(tiles_.size() * TILE_PIXELS), 0, TILE_PIXELS, TILE_PIXELS, 0);
+      tiles_.push_back(tile);
+    }
+    al_set_target_bitmap(target);
+
+    // Levels below a pixel per tile are filled with the mean color of each sprite,
+    // packed as they are uploaded
+    averages_.clear();
+    al_lock_bitmap(atlas_.get(), ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
+    for (int i = 0; i < static_cast<int>(tiles_.size()); ++i)
+    {
+      float sum[4] = {};
+      for (int y = 0; y < TILE_PIXELS; ++y)
+        for (int x = 0; x < TILE_PIXELS; ++x)
+        {
+          const auto c = al_get_pixel(atlas_.get(), i * TILE_PIXELS + x, y);
+          sum[0] += c.r, sum[1] += c.g, sum[2] += c.b, sum[3] += c.a;
+        }
+      const float n = TILE_PIXELS * TILE_PIXELS;
+      averages_.push_back(packColor(al_map_rgba_f(sum[0] / n, sum[1] / n, sum[2] / n, sum[3] / n)));
+    }
+    al_unlock_bitmap(atlas_.get());
+
+    invalidate();
+  }
+
+  // The whole map changed
+  void invalidate()
+  {
+    cache_.clear();
+  }
+
+  // A single tile changed, only its chunk at each level is baked again
+  void invalidate(glm::ivec2 tile)
+  {
+    cache_.invalidate(tile);
+  }
+
+  // Draws the chunks covering tiles [min, max)
+  void draw(dungeon::DungeonView dungeon, glm::ivec2 min, glm::ivec2 max, fu2::function_view<glm::vec2(glm::vec2)> worldToScreen)
+  {
+    const glm::ivec2 mapSize{dungeon.extent(1), dungeon.extent(0)};
+    if (mapSize != mapSize_)
+    {
+      mapSize_ = mapSize;
+      invalidate();
+    }
+
+    const int level = Cache::level(std::abs(worldToScreen({1, 0}).x - worldToScreen({0, 0}).x));
+    cache_.frame(level, min, max,
+      [&](int bakeLevel, glm::ivec2 chunk) { return bake(dungeon, bakeLevel, chunk); },
+      [&](const Cache::Patch& patch)
+        {
+          const auto screenMin = worldToScreen(glm::vec2{patch.origin});
+          const auto screenMax = worldToScreen(glm::vec2{patch.origin + patch.tiles});
+          al_draw_scaled_bitmap(patch.bitmap, patch.offset.x, patch.offset.y, patch.size, patch.size,
+            screenMin.x, screenMin.y, screenMax.x - screenMin.x, screenMax.y - screenMin.y, 0);
+        });
+  }
+
+ private:
+  // A new bitmap with the chunk of the level drawn into it
+  Cache::BitmapPtr bake(dungeon::DungeonView dungeon, int level, glm::ivec2 chunk)
+  {
+    Cache::BitmapPtr bitmap;
+    const auto flags = al_get_new_bitmap_flags();
+    al_set_new_bitmap_flags(flags | ALLEGRO_MIN_LINEAR);
+    bitmap.reset(al_create_bitmap(BITMAP_PIXELS, BITMAP_PIXELS));
+    al_set_new_bitmap_flags(flags);
+    NG_ASSERT(bitmap.get() != nullptr);
+
+    auto* target = al_get_target_bitmap();
+    al_set_target_bitmap(bitmap.get());
+    const auto origin = chunk * (CHUNK << level);
+    if ((TILE_PIXELS >> level) > 1)
+      bakeSprites(dungeon, level, origin);
+    else
+      bakeColors(dungeon, level, origin);
+    al_set_target_bitmap(target);
+    return bitmap;
+  }
+
+  // Every tile comes from the atlas, so these are batched into a few draw calls
+  void bakeSprites(dungeon::DungeonView dungeon, int level, glm::ivec2 origin)
+  {
+    const int pixels = TILE_PIXELS >> level;
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    al_hold_bitmap_drawing(true);
+    const auto end = glm::min(origin + (CHUNK << level), mapSize_);
+    for (int y = origin.y; y < end.y; ++y)
+      for (int x = origin.x; x < end.x; ++x)
+      {
+        const auto sprite = atlasIndex(dungeon(y, x));
+        if (sprite < 0)
+          continue;
+        al_draw_scaled_bitmap(atlas_.get(),
+          static_cast<float>(sprite * TILE_PIXELS), 0, TILE_PIXELS, TILE_PIXELS,
+          static_cast<float>((x - origin.x) * pixels), static_cast<float>((y - origin.y) * pixels), pixels, pixels,
+          ALLEGRO_FLIP_VERTICAL);
+      }
+    al_hold_bitmap_drawing(false);
+  }
+
+  // A pixel per tile or less, one tile is sampled per pixel into a buffer that is then
+  // copied into the locked bitmap row by row
+  void bakeColors(dungeon::DungeonView dungeon, int level, glm::ivec2 origin)
+  {
+    const int step = (CHUNK << level) / BITMAP_PIXELS;
+    pixels_.assign(static_cast<std::size_t>(BITMAP_PIXELS) * BITMAP_PIXELS, 0);
+    const auto end = glm::min(origin + (CHUNK << level), mapSize_);
+    for (int py = 0; py * step < end.y - origin.y; ++py)
+      for (int px = 0; px * step < end.x - origin.x; ++px)
+      {
+        const auto tile = origin + glm::ivec2{px, py} * step;
+        if (const auto sprite = atlasIndex(dungeon(tile.y, tile.x)); sprite >= 0)
+          pixels_[static_cast<std::size_t>(py) * BITMAP_PIXELS + px] = averages_[sprite];
+      }
+
+    auto* locked = al_lock_bitmap(al_get_target_bitmap(), ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+    NG_ASSERT(locked != nullptr);
+    for (int py = 0; py < BITMAP_PIXELS; ++py)
+      std::memcpy(static_cast<std::uint8_t*>(locked->data) + static_cast<std::ptrdiff_t>(py) * locked->pitch,
+        pixels_.data() + static_cast<std::size_t>(py) * BITMAP_PIXELS, BITMAP_PIXELS * sizeof(std::uint32_t));
+    al_unlock_bitmap(al_get_target_bitmap());
+  }
+
+  // R, G, B, A in memory order, which is ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE
+  static std::uint32_t packColor(ALLEGRO_COLOR color)
+  {
+    unsigned char rgba[4];
+    al_unmap_rgba(color, &rgba[0], &rgba[1], &rgba[2], &rgba[3]);
+    std::uint32_t packed;
+    std::memcpy(&packed, rgba, sizeof(packed));
+    return packed;
+  }
+
+  int atlasIndex(dungeon::Tile tile) const
+  {
+    for (std::size_t i = 0; i < tiles_.size(); ++i)
+      if (tiles_[i] == tile)
+        return static_cast<int>(i);
+    return -1;
+  }
+
+ private:
+  UniquePtr<ALLEGRO_BITMAP> atlas_{nullptr, nullptr};
+  std::vector<dungeon::Tile> tiles_;
+  std::vector<std::uint32_t> averages_;
+  std::vector<std::uint32_t> pixels_;
+
+  glm::ivec2 mapSize_{};
+  Cache cache_;
+};
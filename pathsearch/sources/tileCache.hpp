@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+
+// Which baked chunk every part of the visible map is drawn from, the policy half of TileLayer.
+// It never touches a bitmap itself, so it runs without a display.
+// A chunk of level L covers CHUNK << L tiles baked into BITMAP_PIXELS squared, the level follows
+// the zoom so that a baked tile is never more than twice its size on screen: a zoomed out map is
+// a handful of coarse chunks instead of thousands of full resolution ones. Baking is limited to
+// BAKE_TILES_PER_FRAME tiles and a chunk not ready yet is drawn from a coarser level already
+// baked. The chunks of MAX_LEVEL under the view are baked before any other and dropped after
+// them, so that there is one even after panning away at a fine level, and the least recently
+// used are dropped over MAX_CHUNKS.
+template<class Bitmap, class Deleter>
+class TileCache
+{
+ public:
+  static constexpr int TILE_PIXELS = 16;
+  static constexpr int CHUNK = 32;
+  static constexpr int BITMAP_PIXELS = CHUNK * TILE_PIXELS;
+  static constexpr int MAX_LEVEL = 8;
+  // 1 MiB each, enough for every visible chunk on a 4K screen
+  static constexpr std::size_t MAX_CHUNKS = 192;
+  // Tiles drawn or sampled per frame, a chunk over budget is still baked when it comes first
+  static constexpr int BAKE_TILES_PER_FRAME = 1 << 16;
+
+  using BitmapPtr = std::unique_ptr<Bitmap, Deleter>;
+
+  // Tiles [origin, origin + tiles) drawn from the square of a baked bitmap at offset, in bitmap pixels
+  struct Patch
+  {
+    glm::ivec2 origin;
+    int tiles;
+    Bitmap* bitmap;
+    glm::vec2 offset;
+    float size;
+  };
+
+  // The coarsest level still at least as sharp as the screen, linear filtering is enough
+  // below a 2x reduction so the chunks need no mipmaps
+  static int level(float tilePixels)
+  {
+    int level = 0;
+    while (level < MAX_LEVEL && TILE_PIXELS / static_cast<float>(2 << level) >= tilePixels)
+      ++level;
+    return level;
+  }
+
+  // Tiles drawn or sampled to bake a chunk: a sprite per tile down to 2 pixels, then a tile per pixel
+  static int bakeCost(int level)
+  {
+    const int sampled = std::min(CHUNK << level, BITMAP_PIXELS);
+    return sampled * sampled;
+  }
+
+  // The whole map changed
+  void clear()
+  {
+    chunks_.clear();
+  }
+
+  // A single tile changed, only its chunk at each level is baked again
+  void invalidate(glm::ivec2 tile)
+  {
+    if (!glm::all(glm::greaterThanEqual(tile, glm::ivec2{0})))
+      return;
+    for (int level = 0; level <= MAX_LEVEL; ++level)
+      chunks_.erase(key(level, tile / (CHUNK << level)));
+  }
+
+  // One frame of the chunks of a level covering tiles [min, max). bake(level, chunk) returns
+  // the bitmap of a chunk missing from the cache, draw(patch) is called for every part of them
+  // there is something to draw for.
+  template<class Bake, class Draw>
+  void frame(int level, glm::ivec2 min, glm::ivec2 max, Bake&& bake, Draw&& draw)
+  {
+    ++frame_;
+    if (glm::any(glm::greaterThanEqual(min, max)))
+      return;
+
+    const int span = CHUNK << level;
+    const auto first = min / span;
+    const auto last = (max - 1) / span;
+    int budget = BAKE_TILES_PER_FRAME;
+    const int toBackdrop = MAX_LEVEL - level;
+    for (int y = first.y >> toBackdrop; y <= last.y >> toBackdrop; ++y)
+      for (int x = first.x >> toBackdrop; x <= last.x >> toBackdrop; ++x)
+        if (!chunks_.contains(key(MAX_LEVEL, {x, y})))
+          add(MAX_LEVEL, {x, y}, budget, bake);
+
+    for (int y = first.y; y <= last.y; ++y)
+      for (int x = first.x; x <= last.x; ++x)
+      {
+        const glm::ivec2 c{x, y};
+        auto* bitmap = find(level, c);
+        if (bitmap == nullptr)
+          bitmap = add(level, c, budget, bake);
+        if (bitmap != nullptr)
+        {
+          draw(Patch{c * span, span, bitmap, glm::vec2{0}, static_cast<float>(BITMAP_PIXELS)});
+          continue;
+        }
+        // Not baked yet, stand in with the part of a coarser chunk that covers it
+        for (int up = 1; level + up <= MAX_LEVEL; ++up)
+          if (auto* coarser = find(level + up, c >> up))
+          {
+            const int size = BITMAP_PIXELS >> up;
+            draw(Patch{c * span, span, coarser, glm::vec2{(c - ((c >> up) << up)) * size}, static_cast<float>(size)});
+            break;
+          }
+      }
+
+    evict();
+  }
+
+  std::size_t size() const { return chunks_.size(); }
+
+ private:
+  struct Chunk
+  {
+    BitmapPtr bitmap;
+    std::uint64_t lastUsed = 0;
+  };
+
+  static std::uint64_t key(int level, glm::ivec2 chunk)
+  {
+    return static_cast<std::uint64_t>(level) << 48 | static_cast<std::uint64_t>(chunk.y) << 24 | static_cast<std::uint64_t>(chunk.x);
+  }
+
+  // The baked chunk, marked as used this frame
+  Bitmap* find(int level, glm::ivec2 chunk)
+  {
+    auto it = chunks_.find(key(level, chunk));
+    if (it == chunks_.end())
+      return nullptr;
+    it->second.lastUsed = frame_;
+    return it->second.bitmap.get();
+  }
+
+  // Bakes a missing chunk, or returns null when this frame's budget is spent
+  template<class Bake>
+  Bitmap* add(int level, glm::ivec2 chunk, int& budget, Bake& bake)
+  {
+    if (budget <= 0)
+      return nullptr;
+    budget -= bakeCost(level);
+
+    BitmapPtr bitmap = bake(level, chunk);
+    auto* result = bitmap.get();
+    chunks_[key(level, chunk)] = Chunk{std::move(bitmap), frame_};
+    return result;
+  }
+
+  // Least recently used first and MAX_LEVEL last, never a chunk drawn this frame
+  void evict()
+  {
+    if (chunks_.size() <= MAX_CHUNKS)
+      return;
+    std::vector<std::tuple<bool, std::uint64_t, std::uint64_t>> unused;
+    for (const auto&[k, c] : chunks_)
+      if (c.lastUsed != frame_)
+        unused.emplace_back(k >> 48 == MAX_LEVEL, c.lastUsed, k);
+    std::sort(unused.begin(), unused.end());
+    for (std::size_t i = 0; i < unused.size() && chunks_.size() > MAX_CHUNKS; ++i)
+      chunks_.erase(std::get<2>(unused[i]));
+  }
+
+  std::uint64_t frame_ = 0;
+  std::unordered_map<std::uint64_t, Chunk> chunks_;
+};